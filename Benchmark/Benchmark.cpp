@@ -0,0 +1,786 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "SyntheticShaders.h"
+#include "ShaderTranslator.h"
+#include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationIR.h"
+#include "ShaderTranslationThreadPool.h"
+#include "ShaderTranslationDiskCache.h"
+#include "ShaderTranslationTracer.h"
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <numeric>
+#include <new>
+#include <stdexcept>
+
+using namespace translator;
+using namespace benchmark;
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+// Every heap allocation of the thread, through the operator new below
+thread_local unsigned long long tAllocations = 0;
+thread_local unsigned long long tAllocatedBytes = 0;
+
+// Both replacements go straight to malloc and free, so each new is matched by its own delete
+void* CountedAllocate(size_t size)
+{
+	++tAllocations;
+	tAllocatedBytes += size;
+	if(void* memory = std::malloc(size ? size : 1))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+}
+
+void* operator new(size_t size)
+{
+	return CountedAllocate(size);
+}
+
+void* operator new[](size_t size)
+{
+	return CountedAllocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// A sample is one call, which may handle several items
+struct StageResult
+{
+	explicit StageResult(const std::string& name, bool countsAllocations = true)
+		: Name(name)
+		, Items(0)
+		, Bytes(0)
+		, CountsAllocations(countsAllocations)
+		, Allocations(0)
+		, AllocatedBytes(0)
+		, CopiedBytes(0)
+		, ReportedAllocations(0)
+		, SourceBytes(0)
+		, Speedup(0)
+	{}
+
+	std::string Name;
+	std::vector<double> Microseconds;
+	unsigned long long Items;
+	unsigned long long Bytes;
+	// Only the allocations of the calling thread are counted, so stages that run on the pool don't report them
+	bool CountsAllocations;
+	unsigned long long Allocations;
+	unsigned long long AllocatedBytes;
+	// Written into the output, including the copies made when it grew - reported if set
+	unsigned long long CopiedBytes;
+	// TranslationStats::HeapAllocations of the samples - reported if set. Unlike Allocations it
+	// includes the strings the translator mallocs, but not the allocations of std::regex.
+	unsigned long long ReportedAllocations;
+	// Shader source translated by the samples - reported as time per byte if set
+	unsigned long long SourceBytes;
+	// Against the same stage on a single worker - reported if set
+	double Speedup;
+};
+
+// The function returns the bytes it produced
+template<typename Function>
+void Measure(StageResult& stage, unsigned items, Function function)
+{
+	const unsigned long long allocations = tAllocations;
+	const unsigned long long allocatedBytes = tAllocatedBytes;
+	const Clock::time_point start = Clock::now();
+	const size_t bytes = function();
+	const Clock::time_point end = Clock::now();
+	stage.Allocations += tAllocations - allocations;
+	stage.AllocatedBytes += tAllocatedBytes - allocatedBytes;
+
+	stage.Microseconds.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+	stage.Items += items;
+	stage.Bytes += bytes;
+}
+
+struct Options
+{
+	Options()
+		: Iterations(20)
+		, Threads(0)
+	{}
+
+	SyntheticParams Synthetic;
+	unsigned Iterations;
+	unsigned Threads;
+	std::string Output;
+	std::string Trace;
+};
+
+void PrintUsage()
+{
+	std::cerr << "Usage: TranslatorBenchmark [options]\n"
+		<< "  --atoms N          atoms in the universe\n"
+		<< "  --depth N          length of the combinator chain each atom needs\n"
+		<< "  --fanout N         atoms to choose from in each polymorphic\n"
+		<< "  --body N           filler lines in every body\n"
+		<< "  --nesting N        CONTEXT_IF blocks around each polymorphic use\n"
+		<< "  --siblings N       CONTEXT_IF blocks one after the other after each polymorphic use\n"
+		<< "  --entry-points N   entry points in the shader\n"
+		<< "  --permutations N   permutations translated per iteration\n"
+		<< "  --seed N           seed for picking the permutations\n"
+		<< "  --iterations N     repetitions of every stage\n"
+		<< "  --threads N        workers for the parallel stages, 0 for one per hardware thread\n"
+		<< "  --output FILE      where to write the JSON report instead of the standard output\n"
+		<< "  --trace FILE       write a Chrome trace of one extra, untimed batch\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string name = argv[i];
+		if(name == "--output" && i + 1 < argc)
+		{
+			options.Output = argv[++i];
+			continue;
+		}
+		if(name == "--trace" && i + 1 < argc)
+		{
+			options.Trace = argv[++i];
+			continue;
+		}
+
+		unsigned* value = nullptr;
+		if(name == "--atoms") value = &options.Synthetic.AtomCount;
+		else if(name == "--depth") value = &options.Synthetic.CombinatorDepth;
+		else if(name == "--fanout") value = &options.Synthetic.FanOut;
+		else if(name == "--body") value = &options.Synthetic.BodyLines;
+		else if(name == "--nesting") value = &options.Synthetic.ContextIfNesting;
+		else if(name == "--siblings") value = &options.Synthetic.ContextIfSiblings;
+		else if(name == "--entry-points") value = &options.Synthetic.EntryPoints;
+		else if(name == "--permutations") value = &options.Synthetic.Permutations;
+		else if(name == "--seed") value = &options.Synthetic.Seed;
+		else if(name == "--iterations") value = &options.Iterations;
+		else if(name == "--threads") value = &options.Threads;
+
+		if(!value || i + 1 == argc)
+		{
+			return false;
+		}
+		*value = unsigned(strtoul(argv[++i], nullptr, 10));
+	}
+	return true;
+}
+
+void CheckUniverse(ShaderTranslationUniverse::TranslationUniverseError error, const ShaderTranslationUniverse& universe)
+{
+	if(error != ShaderTranslationUniverse::Ok)
+	{
+		throw std::runtime_error("Unable to load the universe: " + universe.GetLastError());
+	}
+}
+
+void CheckTranslator(ShaderTranslator::ShaderTranslatorError error, const ShaderTranslator& translator)
+{
+	if(error != ShaderTranslator::Ok)
+	{
+		throw std::runtime_error("Unable to translate: " + translator.GetLastError());
+	}
+}
+
+void LoadUniverse(ShaderTranslationUniverse& universe, const SyntheticSources& sources)
+{
+	CheckUniverse(universe.AddSemantics(sources.Semantics.c_str()), universe);
+	CheckUniverse(universe.AddCombinators(sources.Combinators.c_str()), universe);
+	CheckUniverse(universe.AddAtoms(sources.Atoms.c_str()), universe);
+	universe.Freeze();
+}
+
+volatile size_t g_LookupSink;
+
+// The names a translation resolves: the needs and context semantics of the entry points,
+// the bound atoms and the needs of everything they pull in, in the order they are met
+struct NameLookups
+{
+	std::vector<String> Atoms;
+	std::vector<String> Symbols;
+};
+
+void GatherLookups(const ParsedShader& parsed, const ShaderTranslationParams& params, const ShaderTranslationUniverse& universe, NameLookups& lookups)
+{
+	for(auto entryPoint = parsed.EntryPoints.cbegin(); entryPoint != parsed.EntryPoints.cend(); ++entryPoint)
+	{
+		for(auto need = entryPoint->Needs.cbegin(); need != entryPoint->Needs.cend(); ++need)
+		{
+			const FrozenString name = parsed.GetSymbol(*need).Name;
+			lookups.Symbols.push_back(String(name.begin(), name.end()));
+		}
+		for(auto rewrite = entryPoint->Rewrites.cbegin(); rewrite != entryPoint->Rewrites.cend(); ++rewrite)
+		{
+			if(rewrite->Symbol != NO_SYMBOL)
+			{
+				lookups.Symbols.push_back(rewrite->Name);
+			}
+		}
+	}
+
+	std::vector<const ExpandableFunction*> pending;
+	std::set<String> entered;
+	for(auto binding = params.cbegin(); binding != params.cend(); ++binding)
+	{
+		lookups.Atoms.push_back(binding->second);
+		auto atom = universe.GetAtoms().find(binding->second);
+		if(atom != universe.GetAtoms().cend())
+		{
+			pending.push_back(&atom->second);
+		}
+	}
+	while(!pending.empty())
+	{
+		const ExpandableFunction* function = pending.back();
+		pending.pop_back();
+		for(auto need = function->Needs.cbegin(); need != function->Needs.cend(); ++need)
+		{
+			lookups.Symbols.push_back(*need);
+			auto combinator = universe.GetCombinators().find(*need);
+			if(combinator != universe.GetCombinators().cend() && entered.insert(*need).second)
+			{
+				pending.push_back(&combinator->second);
+			}
+		}
+	}
+}
+
+void WriteFile(const fs::path& path, const std::string& contents)
+{
+	std::ofstream fout(path.string().c_str(), std::ios::binary);
+	fout << contents;
+	if(!fout)
+	{
+		throw std::runtime_error("Unable to write " + path.string());
+	}
+}
+
+// Nearest rank on sorted samples
+double Percentile(const std::vector<double>& sorted, double percentile)
+{
+	if(sorted.empty())
+	{
+		return 0;
+	}
+	const size_t rank = size_t(std::ceil(percentile / 100 * sorted.size()));
+	return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+}
+
+void WriteReport(std::ostream& out, const Options& options, unsigned workers, const std::vector<StageResult>& stages)
+{
+	const SyntheticParams& synthetic = options.Synthetic;
+	out << std::fixed << std::setprecision(3);
+	out << "{\n";
+	out << "  \"config\": {\n"
+		<< "    \"atoms\": " << synthetic.AtomCount << ",\n"
+		<< "    \"combinator_depth\": " << synthetic.CombinatorDepth << ",\n"
+		<< "    \"fanout\": " << synthetic.FanOut << ",\n"
+		<< "    \"body_lines\": " << synthetic.BodyLines << ",\n"
+		<< "    \"context_if_nesting\": " << synthetic.ContextIfNesting << ",\n"
+		<< "    \"context_if_siblings\": " << synthetic.ContextIfSiblings << ",\n"
+		<< "    \"entry_points\": " << synthetic.EntryPoints << ",\n"
+		<< "    \"permutations\": " << synthetic.Permutations << ",\n"
+		<< "    \"seed\": " << synthetic.Seed << ",\n"
+		<< "    \"iterations\": " << options.Iterations << ",\n"
+		<< "    \"workers\": " << workers << "\n"
+		<< "  },\n";
+
+	out << "  \"stages\": [\n";
+	for(auto stage = stages.cbegin(); stage != stages.cend(); ++stage)
+	{
+		std::vector<double> sorted(stage->Microseconds);
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0;
+		for(auto sample = sorted.cbegin(); sample != sorted.cend(); ++sample)
+		{
+			total += *sample;
+		}
+		const double seconds = total / 1e6;
+
+		out << "    {\n"
+			<< "      \"name\": \"" << stage->Name << "\",\n"
+			<< "      \"samples\": " << sorted.size() << ",\n"
+			<< "      \"items\": " << stage->Items << ",\n"
+			<< "      \"bytes\": " << stage->Bytes << ",\n"
+			<< "      \"total_us\": " << total << ",\n"
+			<< "      \"mean_us\": " << (sorted.empty() ? 0 : total / sorted.size()) << ",\n"
+			<< "      \"min_us\": " << (sorted.empty() ? 0 : sorted.front()) << ",\n"
+			<< "      \"p50_us\": " << Percentile(sorted, 50) << ",\n"
+			<< "      \"p90_us\": " << Percentile(sorted, 90) << ",\n"
+			<< "      \"p99_us\": " << Percentile(sorted, 99) << ",\n"
+			<< "      \"max_us\": " << (sorted.empty() ? 0 : sorted.back()) << ",\n"
+			<< "      \"items_per_second\": " << (seconds > 0 ? stage->Items / seconds : 0) << ",\n";
+		if(stage->CountsAllocations && stage->Items)
+		{
+			out << "      \"allocations_per_item\": " << double(stage->Allocations) / stage->Items << ",\n"
+				<< "      \"allocated_bytes_per_item\": " << double(stage->AllocatedBytes) / stage->Items << ",\n";
+		}
+		if(stage->CopiedBytes && stage->Items)
+		{
+			out << "      \"copied_bytes_per_item\": " << double(stage->CopiedBytes) / stage->Items << ",\n";
+		}
+		if(stage->ReportedAllocations && stage->Items)
+		{
+			out << "      \"reported_heap_allocations_per_item\": " << double(stage->ReportedAllocations) / stage->Items << ",\n";
+		}
+		if(stage->Speedup > 0)
+		{
+			out << "      \"speedup\": " << stage->Speedup << ",\n";
+		}
+		if(stage->SourceBytes)
+		{
+			out << "      \"source_bytes_per_sample\": " << double(stage->SourceBytes) / sorted.size() << ",\n"
+				<< "      \"ns_per_source_byte\": " << total * 1e3 / stage->SourceBytes << ",\n";
+		}
+		out << "      \"bytes_per_second\": " << (seconds > 0 ? stage->Bytes / seconds : 0) << "\n"
+			<< "    }" << (stage + 1 != stages.cend() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+}
+
+int main(int argc, char* argv[])
+try
+{
+	Options options;
+	if(!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	SyntheticSources sources;
+	GenerateSynthetic(options.Synthetic, sources);
+	const std::vector<ShaderTranslationParams>& permutations = sources.Permutations;
+	const unsigned iterations = std::max(1u, options.Iterations);
+
+	TranslationThreadPool pool(options.Threads);
+
+	const fs::path directory = fs::temp_directory_path() / fs::unique_path("translator-benchmark-%%%%-%%%%-%%%%");
+	fs::create_directories(directory);
+
+	std::vector<StageResult> stages;
+
+	// Loading a universe from its sources
+	const size_t universeBytes = sources.Semantics.size() + sources.Combinators.size() + sources.Atoms.size();
+	stages.push_back(StageResult("load"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		Measure(stages.back(), 1, [&]()
+		{
+			ShaderTranslationUniverse universe;
+			LoadUniverse(universe, sources);
+			return universeBytes;
+		});
+	}
+
+	ShaderTranslationUniverse universe;
+	LoadUniverse(universe, sources);
+
+	// Loading the same universe from a snapshot
+	const fs::path snapshot = directory / "universe.snapshot";
+	CheckUniverse(universe.SaveSnapshot(snapshot.string().c_str()), universe);
+	const size_t snapshotBytes = size_t(fs::file_size(snapshot));
+	stages.push_back(StageResult("load_snapshot"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		Measure(stages.back(), 1, [&]()
+		{
+			ShaderTranslationUniverse loaded;
+			CheckUniverse(loaded.LoadSnapshot(snapshot.string().c_str()), loaded);
+			loaded.Freeze();
+			return snapshotBytes;
+		});
+	}
+
+	// Loading it from a library file per polymorphic
+	std::vector<ShaderTranslationUniverse::LibraryFile> files;
+	ShaderTranslationUniverse::LibraryFile file;
+	file.Path = (directory / "semantics.txt").string();
+	file.Content = ShaderTranslationUniverse::SemanticsLibrary;
+	WriteFile(file.Path, sources.Semantics);
+	files.push_back(file);
+	file.Path = (directory / "combinators.txt").string();
+	file.Content = ShaderTranslationUniverse::CombinatorsLibrary;
+	WriteFile(file.Path, sources.Combinators);
+	files.push_back(file);
+	for(size_t i = 0; i < sources.AtomsByPolymorphic.size(); ++i)
+	{
+		std::ostringstream name;
+		name << "atoms_" << i << ".txt";
+		file.Path = (directory / name.str()).string();
+		file.Content = ShaderTranslationUniverse::AtomsLibrary;
+		WriteFile(file.Path, sources.AtomsByPolymorphic[i]);
+		files.push_back(file);
+	}
+	stages.push_back(StageResult("load_library", false));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		Measure(stages.back(), unsigned(files.size()), [&]()
+		{
+			ShaderTranslationUniverse loaded;
+			CheckUniverse(loaded.AddLibraryFiles(files, &pool), loaded);
+			loaded.Freeze();
+			return universeBytes;
+		});
+	}
+
+	ShaderTranslator translator;
+	translator.SetThreadPool(&pool);
+
+	stages.push_back(StageResult("parse"));
+	ParsedShaderPtr parsed;
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		Measure(stages.back(), 1, [&]()
+		{
+			CheckTranslator(translator.ParseShader(sources.Shader, &universe, parsed), translator);
+			return sources.Shader.size();
+		});
+	}
+
+	// Resolving the names of a translation through the interned IDs and through the universe maps they replaced.
+	// An item is one lookup, a sample the lookups of one permutation.
+	std::vector<NameLookups> lookups(permutations.size());
+	for(size_t permutation = 0; permutation < permutations.size(); ++permutation)
+	{
+		GatherLookups(*parsed, permutations[permutation], universe, lookups[permutation]);
+	}
+	const FrozenUniverse& frozen = *parsed->Frozen;
+	size_t resolved = 0;
+	size_t resolvedByMaps = 0;
+	stages.push_back(StageResult("lookup_symbol_ids"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto names = lookups.cbegin(); names != lookups.cend(); ++names)
+		{
+			Measure(stages.back(), unsigned(names->Atoms.size() + names->Symbols.size()), [&]()
+			{
+				for(auto name = names->Atoms.cbegin(); name != names->Atoms.cend(); ++name)
+				{
+					resolved += frozen.FindAtom(*name) != NO_FUNCTION;
+				}
+				for(auto name = names->Symbols.cbegin(); name != names->Symbols.cend(); ++name)
+				{
+					resolved += frozen.FindSymbol(*name) != NO_SYMBOL;
+				}
+				return size_t(0);
+			});
+		}
+	}
+	// A need was looked up as a semantic and as the return type of a combinator
+	stages.push_back(StageResult("lookup_maps"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto names = lookups.cbegin(); names != lookups.cend(); ++names)
+		{
+			Measure(stages.back(), unsigned(names->Atoms.size() + names->Symbols.size()), [&]()
+			{
+				for(auto name = names->Atoms.cbegin(); name != names->Atoms.cend(); ++name)
+				{
+					resolvedByMaps += universe.GetAtoms().find(*name) != universe.GetAtoms().cend();
+				}
+				for(auto name = names->Symbols.cbegin(); name != names->Symbols.cend(); ++name)
+				{
+					resolvedByMaps += universe.GetSemantics().find(*name) != universe.GetSemantics().cend()
+						|| universe.GetCombinators().find(*name) != universe.GetCombinators().cend();
+				}
+				return size_t(0);
+			});
+		}
+	}
+	// Textures and samplers are symbols without a semantic, so the counts are kept only to be used
+	g_LookupSink = resolved + resolvedByMaps;
+
+
+	// Expanding and emitting every permutation of the parsed shader into a string
+	TranslationContext context;
+	std::string output;
+	TranslationStats outputStats;
+	stages.push_back(StageResult("instantiate"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+		{
+			Measure(stages.back(), 1, [&]()
+			{
+				CheckTranslator(translator.Instantiate(*parsed, *permutation, context, output, &outputStats), translator);
+				return output.size();
+			});
+			stages.back().CopiedBytes += outputStats.BytesEmitted + outputStats.BytesMoved;
+			stages.back().ReportedAllocations += outputStats.HeapAllocations;
+		}
+	}
+
+	// The same streamed into a preallocated buffer, which is written once
+	std::vector<char> buffer(1024 * 1024);
+	stages.push_back(StageResult("instantiate_sink"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+		{
+			BufferOutputSink sink(buffer.data(), buffer.size());
+			Measure(stages.back(), 1, [&]()
+			{
+				CheckTranslator(translator.Instantiate(*parsed, *permutation, sink, &outputStats), translator);
+				return sink.GetSize();
+			});
+			stages.back().CopiedBytes += outputStats.BytesEmitted + outputStats.BytesMoved;
+			stages.back().ReportedAllocations += outputStats.HeapAllocations;
+			if(sink.HasOverflowed())
+			{
+				buffer.resize(sink.GetSize() * 2);
+			}
+		}
+	}
+
+	// Parsing and instantiating every time, split in the stages the translator reports
+	StageResult translate("translate");
+	const char* stageNames[] = { "stage_polymorphics", "stage_scan", "stage_expand", "stage_struct_emission", "stage_assembly" };
+	double TranslationStats::* const stageFields[] = { &TranslationStats::PolymorphicParseTime
+		, &TranslationStats::BodyScanTime
+		, &TranslationStats::ExpansionTime
+		, &TranslationStats::StructEmissionTime
+		, &TranslationStats::AssemblyTime };
+	std::vector<StageResult> translateStages;
+	for(size_t stage = 0; stage < sizeof(stageNames) / sizeof(stageNames[0]); ++stage)
+	{
+		translateStages.push_back(StageResult(stageNames[stage], false));
+	}
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+		{
+			TranslationStats stats;
+			Measure(translate, 1, [&]()
+			{
+				CheckTranslator(translator.TranslateToHLSL(sources.Shader, *permutation, &universe, context, output, &stats), translator);
+				return output.size();
+			});
+			for(size_t stage = 0; stage < translateStages.size(); ++stage)
+			{
+				translateStages[stage].Microseconds.push_back(stats.*stageFields[stage]);
+				translateStages[stage].Items += 1;
+				translateStages[stage].Bytes += stats.BytesEmitted;
+			}
+			translate.ReportedAllocations += stats.HeapAllocations;
+		}
+	}
+	stages.push_back(translate);
+	stages.insert(stages.end(), translateStages.begin(), translateStages.end());
+
+	// The same with the entry points of the shader translated concurrently
+	ShaderTranslator parallel;
+	parallel.SetThreadPool(&pool);
+	parallel.SetParallelEntryPoints(true);
+	// Linking resolves the entry points in two passes - both have to match a serial translation too
+	ShaderTranslator linked;
+	linked.SetStageLinking(true);
+	ShaderTranslator parallelLinked;
+	parallelLinked.SetThreadPool(&pool);
+	parallelLinked.SetParallelEntryPoints(true);
+	parallelLinked.SetStageLinking(true);
+	std::string expected;
+	stages.push_back(StageResult("translate_parallel_entry_points", false));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+		{
+			Measure(stages.back(), 1, [&]()
+			{
+				CheckTranslator(parallel.TranslateToHLSL(sources.Shader, *permutation, &universe, context, output), parallel);
+				return output.size();
+			});
+			if(i == 0)
+			{
+				CheckTranslator(translator.TranslateToHLSL(sources.Shader, *permutation, &universe, expected), translator);
+				if(output != expected)
+				{
+					throw std::runtime_error("Translating the entry points concurrently changed the output");
+				}
+				CheckTranslator(linked.TranslateToHLSL(sources.Shader, *permutation, &universe, expected), linked);
+				CheckTranslator(parallelLinked.TranslateToHLSL(sources.Shader, *permutation, &universe, output), parallelLinked);
+				if(output != expected)
+				{
+					throw std::runtime_error("Translating the linked entry points concurrently changed the output");
+				}
+			}
+		}
+	}
+
+	// Translating shaders with ever longer bodies - the time per source byte
+	// levels off once the fixed cost of a translation is spread, if it is linear in the size
+	for(unsigned scale = 1; scale <= 16; scale *= 2)
+	{
+		SyntheticParams params = options.Synthetic;
+		params.BodyLines = std::max(1u, options.Synthetic.BodyLines) * scale;
+		SyntheticSources scaled;
+		GenerateSynthetic(params, scaled);
+		ShaderTranslationUniverse scaledUniverse;
+		LoadUniverse(scaledUniverse, scaled);
+
+		std::ostringstream name;
+		name << "translate_body_" << params.BodyLines;
+		stages.push_back(StageResult(name.str()));
+		for(unsigned i = 0; i < iterations; ++i)
+		{
+			for(auto permutation = scaled.Permutations.cbegin(); permutation != scaled.Permutations.cend(); ++permutation)
+			{
+				Measure(stages.back(), 1, [&]()
+				{
+					CheckTranslator(translator.TranslateToHLSL(scaled.Shader, *permutation, &scaledUniverse, context, output), translator);
+					return output.size();
+				});
+				stages.back().SourceBytes += scaled.Shader.size();
+			}
+		}
+	}
+
+	// Translating all permutations at once on 1, 2, 4... workers up to the ones of the pool.
+	// The speedup of every worker count is against the mean batch time on one worker.
+	std::vector<ShaderTranslator::BatchResult> results;
+	double singleWorkerTime = 0;
+	for(unsigned workers = 1; ; workers = std::min(workers * 2, pool.GetWorkerCount()))
+	{
+		TranslationThreadPool batchPool(workers);
+		translator.SetThreadPool(&batchPool);
+		std::ostringstream name;
+		name << "batch_" << workers;
+		stages.push_back(StageResult(name.str(), false));
+		for(unsigned i = 0; i < iterations; ++i)
+		{
+			Measure(stages.back(), unsigned(permutations.size()), [&]()
+			{
+				CheckTranslator(translator.TranslateBatch(sources.Shader, permutations, &universe, results), translator);
+				size_t bytes = 0;
+				for(auto result = results.cbegin(); result != results.cend(); ++result)
+				{
+					bytes += result->Output.size();
+				}
+				return bytes;
+			});
+		}
+		translator.SetThreadPool(&pool);
+
+		const std::vector<double>& samples = stages.back().Microseconds;
+		const double time = std::accumulate(samples.cbegin(), samples.cend(), 0.0) / samples.size();
+		if(workers == 1)
+		{
+			singleWorkerTime = time;
+		}
+		stages.back().Speedup = time > 0 ? singleWorkerTime / time : 0;
+		if(workers == pool.GetWorkerCount())
+		{
+			break;
+		}
+	}
+
+	if(!options.Trace.empty())
+	{
+		TranslationTracer tracer;
+		translator.SetTracer(&tracer);
+		CheckTranslator(translator.TranslateBatch(sources.Shader, permutations, &universe, results), translator);
+		translator.SetTracer(nullptr);
+		if(!tracer.WriteChromeTrace(options.Trace.c_str()))
+		{
+			throw std::runtime_error("Unable to write " + options.Trace);
+		}
+	}
+
+	// Repeated translations served by the caches
+	ShaderTranslator cached;
+	cached.EnableCache(permutations.size() + 1, size_t(-1));
+	for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+	{
+		CheckTranslator(cached.TranslateToHLSL(sources.Shader, *permutation, &universe, output), cached);
+	}
+	stages.push_back(StageResult("cache_hit"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+		{
+			Measure(stages.back(), 1, [&]()
+			{
+				CheckTranslator(cached.TranslateToHLSL(sources.Shader, *permutation, &universe, output), cached);
+				return output.size();
+			});
+		}
+	}
+
+	DiskTranslationCache diskCache((directory / "cache").string());
+	ShaderTranslator diskCached;
+	diskCached.SetDiskCache(&diskCache);
+	for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+	{
+		CheckTranslator(diskCached.TranslateToHLSL(sources.Shader, *permutation, &universe, output), diskCached);
+	}
+	stages.push_back(StageResult("disk_cache_hit"));
+	for(unsigned i = 0; i < iterations; ++i)
+	{
+		for(auto permutation = permutations.cbegin(); permutation != permutations.cend(); ++permutation)
+		{
+			Measure(stages.back(), 1, [&]()
+			{
+				CheckTranslator(diskCached.TranslateToHLSL(sources.Shader, *permutation, &universe, output), diskCached);
+				return output.size();
+			});
+		}
+	}
+
+	boost::system::error_code ignored;
+	fs::remove_all(directory, ignored);
+
+	if(options.Output.empty())
+	{
+		WriteReport(std::cout, options, pool.GetWorkerCount(), stages);
+	}
+	else
+	{
+		std::ofstream fout(options.Output.c_str());
+		WriteReport(fout, options, pool.GetWorkerCount(), stages);
+		if(!fout)
+		{
+			throw std::runtime_error("Unable to write " + options.Output);
+		}
+	}
+
+	return 0;
+}
+catch(std::exception& ex)
+{
+	std::cerr << "Exception: " << ex.what() << std::endl;
+	return 1;
+}
@@ -0,0 +1,220 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "SyntheticShaders.h"
+
+#include <random>
+
+namespace benchmark
+{
+
+SyntheticParams::SyntheticParams()
+	: AtomCount(64)
+	, CombinatorDepth(4)
+	, FanOut(4)
+	, BodyLines(8)
+	, ContextIfNesting(2)
+	, ContextIfSiblings(0)
+	, EntryPoints(2)
+	, Permutations(64)
+	, Seed(1)
+{}
+
+namespace
+{
+
+// Every polymorphic value has a chain of combinators per atom slot to pull in
+std::string ChainTop(const SyntheticParams& params, unsigned chain)
+{
+	std::ostringstream name;
+	if(params.CombinatorDepth)
+	{
+		name << "CHAIN_" << chain << "_" << params.CombinatorDepth - 1;
+	}
+	else
+	{
+		name << "INPUT_" << chain;
+	}
+	return name.str();
+}
+
+void AddFiller(std::ostringstream& out, const std::string& indent, unsigned lines)
+{
+	for(unsigned line = 0; line < lines; ++line)
+	{
+		out << indent << "result = result * 0.5f + float4(" << line << ", 0, 0, 1);\n";
+	}
+}
+
+void AddPolymorphicUse(std::ostringstream& out, const SyntheticParams& params, unsigned polymorphics, unsigned polymorphic)
+{
+	out << "\tcontext.value_" << polymorphic << " = Get_" << polymorphic << "();\n";
+
+	std::string indent = "\t";
+	for(unsigned level = 0; level < params.ContextIfNesting; ++level)
+	{
+		out << indent << "CONTEXT_IF(context.value_" << (polymorphic + level) % polymorphics << ") {\n";
+		indent += "\t";
+	}
+	out << indent << "result += context.value_" << polymorphic << ";\n";
+	for(unsigned level = 0; level < params.ContextIfNesting; ++level)
+	{
+		indent.erase(indent.size() - 1);
+		out << indent << "}\n";
+	}
+
+	for(unsigned sibling = 0; sibling < params.ContextIfSiblings; ++sibling)
+	{
+		out << "\t" << (sibling % 2 ? "CONTEXT_IFNOT" : "CONTEXT_IF") << "(context.value_" << (polymorphic + sibling) % polymorphics << ") {\n"
+			<< "\t\tresult += context.value_" << polymorphic << ";\n"
+			<< "\t}\n";
+	}
+}
+
+}
+
+void GenerateSynthetic(const SyntheticParams& params, SyntheticSources& sources)
+{
+	const unsigned fanOut = std::max(1u, params.FanOut);
+	const unsigned chains = fanOut;
+	const unsigned polymorphics = std::max(1u, params.AtomCount / fanOut);
+
+	std::ostringstream semantics;
+	semantics << "void VOID : void;\n\n";
+	for(unsigned chain = 0; chain < chains; ++chain)
+	{
+		semantics << "float4 INPUT_" << chain << " : TEXCOORD;\n";
+		for(unsigned depth = 0; depth < params.CombinatorDepth; ++depth)
+		{
+			semantics << "float4 CHAIN_" << chain << "_" << depth << " : TEXCOORD;\n";
+		}
+	}
+	for(unsigned polymorphic = 0; polymorphic < polymorphics; ++polymorphic)
+	{
+		semantics << "float4 VALUE_" << polymorphic << " : TEXCOORD;\n";
+	}
+	sources.Semantics = semantics.str();
+
+	std::ostringstream combinators;
+	for(unsigned chain = 0; chain < chains; ++chain)
+	{
+		for(unsigned depth = 0; depth < params.CombinatorDepth; ++depth)
+		{
+			std::ostringstream previous;
+			if(depth)
+			{
+				previous << "chain_" << chain << "_" << depth - 1;
+			}
+			else
+			{
+				previous << "input_" << chain;
+			}
+
+			combinators << "combinator CHAIN_" << chain << "_" << depth << " ComputeChain_" << chain << "_" << depth
+				<< "(interface context) needs " << boost::to_upper_copy(previous.str()) << "\n{\n"
+				<< "\tfloat4 result = context." << previous.str() << ";\n";
+			AddFiller(combinators, "\t", params.BodyLines);
+			combinators << "\treturn result;\n}\n\n";
+		}
+	}
+	sources.Combinators = combinators.str();
+
+	sources.AtomsByPolymorphic.assign(polymorphics, std::string());
+	for(unsigned polymorphic = 0; polymorphic < polymorphics; ++polymorphic)
+	{
+		std::ostringstream atoms;
+		if(!polymorphic)
+		{
+			atoms << "atom VOID None(interface context)\n{\n}\n\n";
+		}
+		for(unsigned slot = 0; slot < fanOut; ++slot)
+		{
+			const std::string dependency = ChainTop(params, slot % chains);
+			const std::string lowerDependency = boost::to_lower_copy(dependency);
+			atoms << "atom VALUE_" << polymorphic << " Value_" << polymorphic << "_" << slot
+				<< "(interface context) needs " << dependency << ", MAP_" << polymorphic % 4 << ", SAMPLER_" << slot % 2 << "\n{\n"
+				<< "\tfloat4 result = context." << lowerDependency << " + map_" << polymorphic % 4
+				<< ".Sample(sampler_" << slot % 2 << ", context." << lowerDependency << ".xy);\n";
+			AddFiller(atoms, "\t", params.BodyLines);
+			atoms << "\treturn result;\n}\n\n";
+		}
+		sources.AtomsByPolymorphic[polymorphic] = atoms.str();
+	}
+	sources.Atoms.clear();
+	for(auto atoms = sources.AtomsByPolymorphic.cbegin(); atoms != sources.AtomsByPolymorphic.cend(); ++atoms)
+	{
+		sources.Atoms += *atoms;
+	}
+
+	std::ostringstream shader;
+	for(unsigned polymorphic = 0; polymorphic < polymorphics; ++polymorphic)
+	{
+		shader << "polymorphic Get_" << polymorphic << "\n{\n\tNone";
+		for(unsigned slot = 0; slot < fanOut; ++slot)
+		{
+			shader << ",\n\tValue_" << polymorphic << "_" << slot;
+		}
+		shader << "\n}\n\n";
+	}
+	shader << "cbuffer Synthetic\n{\n\tfloat4 Scale;\n};\n\n";
+
+	for(unsigned entryPoint = 0; entryPoint < params.EntryPoints; ++entryPoint)
+	{
+		const bool isVertex = !(entryPoint % 2);
+		if(isVertex)
+		{
+			// The vertex shaders pass on every input the pixel shaders may read, so that the stages can be linked
+			shader << "vertex_shader VS_OUTPUT VS_" << entryPoint << "(VS_INPUT input) needs INPUT_0";
+			for(unsigned chain = 1; chain < chains; ++chain)
+			{
+				shader << ", INPUT_" << chain;
+			}
+			shader << "\n{\n\tVS_OUTPUT output = (VS_OUTPUT)0;\n";
+			for(unsigned chain = 0; chain < chains; ++chain)
+			{
+				shader << "\toutput.input_" << chain << " = context.input_" << chain << ";\n";
+			}
+		}
+		else
+		{
+			shader << "pixel_shader float4 PS_" << entryPoint << "(PS_INPUT input) : SV_Target needs INPUT_0\n{\n";
+		}
+		shader << "\tfloat4 result = context.input_0 * Scale;\n";
+		for(unsigned polymorphic = 0; polymorphic < polymorphics; ++polymorphic)
+		{
+			AddPolymorphicUse(shader, params, polymorphics, polymorphic);
+		}
+		AddFiller(shader, "\t", params.BodyLines);
+		shader << (isVertex ? "\toutput.Position = result;\n\treturn output;\n}\n\n" : "\treturn result;\n}\n\n");
+	}
+	sources.Shader = shader.str();
+
+	// Picks an atom or None for every polymorphic
+	std::mt19937 random(params.Seed);
+	std::uniform_int_distribution<unsigned> choice(0, fanOut);
+	sources.Permutations.assign(params.Permutations, translator::ShaderTranslationParams());
+	for(auto permutation = sources.Permutations.begin(); permutation != sources.Permutations.end(); ++permutation)
+	{
+		for(unsigned polymorphic = 0; polymorphic < polymorphics; ++polymorphic)
+		{
+			std::ostringstream name;
+			std::ostringstream atom;
+			name << "Get_" << polymorphic;
+			const unsigned slot = choice(random);
+			if(slot)
+			{
+				atom << "Value_" << polymorphic << "_" << slot - 1;
+			}
+			else
+			{
+				atom << "None";
+			}
+			permutation->insert(std::make_pair(translator::String(name.str().c_str()), translator::String(atom.str().c_str())));
+		}
+	}
+}
+
+}
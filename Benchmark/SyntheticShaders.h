@@ -0,0 +1,48 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+namespace benchmark
+{
+
+// Shapes the generated universe and shader
+struct SyntheticParams
+{
+	SyntheticParams();
+
+	// Atoms that compute the polymorphic values - FanOut of them per polymorphic
+	unsigned AtomCount;
+	// Length of the combinator chain every atom needs
+	unsigned CombinatorDepth;
+	// Atoms to choose from in each polymorphic, not counting None
+	unsigned FanOut;
+	// Filler lines in every function and entry point body
+	unsigned BodyLines;
+	// CONTEXT_IF blocks nested around each polymorphic use
+	unsigned ContextIfNesting;
+	// CONTEXT_IF and CONTEXT_IFNOT blocks following each other after each polymorphic use
+	unsigned ContextIfSiblings;
+	// Alternating vertex and pixel shaders in the file
+	unsigned EntryPoints;
+	unsigned Permutations;
+	unsigned Seed;
+};
+
+struct SyntheticSources
+{
+	std::string Semantics;
+	std::string Atoms;
+	std::string Combinators;
+	std::string Shader;
+	// The atoms of every polymorphic, for splitting the universe in library files
+	std::vector<std::string> AtomsByPolymorphic;
+	std::vector<translator::ShaderTranslationParams> Permutations;
+};
+
+void GenerateSynthetic(const SyntheticParams& params, SyntheticSources& sources);
+
+}
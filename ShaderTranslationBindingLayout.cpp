@@ -0,0 +1,129 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationBindingLayout.h"
+#include "ShaderTranslationIR.h"
+#include "ShaderTranslationUtilities.h"
+
+namespace translator
+{
+
+ResourceBindingLayout::ResourceBindingLayout()
+	: m_Hash(HASH_SEED)
+{}
+
+unsigned ResourceBindingLayout::AddTexture(const String& name)
+{
+	return Add(m_Textures, name, 't');
+}
+
+unsigned ResourceBindingLayout::AddSampler(const String& name)
+{
+	return Add(m_Samplers, name, 's');
+}
+
+unsigned ResourceBindingLayout::Add(Registers& registers, const String& name, char kind)
+{
+	auto known = registers.find(name);
+	if(known != registers.end())
+	{
+		return known->second;
+	}
+
+	const unsigned slot = unsigned(registers.size());
+	registers.insert(std::make_pair(name, slot));
+	m_Hash = HashBytes(&kind, 1, m_Hash);
+	m_Hash = HashBytes(name.data(), name.size(), m_Hash);
+	return slot;
+}
+
+void ResourceBindingLayout::AddShader(const ParsedShader& parsed)
+{
+	const FrozenUniverse& frozen = *parsed.Frozen;
+	std::set<String> textures;
+	std::set<String> samplers;
+
+	for(auto entryPoint = parsed.EntryPoints.cbegin(); entryPoint != parsed.EntryPoints.cend(); ++entryPoint)
+	{
+		for(auto need = entryPoint->Needs.cbegin(); need != entryPoint->Needs.cend(); ++need)
+		{
+			const FrozenSymbol& symbol = parsed.GetSymbol(*need);
+			if(symbol.IsTexture)
+			{
+				textures.insert(String(symbol.Name.begin(), symbol.Name.end()));
+			}
+			else if(symbol.IsSampler)
+			{
+				samplers.insert(String(symbol.Name.begin(), symbol.Name.end()));
+			}
+		}
+	}
+
+	// Everything the atoms and the combinators they may pull in read
+	for(auto polymorphic = parsed.Polymorphics.cbegin(); polymorphic != parsed.Polymorphics.cend(); ++polymorphic)
+	{
+		const FunctionClosure closure = frozen.GetAtom(polymorphic->AtomId).Closure;
+		for(auto texture = closure.Textures.cbegin(); texture != closure.Textures.cend(); ++texture)
+		{
+			const FrozenString name = frozen.GetSymbol(*texture).Name;
+			textures.insert(String(name.begin(), name.end()));
+		}
+		for(auto sampler = closure.Samplers.cbegin(); sampler != closure.Samplers.cend(); ++sampler)
+		{
+			const FrozenString name = frozen.GetSymbol(*sampler).Name;
+			samplers.insert(String(name.begin(), name.end()));
+		}
+	}
+
+	std::for_each(textures.cbegin(), textures.cend(), [this](const String& name) { AddTexture(name); });
+	std::for_each(samplers.cbegin(), samplers.cend(), [this](const String& name) { AddSampler(name); });
+}
+
+bool ResourceBindingLayout::FindTexture(const String& name, unsigned& slot) const
+{
+	auto texture = m_Textures.find(name);
+	if(texture == m_Textures.end())
+	{
+		return false;
+	}
+	slot = texture->second;
+	return true;
+}
+
+bool ResourceBindingLayout::FindSampler(const String& name, unsigned& slot) const
+{
+	auto sampler = m_Samplers.find(name);
+	if(sampler == m_Samplers.end())
+	{
+		return false;
+	}
+	slot = sampler->second;
+	return true;
+}
+
+unsigned ResourceBindingLayout::GetTextureCount() const
+{
+	return unsigned(m_Textures.size());
+}
+
+unsigned ResourceBindingLayout::GetSamplerCount() const
+{
+	return unsigned(m_Samplers.size());
+}
+
+unsigned long long ResourceBindingLayout::GetHash() const
+{
+	return m_Hash;
+}
+
+void ResourceBindingLayout::Clear()
+{
+	m_Textures.clear();
+	m_Samplers.clear();
+	m_Hash = HASH_SEED;
+}
+
+}
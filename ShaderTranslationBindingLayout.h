@@ -0,0 +1,50 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+namespace translator
+{
+
+class ParsedShader;
+
+// Gives every texture and sampler a register that is the same in all shaders translated with the layout,
+// so a renderer doesn't have to bind the resources again when it switches between them.
+// Names are the upper case ones of the universe - MAP_NORMAL, SAMPLER_POINT.
+class ResourceBindingLayout
+{
+public:
+	ResourceBindingLayout();
+
+	// Known names keep their register, new ones get the next free register of their kind
+	unsigned AddTexture(const String& name);
+	unsigned AddSampler(const String& name);
+	// Adds the textures and samplers any binding of the shader may use, each kind in the order of the names
+	void AddShader(const ParsedShader& parsed);
+
+	// False if the name was never added
+	bool FindTexture(const String& name, unsigned& slot) const;
+	bool FindSampler(const String& name, unsigned& slot) const;
+
+	unsigned GetTextureCount() const;
+	unsigned GetSamplerCount() const;
+
+	// Equal for layouts built by the same additions
+	unsigned long long GetHash() const;
+
+	void Clear();
+
+private:
+	typedef std::map<String, unsigned> Registers;
+
+	unsigned Add(Registers& registers, const String& name, char kind);
+
+	Registers m_Textures;
+	Registers m_Samplers;
+	unsigned long long m_Hash;
+};
+
+}
@@ -0,0 +1,115 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationCache.h"
+#include "ShaderTranslationUtilities.h"
+
+namespace translator
+{
+
+unsigned long long HashParams(const ShaderTranslationParams& params)
+{
+	unsigned long long hash = HASH_SEED;
+	for(auto param = params.cbegin(); param != params.cend(); ++param)
+	{
+		// include the terminators so that {"ab", "c"} and {"a", "bc"} differ
+		hash = HashBytes(param->first.c_str(), param->first.size() + 1, hash);
+		hash = HashBytes(param->second.c_str(), param->second.size() + 1, hash);
+	}
+	return hash;
+}
+
+TranslationCache::TranslationCache(size_t maxEntries, size_t maxBytes)
+	: m_MaxEntries(maxEntries)
+	, m_MaxBytes(maxBytes)
+	, m_Bytes(0)
+	, m_Hits(0)
+	, m_Misses(0)
+	, m_Evictions(0)
+{}
+
+size_t TranslationCache::GetEntrySize(const Entry& entry)
+{
+	return sizeof(Entry) + entry.Output.size();
+}
+
+bool TranslationCache::Find(const TranslationCacheKey& key, std::string& output)
+{
+	boost::lock_guard<boost::mutex> lock(m_Mutex);
+	auto found = m_Index.find(key);
+	if(found == m_Index.end())
+	{
+		++m_Misses;
+		return false;
+	}
+
+	++m_Hits;
+	m_Entries.splice(m_Entries.begin(), m_Entries, found->second);
+	output = found->second->Output;
+	return true;
+}
+
+void TranslationCache::Insert(const TranslationCacheKey& key, const std::string& output)
+{
+	Entry entry;
+	entry.Key = key;
+	entry.Output = output;
+	const size_t size = GetEntrySize(entry);
+	if(m_MaxBytes && size > m_MaxBytes)
+	{
+		return;
+	}
+
+	boost::lock_guard<boost::mutex> lock(m_Mutex);
+	auto found = m_Index.find(key);
+	if(found != m_Index.end())
+	{
+		m_Bytes -= GetEntrySize(*found->second);
+		m_Entries.erase(found->second);
+		m_Index.erase(found);
+	}
+
+	m_Entries.push_front(std::move(entry));
+	m_Index[key] = m_Entries.begin();
+	m_Bytes += size;
+
+	Trim();
+}
+
+void TranslationCache::Trim()
+{
+	while(!m_Entries.empty()
+		&& ((m_MaxEntries && m_Entries.size() > m_MaxEntries) || (m_MaxBytes && m_Bytes > m_MaxBytes)))
+	{
+		const Entry& last = m_Entries.back();
+		m_Bytes -= GetEntrySize(last);
+		m_Index.erase(last.Key);
+		m_Entries.pop_back();
+		++m_Evictions;
+	}
+}
+
+void TranslationCache::Clear()
+{
+	boost::lock_guard<boost::mutex> lock(m_Mutex);
+	m_Entries.clear();
+	m_Index.clear();
+	m_Bytes = 0;
+}
+
+TranslationCacheStats TranslationCache::GetStats() const
+{
+	boost::lock_guard<boost::mutex> lock(m_Mutex);
+	TranslationCacheStats stats;
+	stats.Hits = m_Hits;
+	stats.Misses = m_Misses;
+	stats.Evictions = m_Evictions;
+	stats.Entries = m_Entries.size();
+	stats.Bytes = m_Bytes;
+	return stats;
+}
+
+}
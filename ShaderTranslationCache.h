@@ -0,0 +1,81 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+namespace translator
+{
+
+struct TranslationCacheKey
+{
+	unsigned long long SourceHash;
+	unsigned long long ParamsHash;
+	unsigned long long UniverseGeneration;
+
+	bool operator==(const TranslationCacheKey& rhs) const
+	{
+		return SourceHash == rhs.SourceHash && ParamsHash == rhs.ParamsHash && UniverseGeneration == rhs.UniverseGeneration;
+	}
+};
+
+struct TranslationCacheStats
+{
+	unsigned long long Hits;
+	unsigned long long Misses;
+	unsigned long long Evictions;
+	size_t Entries;
+	size_t Bytes;
+};
+
+// Hashes the bindings in key order so equal maps always hash equally
+unsigned long long HashParams(const ShaderTranslationParams& params);
+
+// A thread-safe LRU map from (source, params, universe) to translated HLSL.
+// A limit of 0 means unlimited.
+class TranslationCache : boost::noncopyable
+{
+public:
+	TranslationCache(size_t maxEntries, size_t maxBytes);
+
+	bool Find(const TranslationCacheKey& key, std::string& output);
+	void Insert(const TranslationCacheKey& key, const std::string& output);
+	void Clear();
+
+	TranslationCacheStats GetStats() const;
+
+private:
+	struct Entry
+	{
+		TranslationCacheKey Key;
+		std::string Output;
+	};
+	typedef std::list<Entry> Entries;
+
+	struct KeyHasher
+	{
+		size_t operator()(const TranslationCacheKey& key) const
+		{
+			return size_t(key.SourceHash ^ (key.ParamsHash * 31) ^ (key.UniverseGeneration * 1099511628211ULL));
+		}
+	};
+
+	static size_t GetEntrySize(const Entry& entry);
+	void Trim();
+
+	mutable boost::mutex m_Mutex;
+	// Most recently used first
+	Entries m_Entries;
+	std::unordered_map<TranslationCacheKey, Entries::iterator, KeyHasher> m_Index;
+
+	size_t m_MaxEntries;
+	size_t m_MaxBytes;
+	size_t m_Bytes;
+	unsigned long long m_Hits;
+	unsigned long long m_Misses;
+	unsigned long long m_Evictions;
+};
+
+}
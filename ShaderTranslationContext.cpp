@@ -0,0 +1,125 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationTypes.h"
+
+namespace translator
+{
+
+namespace
+{
+thread_local TranslationContext* tCurrentContext = nullptr;
+}
+
+thread_local unsigned long long* HeapAllocationCounter::s_Count = nullptr;
+
+HeapAllocationCounter::HeapAllocationCounter(unsigned long long* count)
+	: m_Previous(s_Count)
+{
+	s_Count = count;
+}
+
+HeapAllocationCounter::~HeapAllocationCounter()
+{
+	s_Count = m_Previous;
+}
+
+const size_t TranslationContext::ALIGNMENT;
+
+TranslationContext::TranslationContext(size_t chunkSize)
+	: m_ChunkSize(std::max<size_t>(chunkSize, ALIGNMENT))
+	, m_Current(0)
+	, m_Offset(0)
+	, m_Used(0)
+	, m_Peak(0)
+	, m_HighWaterMark(0)
+	, m_ChunkAllocations(0)
+{}
+
+TranslationContext::~TranslationContext()
+{}
+
+void* TranslationContext::AllocateSlow(size_t bytes)
+{
+	// The rest of the current chunk is wasted until the next reset
+	if(m_Current < m_Chunks.size())
+	{
+		m_Used += m_Chunks[m_Current].Size - m_Offset;
+		++m_Current;
+	}
+
+	// Chunks left from previous translations that are too small for this allocation are skipped
+	while(m_Current < m_Chunks.size() && m_Chunks[m_Current].Size < bytes)
+	{
+		m_Used += m_Chunks[m_Current].Size;
+		++m_Current;
+	}
+
+	if(m_Current == m_Chunks.size())
+	{
+		Chunk chunk;
+		chunk.Size = std::max(m_ChunkSize, bytes);
+		chunk.Memory.reset(new char[chunk.Size]);
+		m_Chunks.push_back(std::move(chunk));
+		++m_ChunkAllocations;
+		HeapAllocationCounter::Count();
+	}
+
+	m_Offset = 0;
+	return Allocate(bytes);
+}
+
+void TranslationContext::Reset()
+{
+	m_Current = 0;
+	m_Offset = 0;
+	m_Used = 0;
+	m_HighWaterMark = std::max(m_HighWaterMark, m_Peak);
+	m_Peak = 0;
+}
+
+size_t TranslationContext::GetHighWaterMark() const
+{
+	return std::max(m_HighWaterMark, m_Peak);
+}
+
+size_t TranslationContext::GetPeakSinceReset() const
+{
+	return m_Peak;
+}
+
+unsigned long long TranslationContext::GetChunkAllocations() const
+{
+	return m_ChunkAllocations;
+}
+
+size_t TranslationContext::GetReservedBytes() const
+{
+	size_t total = 0;
+	for(auto chunk = m_Chunks.cbegin(); chunk != m_Chunks.cend(); ++chunk)
+	{
+		total += chunk->Size;
+	}
+	return total;
+}
+
+TranslationContext* TranslationContext::GetCurrent()
+{
+	return tCurrentContext;
+}
+
+TranslationContext::Scope::Scope(TranslationContext& context)
+	: m_Previous(tCurrentContext)
+{
+	tCurrentContext = &context;
+}
+
+TranslationContext::Scope::~Scope()
+{
+	tCurrentContext = m_Previous;
+}
+
+}
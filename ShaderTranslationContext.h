@@ -0,0 +1,120 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+namespace translator
+{
+
+// Counts the heap allocations the translator makes on this thread for its lifetime. Scopes nest,
+// only the innermost one counts, and one given no count stops the counting until it ends.
+class HeapAllocationCounter : boost::noncopyable
+{
+public:
+	explicit HeapAllocationCounter(unsigned long long* count);
+	~HeapAllocationCounter();
+
+	// Called by the allocators of the translator whenever they go to the heap
+	static void Count()
+	{
+		if(s_Count)
+		{
+			++*s_Count;
+		}
+	}
+
+private:
+	static thread_local unsigned long long* s_Count;
+	unsigned long long* m_Previous;
+};
+
+// The scratch memory of translations. Memory is handed out from chunks that are
+// kept when the context is reset, so a context reused for many translations
+// allocates only until it has grown to fit the largest of them.
+// A context must be used by one translation at a time.
+class TranslationContext : boost::noncopyable
+{
+public:
+	static const size_t DEFAULT_CHUNK_SIZE = 128 * 1024;
+
+	explicit TranslationContext(size_t chunkSize = DEFAULT_CHUNK_SIZE);
+	~TranslationContext();
+
+	void* Allocate(size_t bytes);
+	// Only the latest allocation is given back - growing strings reuse their memory
+	void Deallocate(void* ptr, size_t bytes);
+
+	// Releases all allocations at once, the chunks are kept for reuse
+	void Reset();
+
+	// The most memory in use at once since creation
+	size_t GetHighWaterMark() const;
+	// The most memory in use at once since the last reset
+	size_t GetPeakSinceReset() const;
+	// The chunks taken from the heap since creation
+	unsigned long long GetChunkAllocations() const;
+	// The memory held in chunks
+	size_t GetReservedBytes() const;
+
+	// The context that scratch strings created on this thread allocate from
+	static TranslationContext* GetCurrent();
+
+	// Makes a context current on this thread for its lifetime
+	class Scope : boost::noncopyable
+	{
+	public:
+		explicit Scope(TranslationContext& context);
+		~Scope();
+
+	private:
+		TranslationContext* m_Previous;
+	};
+
+private:
+	static const size_t ALIGNMENT = 16;
+
+	struct Chunk
+	{
+		std::unique_ptr<char[]> Memory;
+		size_t Size;
+	};
+
+	void* AllocateSlow(size_t bytes);
+
+	std::vector<Chunk> m_Chunks;
+	size_t m_ChunkSize;
+	size_t m_Current;
+	size_t m_Offset;
+	size_t m_Used;
+	size_t m_Peak;
+	size_t m_HighWaterMark;
+	unsigned long long m_ChunkAllocations;
+};
+
+inline void* TranslationContext::Allocate(size_t bytes)
+{
+	bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if(m_Current < m_Chunks.size() && m_Offset + bytes <= m_Chunks[m_Current].Size)
+	{
+		void* ptr = m_Chunks[m_Current].Memory.get() + m_Offset;
+		m_Offset += bytes;
+		m_Used += bytes;
+		m_Peak = std::max(m_Peak, m_Used);
+		return ptr;
+	}
+	return AllocateSlow(bytes);
+}
+
+inline void TranslationContext::Deallocate(void* ptr, size_t bytes)
+{
+	bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if(m_Current < m_Chunks.size() && bytes <= m_Offset
+		&& static_cast<char*>(ptr) == m_Chunks[m_Current].Memory.get() + m_Offset - bytes)
+	{
+		m_Offset -= bytes;
+		m_Used -= bytes;
+	}
+}
+
+}
@@ -0,0 +1,194 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationDependencies.h"
+#include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationUtilities.h"
+
+namespace translator
+{
+
+namespace
+{
+
+unsigned long long HashString(const String& str, unsigned long long hash)
+{
+	// include the terminator so that adjacent strings can't run into each other
+	return HashBytes(str.c_str(), str.size() + 1, hash);
+}
+
+void DigestFunctions(const std::map<String, ExpandableFunction>& functions, std::map<String, unsigned long long>& digest)
+{
+	for(auto it = functions.cbegin(); it != functions.cend(); ++it)
+	{
+		unsigned long long hash = HashString(it->second.ReturnType, HASH_SEED);
+		hash = HashString(it->second.Name, hash);
+		hash = HashString(it->second.Params, hash);
+		for(auto need = it->second.Needs.cbegin(); need != it->second.Needs.cend(); ++need)
+		{
+			hash = HashString(*need, hash);
+		}
+		digest[it->first] = HashString(it->second.Source, hash);
+	}
+}
+
+void DiffDigests(const std::map<String, unsigned long long>& before, const std::map<String, unsigned long long>& after, DiffNames& diff)
+{
+	diff = DiffNames();
+
+	// Both maps are sorted - walk them side by side
+	auto lhs = before.cbegin();
+	auto rhs = after.cbegin();
+	while(lhs != before.cend() || rhs != after.cend())
+	{
+		if(rhs == after.cend() || (lhs != before.cend() && lhs->first < rhs->first))
+		{
+			diff.Removed.insert(lhs->first);
+			++lhs;
+		}
+		else if(lhs == before.cend() || rhs->first < lhs->first)
+		{
+			diff.Added.insert(rhs->first);
+			++rhs;
+		}
+		else
+		{
+			if(lhs->second != rhs->second)
+			{
+				diff.Changed.insert(lhs->first);
+			}
+			++lhs;
+			++rhs;
+		}
+	}
+}
+
+bool Intersects(const std::set<String>& lhs, const std::set<String>& rhs)
+{
+	const std::set<String>& smaller = lhs.size() < rhs.size() ? lhs : rhs;
+	const std::set<String>& larger = lhs.size() < rhs.size() ? rhs : lhs;
+	for(auto name = smaller.cbegin(); name != smaller.cend(); ++name)
+	{
+		if(larger.count(*name))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsAffected(const DependencyNames& names, const DiffNames& diff)
+{
+	return Intersects(names.Used, diff.Changed)
+		|| Intersects(names.Used, diff.Added)
+		|| Intersects(names.Used, diff.Removed)
+		|| Intersects(names.LookedUp, diff.Added)
+		|| Intersects(names.LookedUp, diff.Removed);
+}
+
+bool IsEmpty(const DiffNames& diff)
+{
+	return diff.Added.empty() && diff.Removed.empty() && diff.Changed.empty();
+}
+
+}
+
+void TranslationDependencies::Clear()
+{
+	*this = TranslationDependencies();
+}
+
+void BuildUniverseDigest(const ShaderTranslationUniverse& universe, UniverseDigest& digest)
+{
+	digest = UniverseDigest();
+
+	const ShaderSemantics& semantics = universe.GetSemantics();
+	for(auto it = semantics.cbegin(); it != semantics.cend(); ++it)
+	{
+		digest.Semantics[it->first] = HashString(it->second.HLSLSemantic, HashString(it->second.Type, HASH_SEED));
+	}
+	DigestFunctions(universe.GetAtoms(), digest.Atoms);
+	DigestFunctions(universe.GetCombinators(), digest.Combinators);
+}
+
+bool UniverseDiff::Empty() const
+{
+	return IsEmpty(Semantics) && IsEmpty(Atoms) && IsEmpty(Combinators);
+}
+
+void DiffUniverses(const UniverseDigest& before, const UniverseDigest& after, UniverseDiff& diff)
+{
+	DiffDigests(before.Semantics, after.Semantics, diff.Semantics);
+	DiffDigests(before.Atoms, after.Atoms, diff.Atoms);
+	DiffDigests(before.Combinators, after.Combinators, diff.Combinators);
+}
+
+bool IsAffected(const TranslationDependencies& dependencies, const UniverseDiff& diff)
+{
+	return IsAffected(dependencies.Semantics, diff.Semantics)
+		|| IsAffected(dependencies.Atoms, diff.Atoms)
+		|| IsAffected(dependencies.Combinators, diff.Combinators);
+}
+
+void DependencyIndex::Add(unsigned permutation, const TranslationDependencies& dependencies)
+{
+	Add(permutation, dependencies.Semantics, m_Semantics);
+	Add(permutation, dependencies.Atoms, m_Atoms);
+	Add(permutation, dependencies.Combinators, m_Combinators);
+}
+
+void DependencyIndex::Add(unsigned permutation, const DependencyNames& names, KindIndex& index)
+{
+	for(auto name = names.Used.cbegin(); name != names.Used.cend(); ++name)
+	{
+		index.Used[*name].push_back(permutation);
+	}
+	for(auto name = names.LookedUp.cbegin(); name != names.LookedUp.cend(); ++name)
+	{
+		index.LookedUp[*name].push_back(permutation);
+	}
+}
+
+void DependencyIndex::Clear()
+{
+	m_Semantics = KindIndex();
+	m_Atoms = KindIndex();
+	m_Combinators = KindIndex();
+}
+
+void DependencyIndex::FindAffected(const UniverseDiff& diff, std::vector<unsigned>& permutations) const
+{
+	permutations.clear();
+	FindAffected(diff.Semantics, m_Semantics, permutations);
+	FindAffected(diff.Atoms, m_Atoms, permutations);
+	FindAffected(diff.Combinators, m_Combinators, permutations);
+
+	std::sort(permutations.begin(), permutations.end());
+	permutations.erase(std::unique(permutations.begin(), permutations.end()), permutations.end());
+}
+
+void DependencyIndex::FindAffected(const DiffNames& diff, const KindIndex& index, std::vector<unsigned>& permutations)
+{
+	auto append = [&permutations](const Postings& postings, const std::set<String>& names)
+	{
+		for(auto name = names.cbegin(); name != names.cend(); ++name)
+		{
+			auto found = postings.find(*name);
+			if(found != postings.cend())
+			{
+				permutations.insert(permutations.end(), found->second.cbegin(), found->second.cend());
+			}
+		}
+	};
+
+	append(index.Used, diff.Changed);
+	append(index.Used, diff.Added);
+	append(index.Used, diff.Removed);
+	append(index.LookedUp, diff.Added);
+	append(index.LookedUp, diff.Removed);
+}
+
+}
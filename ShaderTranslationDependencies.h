@@ -0,0 +1,96 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+namespace translator
+{
+
+class ShaderTranslationUniverse;
+
+// Names of one kind of universe definitions a translation depended on. Changing a definition
+// affects the translation only if it was used; adding or removing one also if it was looked up.
+struct DependencyNames
+{
+	// The contents of the definitions ended up in the output
+	std::set<String> Used;
+	// Only whether there is such a definition mattered
+	std::set<String> LookedUp;
+};
+
+// Everything a translation read from the universe and the bindings
+struct TranslationDependencies
+{
+	DependencyNames Semantics;
+	DependencyNames Atoms;
+	// By return type, as the universe keeps them
+	DependencyNames Combinators;
+	// MAP_ and SAMPLER_ resources - they are not part of the universe
+	std::set<String> Textures;
+	std::set<String> Samplers;
+	// Only the bindings of polymorphics that were expanded
+	ShaderTranslationParams Bindings;
+
+	void Clear();
+};
+
+// The hash of every definition of a universe, by name
+struct UniverseDigest
+{
+	std::map<String, unsigned long long> Semantics;
+	std::map<String, unsigned long long> Atoms;
+	std::map<String, unsigned long long> Combinators;
+};
+
+void BuildUniverseDigest(const ShaderTranslationUniverse& universe, UniverseDigest& digest);
+
+struct DiffNames
+{
+	std::set<String> Added;
+	std::set<String> Removed;
+	std::set<String> Changed;
+};
+
+struct UniverseDiff
+{
+	DiffNames Semantics;
+	DiffNames Atoms;
+	DiffNames Combinators;
+
+	bool Empty() const;
+};
+
+void DiffUniverses(const UniverseDigest& before, const UniverseDigest& after, UniverseDiff& diff);
+
+bool IsAffected(const TranslationDependencies& dependencies, const UniverseDiff& diff);
+
+// Finds the permutations a universe edit affects without looking at every one of them
+class DependencyIndex
+{
+public:
+	void Add(unsigned permutation, const TranslationDependencies& dependencies);
+	void Clear();
+
+	// The affected permutations in increasing order
+	void FindAffected(const UniverseDiff& diff, std::vector<unsigned>& permutations) const;
+
+private:
+	typedef std::map<String, std::vector<unsigned>> Postings;
+	struct KindIndex
+	{
+		Postings Used;
+		Postings LookedUp;
+	};
+
+	static void Add(unsigned permutation, const DependencyNames& names, KindIndex& index);
+	static void FindAffected(const DiffNames& diff, const KindIndex& index, std::vector<unsigned>& permutations);
+
+	KindIndex m_Semantics;
+	KindIndex m_Atoms;
+	KindIndex m_Combinators;
+};
+
+}
@@ -0,0 +1,262 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationDiskCache.h"
+
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+namespace translator
+{
+
+namespace fs = boost::filesystem;
+namespace ipc = boost::interprocess;
+
+// Changes whenever translating gives a different output for the same inputs
+static const char DISK_CACHE_MAGIC[4] = { 'S', 'T', 'D', '4' };
+static const char* DISK_CACHE_EXTENSION = ".hlsl";
+static const char* DISK_CACHE_TEMP_EXTENSION = ".tmp";
+static const char* DISK_CACHE_LOCK = "cache.lock";
+
+// magic, key, payload size
+static const size_t DISK_CACHE_HEADER_SIZE = sizeof(DISK_CACHE_MAGIC) + sizeof(DiskCacheKey) + sizeof(unsigned long long);
+
+// Holds the file lock shared while any thread of the process stores
+class DiskTranslationCache::WriterScope : boost::noncopyable
+{
+public:
+	explicit WriterScope(DiskTranslationCache& cache)
+		: m_Cache(cache)
+	{
+		boost::lock_guard<boost::mutex> lock(m_Cache.m_WritersMutex);
+		if(!m_Cache.m_Writers++)
+		{
+			m_Cache.m_FileLock.lock_sharable();
+		}
+	}
+
+	~WriterScope()
+	{
+		boost::lock_guard<boost::mutex> lock(m_Cache.m_WritersMutex);
+		if(!--m_Cache.m_Writers)
+		{
+			m_Cache.m_FileLock.unlock_sharable();
+		}
+	}
+
+private:
+	DiskTranslationCache& m_Cache;
+};
+
+DiskTranslationCache::DiskTranslationCache(const std::string& directory)
+	: m_Directory(directory)
+	, m_TempCounter(0)
+	, m_HasFileLock(false)
+	, m_Writers(0)
+{
+	boost::system::error_code error;
+	fs::create_directories(m_Directory, error);
+
+	const std::string lockPath = (fs::path(m_Directory) / DISK_CACHE_LOCK).string();
+	// The lock file has to exist before it can be locked
+	std::ofstream touch(lockPath.c_str(), std::ios::app);
+	touch.close();
+	try
+	{
+		ipc::file_lock fileLock(lockPath.c_str());
+		m_FileLock.swap(fileLock);
+		m_HasFileLock = true;
+	}
+	catch(const ipc::interprocess_exception&)
+	{
+		// Nothing can be stored then, but entries can still be found
+	}
+}
+
+const std::string& DiskTranslationCache::GetDirectory() const
+{
+	return m_Directory;
+}
+
+std::string DiskTranslationCache::GetEntryPath(const DiskCacheKey& key) const
+{
+	char name[64];
+	sprintf(name, "%016llx%016llx%016llx", key.SourceHash, key.ParamsHash, key.UniverseHash);
+
+	// Fan out on the first two digits to keep directories small
+	return (fs::path(m_Directory) / std::string(name, 2) / (std::string(name) + DISK_CACHE_EXTENSION)).string();
+}
+
+bool DiskTranslationCache::Find(const DiskCacheKey& key, std::string& output) const
+{
+	std::ifstream fin(GetEntryPath(key).c_str(), std::ios::binary | std::ios::ate);
+	if(!fin.is_open())
+	{
+		return false;
+	}
+
+	const std::streamoff size = fin.tellg();
+	if(size < std::streamoff(DISK_CACHE_HEADER_SIZE))
+	{
+		return false;
+	}
+	fin.seekg(0);
+
+	std::string data;
+	data.resize(size_t(size));
+	if(!fin.read(&data[0], size))
+	{
+		return false;
+	}
+
+	// Guard against hash collisions in the file name and foreign files
+	DiskCacheKey stored;
+	unsigned long long payload;
+	memcpy(&stored, data.data() + sizeof(DISK_CACHE_MAGIC), sizeof(stored));
+	memcpy(&payload, data.data() + sizeof(DISK_CACHE_MAGIC) + sizeof(stored), sizeof(payload));
+	if(memcmp(data.data(), DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC))
+		|| stored.SourceHash != key.SourceHash
+		|| stored.ParamsHash != key.ParamsHash
+		|| stored.UniverseHash != key.UniverseHash
+		|| payload != size - DISK_CACHE_HEADER_SIZE)
+	{
+		return false;
+	}
+
+	data.erase(0, DISK_CACHE_HEADER_SIZE);
+	output.swap(data);
+	return true;
+}
+
+bool DiskTranslationCache::Store(const DiskCacheKey& key, const std::string& output)
+{
+	if(!m_HasFileLock)
+	{
+		return false;
+	}
+	const fs::path path(GetEntryPath(key));
+
+	// Many writers may store at once, only the collection is exclusive
+	boost::shared_lock<boost::shared_mutex> threadLock(m_Mutex);
+	WriterScope writer(*this);
+
+	boost::system::error_code error;
+	fs::create_directories(path.parent_path(), error);
+
+	std::ostringstream tempName;
+	tempName << path.string() << "." << boost::this_thread::get_id() << "." << m_TempCounter++ << DISK_CACHE_TEMP_EXTENSION;
+	const std::string tempPath = tempName.str();
+	{
+		std::ofstream fout(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if(!fout.is_open())
+		{
+			return false;
+		}
+
+		const unsigned long long payload = output.size();
+		fout.write(DISK_CACHE_MAGIC, sizeof(DISK_CACHE_MAGIC));
+		fout.write(reinterpret_cast<const char*>(&key), sizeof(key));
+		fout.write(reinterpret_cast<const char*>(&payload), sizeof(payload));
+		fout.write(output.data(), output.size());
+		if(!fout.flush())
+		{
+			fout.close();
+			fs::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	// Atomically replaces any entry stored meanwhile by another process - it has the same contents
+	fs::rename(tempPath, path, error);
+	if(error)
+	{
+		fs::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+bool DiskTranslationCache::Collect(unsigned long long maxBytes)
+{
+	if(!m_HasFileLock)
+	{
+		return false;
+	}
+	// No thread of this process stores meanwhile, so it holds no shared lock on the file either
+	boost::unique_lock<boost::shared_mutex> threadLock(m_Mutex);
+	ipc::scoped_lock<ipc::file_lock> lock(m_FileLock);
+
+	struct Entry
+	{
+		std::time_t Time;
+		unsigned long long Size;
+		fs::path Path;
+
+		bool operator<(const Entry& rhs) const
+		{
+			return Time < rhs.Time;
+		}
+	};
+	std::vector<Entry> entries;
+	std::vector<fs::path> temporaries;
+	unsigned long long total = 0;
+
+	boost::system::error_code error;
+	for(fs::recursive_directory_iterator it(m_Directory, error), end; !error && it != end; it.increment(error))
+	{
+		if(!fs::is_regular_file(it->status()))
+		{
+			continue;
+		}
+
+		const fs::path& path = it->path();
+		const std::string extension = path.extension().string();
+		if(extension == DISK_CACHE_TEMP_EXTENSION)
+		{
+			// Removed after the walk - the iterator fails to advance past a removed file
+			temporaries.push_back(path);
+		}
+		else if(extension == DISK_CACHE_EXTENSION)
+		{
+			Entry entry;
+			entry.Path = path;
+			entry.Size = fs::file_size(path, error);
+			entry.Time = fs::last_write_time(path, error);
+			if(error)
+			{
+				error.clear();
+				continue;
+			}
+			total += entry.Size;
+			entries.push_back(entry);
+		}
+	}
+	if(error)
+	{
+		return false;
+	}
+
+	// No writer runs while the lock is held exclusively
+	for(auto temporary = temporaries.cbegin(); temporary != temporaries.cend(); ++temporary)
+	{
+		fs::remove(*temporary, error);
+	}
+	error.clear();
+
+	std::sort(entries.begin(), entries.end());
+	for(auto entry = entries.cbegin(); entry != entries.cend() && total > maxBytes; ++entry)
+	{
+		// Readers that already opened the file keep reading it on POSIX, on Windows removal fails and the entry stays
+		if(fs::remove(entry->Path, error))
+		{
+			total -= entry->Size;
+		}
+	}
+	return true;
+}
+
+}
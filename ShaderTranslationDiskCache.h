@@ -0,0 +1,59 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+#include <boost/interprocess/sync/file_lock.hpp>
+
+namespace translator
+{
+
+struct DiskCacheKey
+{
+	unsigned long long SourceHash;
+	unsigned long long ParamsHash;
+	unsigned long long UniverseHash;
+};
+
+// A content addressed store of translated shaders that can be shared by
+// many processes. Entries are written to a temporary file and renamed in place
+// so readers never see partial files; writers and the garbage collection are
+// serialized through a lock file in the cache directory, which all threads of
+// the process share.
+class DiskTranslationCache : boost::noncopyable
+{
+public:
+	explicit DiskTranslationCache(const std::string& directory);
+
+	// A hit costs a single read of the entry file
+	bool Find(const DiskCacheKey& key, std::string& output) const;
+	bool Store(const DiskCacheKey& key, const std::string& output);
+
+	// Removes the oldest entries until the cache takes at most maxBytes.
+	// Left-over temporary files of crashed writers are removed as well.
+	bool Collect(unsigned long long maxBytes);
+
+	const std::string& GetDirectory() const;
+
+private:
+	class WriterScope;
+
+	std::string GetEntryPath(const DiskCacheKey& key) const;
+
+	std::string m_Directory;
+	std::atomic<unsigned> m_TempCounter;
+
+	// Closing any descriptor of the lock file drops all locks the process has on it,
+	// so it is opened once and held shared for as long as any thread of the process stores
+	boost::interprocess::file_lock m_FileLock;
+	bool m_HasFileLock;
+	// Shared by the storing threads, exclusive for the collection
+	boost::shared_mutex m_Mutex;
+	boost::mutex m_WritersMutex;
+	unsigned m_Writers;
+};
+
+}
@@ -0,0 +1,473 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationUtilities.h"
+
+namespace translator
+{
+
+extern const char* MAP_PREFIX;
+extern const char* SAMPLER_PREFIX;
+extern const char* VOID_TYPE;
+
+typedef unsigned SymbolId;
+static const SymbolId NO_SYMBOL = unsigned(-1);
+static const unsigned NO_FUNCTION = unsigned(-1);
+
+// A set of symbols with a bit for each, in the memory of the current translation context.
+// Iterating visits the IDs in increasing order.
+class SymbolSet
+{
+public:
+	typedef StdAllocator<unsigned long> allocator_type;
+
+	SymbolSet()
+		: m_Bits(allocator_type(TranslationContext::GetCurrent()))
+	{}
+
+	void Resize(size_t symbolCount)
+	{
+		m_Bits.resize(symbolCount);
+	}
+
+	void Insert(SymbolId id)
+	{
+		if(id >= m_Bits.size())
+		{
+			m_Bits.resize(id + 1);
+		}
+		m_Bits.set(id);
+	}
+
+	bool Contains(SymbolId id) const
+	{
+		return id < m_Bits.size() && m_Bits.test(id);
+	}
+
+	bool Empty() const
+	{
+		return m_Bits.none();
+	}
+
+	size_t Count() const
+	{
+		return m_Bits.count();
+	}
+
+	// NO_SYMBOL when there are no more
+	SymbolId First() const
+	{
+		return ToSymbol(m_Bits.find_first());
+	}
+
+	SymbolId Next(SymbolId id) const
+	{
+		return ToSymbol(m_Bits.find_next(id));
+	}
+
+private:
+	typedef boost::dynamic_bitset<unsigned long, allocator_type> Bits;
+
+	static SymbolId ToSymbol(size_t position)
+	{
+		return position != Bits::npos ? SymbolId(position) : NO_SYMBOL;
+	}
+
+	Bits m_Bits;
+};
+
+// A string of a frozen universe - it points into its image, so it is valid as long as the universe
+class FrozenString
+{
+public:
+	FrozenString()
+		: m_Data("")
+		, m_Size(0)
+	{}
+
+	FrozenString(const char* data, size_t size)
+		: m_Data(data)
+		, m_Size(size)
+	{}
+
+	FrozenString(const char* str)
+		: m_Data(str)
+		, m_Size(strlen(str))
+	{}
+
+	explicit FrozenString(const String& str)
+		: m_Data(str.data())
+		, m_Size(str.size())
+	{}
+
+	const char* data() const { return m_Data; }
+	size_t size() const { return m_Size; }
+	bool empty() const { return !m_Size; }
+	const char* begin() const { return m_Data; }
+	const char* end() const { return m_Data + m_Size; }
+	char operator[](size_t index) const { return m_Data[index]; }
+
+	bool operator==(const FrozenString& rhs) const
+	{
+		return m_Size == rhs.m_Size && !memcmp(m_Data, rhs.m_Data, m_Size);
+	}
+
+	bool operator!=(const FrozenString& rhs) const
+	{
+		return !operator==(rhs);
+	}
+
+	bool operator<(const FrozenString& rhs) const
+	{
+		const int order = memcmp(m_Data, rhs.m_Data, std::min(m_Size, rhs.m_Size));
+		return order < 0 || (!order && m_Size < rhs.m_Size);
+	}
+
+private:
+	const char* m_Data;
+	size_t m_Size;
+};
+
+// Consecutive elements of an array of a frozen universe
+template<typename T>
+class FrozenArray
+{
+public:
+	typedef const T* const_iterator;
+
+	FrozenArray()
+		: m_Begin(nullptr)
+		, m_End(nullptr)
+	{}
+
+	FrozenArray(const T* begin, size_t count)
+		: m_Begin(begin)
+		, m_End(begin + count)
+	{}
+
+	const T* begin() const { return m_Begin; }
+	const T* end() const { return m_End; }
+	const T* cbegin() const { return m_Begin; }
+	const T* cend() const { return m_End; }
+	size_t size() const { return m_End - m_Begin; }
+	bool empty() const { return m_Begin == m_End; }
+	const T& operator[](size_t index) const { return m_Begin[index]; }
+
+private:
+	const T* m_Begin;
+	const T* m_End;
+};
+
+// The image of a frozen universe is position-independent, so that a snapshot is the image itself and
+// is used where it is mapped. After the header come its arrays - the records refer to each other by
+// index and to their strings by offset in the string table. All records are 4-byte aligned.
+// header | symbols | functions | ids | returns | expansion | symbol table | atom table | strings
+
+// A string in the string table
+struct FrozenStringRecord
+{
+	unsigned Offset;
+	unsigned Size;
+};
+
+// Count elements of an array starting at Begin
+struct FrozenRange
+{
+	unsigned Begin;
+	unsigned Count;
+};
+
+struct FrozenImageHeader
+{
+	char Magic[8];
+	unsigned Version;
+	unsigned ByteOrder;
+	unsigned long long ContentHash;
+	unsigned long long Size;
+	unsigned HLSLSemanticCount;
+	unsigned AtomCount;
+	unsigned CombinatorCount;
+	unsigned SymbolsOffset;
+	unsigned SymbolCount;
+	// Atoms first, then combinators
+	unsigned FunctionsOffset;
+	// The needs and closures of the functions
+	unsigned IdsOffset;
+	unsigned IdCount;
+	unsigned ReturnsOffset;
+	unsigned ReturnCount;
+	unsigned ExpansionOffset;
+	unsigned ExpansionCount;
+	// Open addressing tables of IDs by the hash of the name - sizes are powers of two
+	unsigned SymbolTableOffset;
+	unsigned SymbolTableSize;
+	unsigned AtomTableOffset;
+	unsigned AtomTableSize;
+	unsigned StringsOffset;
+	unsigned StringsSize;
+};
+
+enum FrozenSymbolFlags
+{
+	FSF_Semantic = 1,
+	FSF_Texture = 2,
+	FSF_Sampler = 4
+};
+
+struct FrozenSymbolRecord
+{
+	FrozenStringRecord Name;
+	FrozenStringRecord LowerName;
+	// Of the semantic with that name - empty if there is none
+	FrozenStringRecord Type;
+	FrozenStringRecord HLSLSemantic;
+	unsigned HLSLSemanticIndex;
+	unsigned Combinator;
+	unsigned Flags;
+};
+
+struct FrozenFunctionRecord
+{
+	FrozenStringRecord ReturnType;
+	FrozenStringRecord LowerReturnType;
+	FrozenStringRecord Name;
+	FrozenStringRecord Params;
+	FrozenStringRecord Source;
+	SymbolId ReturnSymbol;
+	// In the ids
+	FrozenRange Needs;
+	FrozenRange Returns;
+	unsigned ExpansionBegin;
+	// In the ids
+	FrozenRange ClosureCombinators;
+	FrozenRange ClosureSemantics;
+	FrozenRange ClosureTextures;
+	FrozenRange ClosureSamplers;
+};
+
+// A "return expression;" statement as offsets in the source of a function
+struct FrozenReturn
+{
+	unsigned Begin;
+	unsigned End;
+	unsigned ExpressionBegin;
+	unsigned ExpressionEnd;
+};
+
+// One step of the flattened expansion of a function. Walking the steps in order does what
+// resolving the needs recursively would, with the skips taken when a need is already available.
+struct ExpansionStep
+{
+	enum StepType : unsigned
+	{
+		// Symbol is an input semantic, a texture or a sampler
+		RequireInput,
+		// Symbol is computed by Function - its steps are walked unless Symbol is available
+		EnterCombinator,
+		// Emit the code of Function and return to the step after the one that entered it
+		EmitFunction
+	};
+
+	StepType Type;
+	SymbolId Symbol;
+	// Index in the functions of the universe
+	unsigned Function;
+};
+
+// A name used as a semantic, a function return type or a need
+struct FrozenSymbol
+{
+	FrozenString Name;
+	FrozenString LowerName;
+	// Type and HLSLSemantic are those of the semantic with that name, empty if there is none
+	bool IsSemantic;
+	FrozenString Type;
+	FrozenString HLSLSemantic;
+	// Index of the HLSL semantic among the different ones of the universe, valid for semantics
+	unsigned HLSLSemanticIndex;
+	// The combinator that computes it - NO_FUNCTION if there is none
+	unsigned Combinator;
+	bool IsTexture;
+	bool IsSampler;
+};
+
+// Everything a function may pull in when nothing is available yet
+struct FunctionClosure
+{
+	// Indices of combinators, dependencies first
+	FrozenArray<unsigned> Combinators;
+	// Sorted by ID
+	FrozenArray<SymbolId> Semantics;
+	FrozenArray<SymbolId> Textures;
+	FrozenArray<SymbolId> Samplers;
+};
+
+struct FrozenFunction
+{
+	// Index in the functions of the universe - the atoms come first, then the combinators
+	unsigned Index;
+	// NO_SYMBOL for void functions
+	SymbolId ReturnType;
+	FrozenString ReturnTypeName;
+	FrozenString LowerReturnType;
+	FrozenString Name;
+	FrozenString Params;
+	FrozenString Source;
+	// Sorted by ID, as ExpandableFunction::Needs are by name
+	FrozenArray<SymbolId> Needs;
+	FrozenArray<FrozenReturn> Returns;
+	// Where its own steps start in the expansion - they end with the one that emits the function itself
+	unsigned ExpansionBegin;
+	FunctionClosure Closure;
+};
+
+// An index of a universe where every name is interned to a dense integer ID.
+// IDs are given in the order of the names, so ordering IDs orders the names.
+// It reads everything from its image, which the owner keeps alive as long as the index.
+class FrozenUniverse : boost::noncopyable
+{
+public:
+	// The image has to be a valid one
+	FrozenUniverse(const char* image, std::shared_ptr<const void> owner)
+		: m_Owner(std::move(owner))
+		, m_Image(image)
+		, m_Header(reinterpret_cast<const FrozenImageHeader*>(image))
+		, m_Symbols(reinterpret_cast<const FrozenSymbolRecord*>(image + m_Header->SymbolsOffset))
+		, m_Functions(reinterpret_cast<const FrozenFunctionRecord*>(image + m_Header->FunctionsOffset))
+		, m_Ids(reinterpret_cast<const unsigned*>(image + m_Header->IdsOffset))
+		, m_Returns(reinterpret_cast<const FrozenReturn*>(image + m_Header->ReturnsOffset))
+		, m_Expansion(reinterpret_cast<const ExpansionStep*>(image + m_Header->ExpansionOffset))
+		, m_SymbolTable(reinterpret_cast<const SymbolId*>(image + m_Header->SymbolTableOffset))
+		, m_AtomTable(reinterpret_cast<const unsigned*>(image + m_Header->AtomTableOffset))
+		, m_Strings(image + m_Header->StringsOffset)
+	{}
+
+	const char* GetImage() const { return m_Image; }
+	const FrozenImageHeader& GetHeader() const { return *m_Header; }
+
+	unsigned GetSymbolCount() const { return m_Header->SymbolCount; }
+	unsigned GetAtomCount() const { return m_Header->AtomCount; }
+	unsigned GetCombinatorCount() const { return m_Header->CombinatorCount; }
+	unsigned GetHLSLSemanticCount() const { return m_Header->HLSLSemanticCount; }
+
+	FrozenSymbol GetSymbol(SymbolId id) const
+	{
+		const FrozenSymbolRecord& record = m_Symbols[id];
+		FrozenSymbol symbol;
+		symbol.Name = GetString(record.Name);
+		symbol.LowerName = GetString(record.LowerName);
+		symbol.IsSemantic = (record.Flags & FSF_Semantic) != 0;
+		symbol.Type = GetString(record.Type);
+		symbol.HLSLSemantic = GetString(record.HLSLSemantic);
+		symbol.HLSLSemanticIndex = record.HLSLSemanticIndex;
+		symbol.Combinator = record.Combinator;
+		symbol.IsTexture = (record.Flags & FSF_Texture) != 0;
+		symbol.IsSampler = (record.Flags & FSF_Sampler) != 0;
+		return symbol;
+	}
+
+	bool IsSemantic(SymbolId id) const
+	{
+		return (m_Symbols[id].Flags & FSF_Semantic) != 0;
+	}
+
+	FrozenFunction GetFunction(unsigned index) const
+	{
+		const FrozenFunctionRecord& record = m_Functions[index];
+		FrozenFunction function;
+		function.Index = index;
+		function.ReturnType = record.ReturnSymbol;
+		function.ReturnTypeName = GetString(record.ReturnType);
+		function.LowerReturnType = GetString(record.LowerReturnType);
+		function.Name = GetString(record.Name);
+		function.Params = GetString(record.Params);
+		function.Source = GetString(record.Source);
+		function.Needs = FrozenArray<SymbolId>(m_Ids + record.Needs.Begin, record.Needs.Count);
+		function.Returns = FrozenArray<FrozenReturn>(m_Returns + record.Returns.Begin, record.Returns.Count);
+		function.ExpansionBegin = record.ExpansionBegin;
+		function.Closure.Combinators = FrozenArray<unsigned>(m_Ids + record.ClosureCombinators.Begin, record.ClosureCombinators.Count);
+		function.Closure.Semantics = FrozenArray<SymbolId>(m_Ids + record.ClosureSemantics.Begin, record.ClosureSemantics.Count);
+		function.Closure.Textures = FrozenArray<SymbolId>(m_Ids + record.ClosureTextures.Begin, record.ClosureTextures.Count);
+		function.Closure.Samplers = FrozenArray<SymbolId>(m_Ids + record.ClosureSamplers.Begin, record.ClosureSamplers.Count);
+		return function;
+	}
+
+	FrozenFunction GetAtom(unsigned index) const
+	{
+		return GetFunction(index);
+	}
+
+	FrozenFunction GetCombinator(unsigned index) const
+	{
+		return GetFunction(m_Header->AtomCount + index);
+	}
+
+	// The steps of every function once, the ones of a combinator before those of the functions that need it
+	const ExpansionStep& GetExpansionStep(unsigned index) const
+	{
+		return m_Expansion[index];
+	}
+
+	unsigned GetExpansionBegin(unsigned function) const
+	{
+		return m_Functions[function].ExpansionBegin;
+	}
+
+	SymbolId FindSymbol(const String& name) const
+	{
+		const unsigned mask = m_Header->SymbolTableSize - 1;
+		for(unsigned slot = GetTableSlot(name.data(), name.size(), mask);; slot = (slot + 1) & mask)
+		{
+			const SymbolId id = m_SymbolTable[slot];
+			if(id == NO_SYMBOL || GetString(m_Symbols[id].Name) == FrozenString(name))
+			{
+				return id;
+			}
+		}
+	}
+
+	unsigned FindAtom(const String& name) const
+	{
+		const unsigned mask = m_Header->AtomTableSize - 1;
+		for(unsigned slot = GetTableSlot(name.data(), name.size(), mask);; slot = (slot + 1) & mask)
+		{
+			const unsigned index = m_AtomTable[slot];
+			if(index == NO_FUNCTION || GetString(m_Functions[index].Name) == FrozenString(name))
+			{
+				return index;
+			}
+		}
+	}
+
+	// Where the lookup of a name starts in a table with mask + 1 slots
+	static unsigned GetTableSlot(const char* name, size_t size, unsigned mask)
+	{
+		return unsigned(HashBytes(name, size)) & mask;
+	}
+
+private:
+	FrozenString GetString(const FrozenStringRecord& record) const
+	{
+		return FrozenString(m_Strings + record.Offset, record.Size);
+	}
+
+	std::shared_ptr<const void> m_Owner;
+	const char* m_Image;
+	const FrozenImageHeader* m_Header;
+	const FrozenSymbolRecord* m_Symbols;
+	const FrozenFunctionRecord* m_Functions;
+	const unsigned* m_Ids;
+	const FrozenReturn* m_Returns;
+	const ExpansionStep* m_Expansion;
+	const SymbolId* m_SymbolTable;
+	const unsigned* m_AtomTable;
+	const char* m_Strings;
+};
+
+typedef std::shared_ptr<const FrozenUniverse> FrozenUniversePtr;
+
+}
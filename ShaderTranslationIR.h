@@ -0,0 +1,145 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+#include "ShaderTranslationUtilities.h"
+#include "ShaderTranslationFrozenUniverse.h"
+
+namespace translator
+{
+
+class ShaderTranslationUniverse;
+
+enum TranslatorShaderType
+{
+	VertexShader,
+	PixelShader
+};
+
+static const unsigned NO_REWRITE = unsigned(-1);
+
+// A polymorphic declaration - one entry per atom listed in a polymorphic block
+struct ParsedPolymorphic
+{
+	String Name;
+	String Atom;
+	// Index of the atom in the frozen universe
+	unsigned AtomId;
+};
+
+// A rewrite point inside an entry point body. Offsets are relative to the body.
+// Scanning resumes at End and continues with Next; a CONTEXT_IF whose code is
+// removed resumes at SkipTo and continues with SkipNext instead.
+struct ParsedRewrite
+{
+	CodeTranslationType Type;
+	unsigned Begin;
+	unsigned PrefixEnd;
+	unsigned End;
+
+	// Polymorphic name for calls, upper-cased semantic for outputs and CONTEXT_IFs
+	String Name;
+	// The symbol of the semantic for outputs and CONTEXT_IFs - NO_SYMBOL if it is unknown
+	SymbolId Symbol;
+	// Indices in ParsedShader::Polymorphics visible for this call - empty if it is plain code
+	CountedVector<unsigned> Candidates;
+	// The output is a known semantic
+	bool IsSemantic;
+
+	bool HasClosingBrace;
+	unsigned SkipTo;
+
+	unsigned Next;
+	unsigned SkipNext;
+};
+
+struct ParsedEntryPoint
+{
+	TranslatorShaderType Type;
+	String Signature;
+	// Shader needs in declaration order, already validated against the universe
+	CountedVector<SymbolId> Needs;
+
+	// The body inside the outermost braces, as offsets in ParsedShader::Source
+	unsigned BodyBegin;
+	unsigned BodyEnd;
+
+	unsigned FirstRewrite;
+	CountedVector<ParsedRewrite> Rewrites;
+};
+
+// A texture or sampler of a shader that the universe does not know of
+struct LocalSymbol
+{
+	String Name;
+	String LowerName;
+	bool IsTexture;
+	bool IsSampler;
+};
+
+// A piece of the output - either verbatim source text or an entry point
+struct ParsedSegment
+{
+	unsigned Begin;
+	unsigned End;
+	int EntryPoint;
+};
+
+// The immutable result of parsing a shader against a universe. It can be
+// instantiated any number of times with different polymorphic bindings.
+// Not copyable, as Source may point into the shader's own memory.
+class ParsedShader : boost::noncopyable
+{
+public:
+	ParsedShader()
+		: Source("", 0)
+	{}
+
+	// The text the offsets point into. It is either OwnedSource, a mapped
+	// SourceFile or the caller's buffer for the duration of a translation.
+	SourceView Source;
+	String OwnedSource;
+	std::shared_ptr<const void> SourceFile;
+	unsigned long long SourceHash;
+	const ShaderTranslationUniverse* Universe;
+	unsigned long long UniverseGeneration;
+	FrozenUniversePtr Frozen;
+	// Textures and samplers needed by entry points that the universe does not know of.
+	// Their IDs follow the ones of the universe symbols.
+	CountedVector<LocalSymbol> LocalSymbols;
+
+	unsigned GetSymbolCount() const
+	{
+		return Frozen->GetSymbolCount() + unsigned(LocalSymbols.size());
+	}
+
+	FrozenSymbol GetSymbol(SymbolId id) const
+	{
+		if(id < Frozen->GetSymbolCount())
+		{
+			return Frozen->GetSymbol(id);
+		}
+
+		const LocalSymbol& local = LocalSymbols[id - Frozen->GetSymbolCount()];
+		FrozenSymbol symbol;
+		symbol.Name = FrozenString(local.Name);
+		symbol.LowerName = FrozenString(local.LowerName);
+		symbol.IsSemantic = false;
+		symbol.HLSLSemanticIndex = 0;
+		symbol.Combinator = NO_FUNCTION;
+		symbol.IsTexture = local.IsTexture;
+		symbol.IsSampler = local.IsSampler;
+		return symbol;
+	}
+
+	CountedVector<ParsedPolymorphic> Polymorphics;
+	CountedVector<ParsedEntryPoint> EntryPoints;
+	CountedVector<ParsedSegment> Segments;
+};
+
+typedef std::shared_ptr<const ParsedShader> ParsedShaderPtr;
+
+}
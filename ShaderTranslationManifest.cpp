@@ -0,0 +1,360 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationManifest.h"
+#include "ShaderTranslationCache.h"
+#include "ShaderTranslationUtilities.h"
+
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+namespace translator
+{
+
+namespace fs = boost::filesystem;
+
+// Changes whenever translating gives a different output for the same inputs
+static const char* BUILD_STATE_HEADER = "ShaderTranslator build state 2";
+
+namespace
+{
+
+std::string ResolvePath(const fs::path& base, const std::string& path)
+{
+	const fs::path resolved(path);
+	return resolved.is_absolute() ? resolved.string() : (base / resolved).string();
+}
+
+// The kinds of universe definitions as written in the state
+static const char* DEFINITION_KINDS[] = { "semantic", "atom", "combinator" };
+
+std::map<String, unsigned long long>& GetDigest(UniverseDigest& digest, size_t kind)
+{
+	return kind == 0 ? digest.Semantics : kind == 1 ? digest.Atoms : digest.Combinators;
+}
+
+const std::map<String, unsigned long long>& GetDigest(const UniverseDigest& digest, size_t kind)
+{
+	return kind == 0 ? digest.Semantics : kind == 1 ? digest.Atoms : digest.Combinators;
+}
+
+DependencyNames& GetNames(TranslationDependencies& dependencies, size_t kind)
+{
+	return kind == 0 ? dependencies.Semantics : kind == 1 ? dependencies.Atoms : dependencies.Combinators;
+}
+
+const DependencyNames& GetNames(const TranslationDependencies& dependencies, size_t kind)
+{
+	return kind == 0 ? dependencies.Semantics : kind == 1 ? dependencies.Atoms : dependencies.Combinators;
+}
+
+size_t FindKind(const std::string& name)
+{
+	return std::find(DEFINITION_KINDS, DEFINITION_KINDS + 3, name) - DEFINITION_KINDS;
+}
+
+void WriteNames(std::ostream& out, const char* prefix, const std::set<String>& names)
+{
+	for(auto name = names.cbegin(); name != names.cend(); ++name)
+	{
+		out << prefix << *name << "\n";
+	}
+}
+
+bool ManifestError(const std::string& path, unsigned line, const std::string& message, std::string& error)
+{
+	std::ostringstream out;
+	out << path << "(" << line << "): " << message;
+	error = out.str();
+	return false;
+}
+
+}
+
+bool ReadManifest(const std::string& path, TranslationManifest& manifest, std::string& error)
+{
+	std::ifstream fin(path.c_str());
+	if(!fin.is_open())
+	{
+		error = "Unable to open manifest: " + path;
+		return false;
+	}
+
+	const fs::path base = fs::path(path).parent_path();
+	TranslationManifest result;
+	std::map<std::string, unsigned> outputs;
+
+	std::string text;
+	for(unsigned line = 1; std::getline(fin, text); ++line)
+	{
+		std::istringstream tokens(text);
+		std::string directive;
+		if(!(tokens >> directive) || directive[0] == '#')
+		{
+			continue;
+		}
+
+		if(directive == "semantics" || directive == "atoms" || directive == "combinators")
+		{
+			ShaderTranslationUniverse::LibraryFile file;
+			std::string library;
+			if(!(tokens >> library))
+			{
+				return ManifestError(path, line, "expected a library file after " + directive, error);
+			}
+			file.Path = ResolvePath(base, library);
+			file.Content = directive == "semantics" ? ShaderTranslationUniverse::SemanticsLibrary
+				: directive == "atoms" ? ShaderTranslationUniverse::AtomsLibrary
+				: ShaderTranslationUniverse::CombinatorsLibrary;
+			result.Library.push_back(file);
+		}
+		else if(directive == "shader")
+		{
+			ManifestEntry entry;
+			std::string shader;
+			std::string output;
+			if(!(tokens >> shader >> output))
+			{
+				return ManifestError(path, line, "expected a shader and an output file", error);
+			}
+			entry.Shader = ResolvePath(base, shader);
+			entry.Output = ResolvePath(base, output);
+			entry.Line = line;
+
+			std::string binding;
+			while(tokens >> binding)
+			{
+				const size_t separator = binding.find('=');
+				if(separator == 0 || separator == std::string::npos || separator + 1 == binding.size())
+				{
+					return ManifestError(path, line, "expected polymorphic=atom instead of " + binding, error);
+				}
+				const String polymorphic(binding.c_str(), separator);
+				const String atom(binding.c_str() + separator + 1);
+				if(!entry.Params.insert(std::make_pair(polymorphic, atom)).second)
+				{
+					return ManifestError(path, line, "polymorphic bound twice: " + binding.substr(0, separator), error);
+				}
+			}
+
+			auto previous = outputs.insert(std::make_pair(entry.Output, line));
+			if(!previous.second)
+			{
+				std::ostringstream message;
+				message << "output also written on line " << previous.first->second << ": " << output;
+				return ManifestError(path, line, message.str(), error);
+			}
+			result.Entries.push_back(entry);
+		}
+		else
+		{
+			return ManifestError(path, line, "unknown directive " + directive, error);
+		}
+	}
+
+	std::swap(manifest, result);
+	return true;
+}
+
+bool TranslationBuildState::Load(const std::string& path)
+{
+	m_Universe = UniverseDigest();
+	m_Outputs.clear();
+
+	std::ifstream fin(path.c_str());
+	if(!fin.is_open())
+	{
+		return !fs::exists(path);
+	}
+
+	std::string line;
+	if(!std::getline(fin, line) || line != BUILD_STATE_HEADER)
+	{
+		return true;
+	}
+
+	// The digest of the universe comes first, then every output followed by its dependencies
+	OutputState* output = nullptr;
+	while(std::getline(fin, line))
+	{
+		std::istringstream tokens(line);
+		std::string directive;
+		std::string name;
+		std::string value;
+		tokens >> directive;
+
+		size_t kind = FindKind(directive);
+		if(kind < 3 && tokens >> value >> name)
+		{
+			GetDigest(m_Universe, kind)[String(name.c_str())] = strtoull(value.c_str(), nullptr, 16);
+		}
+		else if(directive == "output" && tokens >> value && std::getline(tokens >> std::ws, name))
+		{
+			output = &m_Outputs[name];
+			output->Key = strtoull(value.c_str(), nullptr, 16);
+		}
+		else if(output && (directive == "uses" || directive == "looks-up") && tokens >> value >> name && (kind = FindKind(value)) < 3)
+		{
+			DependencyNames& names = GetNames(output->Dependencies, kind);
+			(directive == "uses" ? names.Used : names.LookedUp).insert(String(name.c_str()));
+		}
+		else if(output && (directive == "texture" || directive == "sampler") && tokens >> name)
+		{
+			(directive == "texture" ? output->Dependencies.Textures : output->Dependencies.Samplers).insert(String(name.c_str()));
+		}
+		else if(output && directive == "binds" && tokens >> name >> value)
+		{
+			output->Dependencies.Bindings[String(name.c_str())] = String(value.c_str());
+		}
+		else
+		{
+			m_Universe = UniverseDigest();
+			m_Outputs.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool TranslationBuildState::Save(const std::string& path) const
+{
+	const std::string tempPath = path + ".tmp";
+	boost::system::error_code error;
+	{
+		std::ofstream fout(tempPath.c_str(), std::ios::trunc);
+		if(!fout.is_open())
+		{
+			return false;
+		}
+
+		fout << BUILD_STATE_HEADER << "\n";
+		char hash[32];
+		for(size_t kind = 0; kind < 3; ++kind)
+		{
+			const std::map<String, unsigned long long>& digest = GetDigest(m_Universe, kind);
+			for(auto definition = digest.cbegin(); definition != digest.cend(); ++definition)
+			{
+				sprintf(hash, "%016llx", definition->second);
+				fout << DEFINITION_KINDS[kind] << " " << hash << " " << definition->first << "\n";
+			}
+		}
+
+		for(auto output = m_Outputs.cbegin(); output != m_Outputs.cend(); ++output)
+		{
+			sprintf(hash, "%016llx", output->second.Key);
+			fout << "output " << hash << " " << output->first << "\n";
+
+			const TranslationDependencies& dependencies = output->second.Dependencies;
+			for(size_t kind = 0; kind < 3; ++kind)
+			{
+				const DependencyNames& names = GetNames(dependencies, kind);
+				WriteNames(fout, (std::string("uses ") + DEFINITION_KINDS[kind] + " ").c_str(), names.Used);
+				WriteNames(fout, (std::string("looks-up ") + DEFINITION_KINDS[kind] + " ").c_str(), names.LookedUp);
+			}
+			WriteNames(fout, "texture ", dependencies.Textures);
+			WriteNames(fout, "sampler ", dependencies.Samplers);
+			for(auto binding = dependencies.Bindings.cbegin(); binding != dependencies.Bindings.cend(); ++binding)
+			{
+				fout << "binds " << binding->first << " " << binding->second << "\n";
+			}
+		}
+		if(!fout.flush())
+		{
+			fout.close();
+			fs::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	fs::rename(tempPath, path, error);
+	if(error)
+	{
+		fs::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+const UniverseDigest& TranslationBuildState::GetUniverse() const
+{
+	return m_Universe;
+}
+
+void TranslationBuildState::SetUniverse(const UniverseDigest& universe)
+{
+	m_Universe = universe;
+}
+
+bool TranslationBuildState::IsUpToDate(const std::string& output, unsigned long long key) const
+{
+	auto found = m_Outputs.find(output);
+	if(found == m_Outputs.cend() || found->second.Key != key)
+	{
+		return false;
+	}
+
+	boost::system::error_code error;
+	return fs::is_regular_file(output, error);
+}
+
+void TranslationBuildState::FindAffected(const UniverseDiff& diff, std::set<std::string>& outputs) const
+{
+	outputs.clear();
+	if(diff.Empty())
+	{
+		return;
+	}
+
+	std::vector<const std::string*> names;
+	DependencyIndex index;
+	for(auto output = m_Outputs.cbegin(); output != m_Outputs.cend(); ++output)
+	{
+		index.Add(unsigned(names.size()), output->second.Dependencies);
+		names.push_back(&output->first);
+	}
+
+	std::vector<unsigned> affected;
+	index.FindAffected(diff, affected);
+	for(auto output = affected.cbegin(); output != affected.cend(); ++output)
+	{
+		outputs.insert(*names[*output]);
+	}
+}
+
+void TranslationBuildState::Update(const std::string& output, unsigned long long key, const TranslationDependencies& dependencies)
+{
+	OutputState& state = m_Outputs[output];
+	state.Key = key;
+	state.Dependencies = dependencies;
+}
+
+void TranslationBuildState::Remove(const std::string& output)
+{
+	m_Outputs.erase(output);
+}
+
+void TranslationBuildState::Retain(const TranslationManifest& manifest)
+{
+	std::map<std::string, OutputState> outputs;
+	for(auto entry = manifest.Entries.cbegin(); entry != manifest.Entries.cend(); ++entry)
+	{
+		auto found = m_Outputs.find(entry->Output);
+		if(found != m_Outputs.end())
+		{
+			outputs.insert(*found);
+		}
+	}
+	m_Outputs.swap(outputs);
+}
+
+unsigned long long MakeBuildKey(unsigned long long sourceHash, const ShaderTranslationParams& params)
+{
+	const unsigned long long paramsHash = HashParams(params);
+	const unsigned long long key = HashBytes(reinterpret_cast<const char*>(&sourceHash), sizeof(sourceHash));
+	return HashBytes(reinterpret_cast<const char*>(&paramsHash), sizeof(paramsHash), key);
+}
+
+}
@@ -0,0 +1,74 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+#include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationDependencies.h"
+
+namespace translator
+{
+
+struct ManifestEntry
+{
+	std::string Shader;
+	std::string Output;
+	ShaderTranslationParams Params;
+	unsigned Line;
+};
+
+// The files a content build translates. Manifests are text files with one directive per line,
+// empty lines and lines starting with # are skipped:
+//  semantics|atoms|combinators <library file>
+//  shader <source> <output> [polymorphic=atom ...]
+// Relative paths are relative to the directory of the manifest; paths can not contain spaces.
+struct TranslationManifest
+{
+	std::vector<ShaderTranslationUniverse::LibraryFile> Library;
+	std::vector<ManifestEntry> Entries;
+};
+
+// Reports the first malformed line; two entries that write the same output are an error as well
+bool ReadManifest(const std::string& path, TranslationManifest& manifest, std::string& error);
+
+// Remembers the key of the shader and bindings every output was last translated from and what
+// it read from the universe, so that a build can skip the outputs whose inputs did not change
+class TranslationBuildState
+{
+public:
+	// A missing file is an empty state; a file of another version is ignored as well
+	bool Load(const std::string& path);
+	// Written to a temporary file that replaces the previous state, so a crash never leaves a partial one
+	bool Save(const std::string& path) const;
+
+	// The universe the recorded dependencies were read from
+	const UniverseDigest& GetUniverse() const;
+	void SetUniverse(const UniverseDigest& universe);
+
+	// True only if the output exists and was written from the same key
+	bool IsUpToDate(const std::string& output, unsigned long long key) const;
+	// The outputs that depend on an edited definition
+	void FindAffected(const UniverseDiff& diff, std::set<std::string>& outputs) const;
+
+	void Update(const std::string& output, unsigned long long key, const TranslationDependencies& dependencies);
+	void Remove(const std::string& output);
+	// Forgets the outputs that are no longer built
+	void Retain(const TranslationManifest& manifest);
+
+private:
+	struct OutputState
+	{
+		unsigned long long Key;
+		TranslationDependencies Dependencies;
+	};
+
+	UniverseDigest m_Universe;
+	std::map<std::string, OutputState> m_Outputs;
+};
+
+// Combines the shader and the bindings of an entry - the universe is covered by the dependencies
+unsigned long long MakeBuildKey(unsigned long long sourceHash, const ShaderTranslationParams& params);
+
+}
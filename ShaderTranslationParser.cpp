@@ -0,0 +1,566 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+#include "ShaderTranslatorImpl.h"
+
+namespace translator
+{
+
+// Walks a source buffer line by line. Like !std::getline(stream, line).eof()
+// it only yields lines terminated by a new line. The '\r' of a CRLF ending is left
+// out of the line, as a read in text mode would, but the cursor still moves past it.
+class ShaderTranslatorImpl::LineReader
+{
+public:
+	LineReader(const char* begin, const char* end)
+		: m_Cursor(begin)
+		, m_End(end)
+	{}
+
+	bool Next(const char*& lineBegin, const char*& lineEnd)
+	{
+		const char* newLine = std::find(m_Cursor, m_End, '\n');
+		if(newLine == m_End)
+		{
+			m_Cursor = m_End;
+			return false;
+		}
+		lineBegin = m_Cursor;
+		lineEnd = newLine != m_Cursor && newLine[-1] == '\r' ? newLine - 1 : newLine;
+		m_Cursor = newLine + 1;
+		return true;
+	}
+
+	const char* GetCursor() const
+	{
+		return m_Cursor;
+	}
+
+private:
+	const char* m_Cursor;
+	const char* m_End;
+};
+
+namespace
+{
+// Interns a texture or sampler that only the shader uses
+SymbolId AddLocalSymbol(ParsedShader& parsed, const String& name)
+{
+	const SymbolId base = SymbolId(parsed.Frozen->GetSymbolCount());
+	for(unsigned i = 0; i < parsed.LocalSymbols.size(); ++i)
+	{
+		if(parsed.LocalSymbols[i].Name == name)
+		{
+			return base + i;
+		}
+	}
+
+	LocalSymbol symbol;
+	symbol.Name = name;
+	symbol.LowerName = boost::to_lower_copy(name);
+	symbol.IsTexture = name.find(MAP_PREFIX) == 0;
+	symbol.IsSampler = name.find(SAMPLER_PREFIX) == 0;
+	parsed.LocalSymbols.push_back(symbol);
+	return base + SymbolId(parsed.LocalSymbols.size() - 1);
+}
+
+// The declarations are only matched on the lines that have their keyword, so the
+// regular expressions don't allocate for every line of the shader
+bool HasKeyword(const char* begin, const char* end, const char* keyword)
+{
+	return std::search(begin, end, keyword, keyword + strlen(keyword)) != end;
+}
+
+// Splits a list of names like boost::split on ", \r" with token_compress_on, empty tokens at the
+// ends included, without the allocations of its finder
+void SplitNames(const String& list, CountedVector<String>& names)
+{
+	const auto isSeparator = [](char c) { return c == ',' || c == ' ' || c == '\r'; };
+	const char* end = list.data() + list.size();
+	const char* tokenBegin = list.data();
+	for(const char* c = tokenBegin; ; ++c)
+	{
+		if(c == end || isSeparator(*c))
+		{
+			names.push_back(String(tokenBegin, c));
+			if(c == end)
+			{
+				break;
+			}
+			while(c + 1 != end && isSeparator(c[1]))
+			{
+				++c;
+			}
+			tokenBegin = c + 1;
+		}
+	}
+}
+
+static const unsigned NO_BRACE = unsigned(-1);
+
+// The braces of a body, each opening one linked to the one that closes it. Looking for the end of a
+// block jumps over the blocks nested in it, so resolving all CONTEXT_IFs takes linear time.
+class BraceIndex
+{
+public:
+	BraceIndex(const char* body, unsigned size)
+		: m_Body(body)
+	{
+		CountedVector<unsigned> open;
+		for(unsigned position = 0; position < size; ++position)
+		{
+			if(body[position] == '{')
+			{
+				open.push_back(unsigned(m_Braces.size()));
+				m_Braces.push_back(position);
+				m_Closing.push_back(NO_BRACE);
+			}
+			else if(body[position] == '}')
+			{
+				if(!open.empty())
+				{
+					m_Closing[open.back()] = unsigned(m_Braces.size());
+					open.pop_back();
+				}
+				m_Braces.push_back(position);
+				m_Closing.push_back(NO_BRACE);
+			}
+		}
+	}
+
+	// The first closing brace from the position on that isn't matched by an opening one after it
+	bool FindClosing(unsigned from, unsigned& position) const
+	{
+		size_t brace = std::lower_bound(m_Braces.cbegin(), m_Braces.cend(), from) - m_Braces.cbegin();
+		while(brace < m_Braces.size())
+		{
+			if(m_Body[m_Braces[brace]] == '}')
+			{
+				position = m_Braces[brace];
+				return true;
+			}
+			// An opening brace that's never closed hides all the closing ones after it
+			if(m_Closing[brace] == NO_BRACE)
+			{
+				return false;
+			}
+			brace = m_Closing[brace] + 1;
+		}
+		return false;
+	}
+
+private:
+	const char* m_Body;
+	// Positions in the body
+	CountedVector<unsigned> m_Braces;
+	// For opening braces the index of the closing one in m_Braces
+	CountedVector<unsigned> m_Closing;
+};
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ParsePolymorphic(LineReader& lines, ParsedShader& parsed, const String& name)
+{
+	ScratchString source;
+	const char* lineBegin;
+	const char* lineEnd;
+	bool inCode = false;
+	bool end = false;
+	bool eof = false;
+	// NB: the line following the closing brace is consumed as well
+	for(;;)
+	{
+		if(!lines.Next(lineBegin, lineEnd))
+		{
+			eof = true;
+			break;
+		}
+		if(end)
+		{
+			break;
+		}
+
+		if(!inCode && std::find(lineBegin, lineEnd, '{') != lineEnd)
+		{
+			inCode = true;
+		}
+		else if(inCode)
+		{
+			for(const char* c = lineBegin; c != lineEnd; ++c)
+			{
+				if(*c == '}')
+				{
+					end = true;
+					break;
+				}
+				source.push_back(*c);
+			}
+		}
+	}
+
+	if(eof && !end)
+	{
+		m_Error = "Error parsing polymorphic types - EOF";
+		return ShaderTranslator::PolymorphicParsingError;
+	}
+
+	CountedVector<String> ptrs;
+	SplitNames(source, ptrs);
+
+	for(auto it = ptrs.begin(); it != ptrs.end(); ++it)
+	{
+		boost::trim(*it);
+		const unsigned atomId = parsed.Frozen->FindAtom(*it);
+		if(atomId == NO_FUNCTION)
+		{
+			m_Error = "Unknown atom used: ";
+			m_Error.append(it->c_str());
+			return ShaderTranslator::UnknownAtomUsed;
+		}
+		ParsedPolymorphic polymorphic;
+		polymorphic.Name = name;
+		polymorphic.Atom = *it;
+		polymorphic.AtomId = atomId;
+		parsed.Polymorphics.push_back(polymorphic);
+	}
+	
+	return ShaderTranslator::Ok;
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ParseEntryPoint(LineReader& lines
+																			, ParsedShader& parsed
+																			, TranslatorShaderType type
+																			, const DeclarationMatch& match)
+{
+	ParsedEntryPoint entryPoint;
+	entryPoint.Type = type;
+	entryPoint.Signature.assign(match[1].first, match[1].second);
+
+	const FrozenUniverse& frozen = *parsed.Frozen;
+
+	// Check the needs of the shader itself
+	String temp(match[7].first, match[7].second);
+	CountedVector<String> shaderNeeds;
+	SplitNames(temp, shaderNeeds);
+
+	for(auto it = shaderNeeds.cbegin(); it != shaderNeeds.cend(); ++it)
+	{
+		if(it->empty())
+		{
+			continue;
+		}
+		SymbolId symbol = frozen.FindSymbol(*it);
+		if(it->find(MAP_PREFIX) != 0 && it->find(SAMPLER_PREFIX) != 0 && (symbol == NO_SYMBOL || !frozen.IsSemantic(symbol)))
+		{
+			m_Error = "Unknown semantic found: ";
+			m_Error.append(it->begin(), it->end());
+			return ShaderTranslator::UnknownSemantic;
+		}
+		if(symbol == NO_SYMBOL)
+		{
+			symbol = AddLocalSymbol(parsed, *it);
+		}
+		entryPoint.Needs.push_back(symbol);
+	}
+
+	// Find the body - everything up to the brace closing the first opened one.
+	// The lines are contiguous in the source so the body is kept as a range.
+	const char* source = parsed.Source.GetData();
+	const char* lineBegin;
+	const char* lineEnd;
+	const char* bodyBegin = nullptr;
+	const char* bodyEnd = lines.GetCursor();
+	size_t startPosition = String::npos;
+	size_t scopes = 0;
+	while(lines.Next(lineBegin, lineEnd))
+	{
+		const char* from = lineBegin;
+		if(startPosition == String::npos)
+		{
+			const char* brace = std::find(lineBegin, lineEnd, '{');
+			if(brace != lineEnd)
+			{
+				startPosition = brace - lineBegin;
+				++scopes;
+				// the characters right after the opening brace are skipped as many times as the brace offset
+				const size_t lineStart = startPosition + 1;
+				from = lineBegin + std::min<size_t>(2 * lineStart, lineEnd - lineBegin);
+			}
+			if(bodyBegin && from != lineBegin)
+			{
+				// A closing brace before the opening one
+				m_Error = "Unexpected end of file";
+				return ShaderTranslator::UnexpectedEOF;
+			}
+		}
+		if(!bodyBegin)
+		{
+			bodyBegin = from;
+		}
+
+		const char* cursor = from;
+		for(; cursor != lineEnd; ++cursor)
+		{
+			if(*cursor == '{')
+			{
+				++scopes;
+			}
+			else if(*cursor == '}')
+			{
+				--scopes;
+				if(!scopes) break;
+			}
+		}
+		bodyEnd = cursor;
+
+		if(!scopes) break;
+		bodyEnd = lines.GetCursor();
+	}
+
+	if(scopes != 0)
+	{
+		m_Error = "Unexpected end of file";
+		return ShaderTranslator::UnexpectedEOF;
+	}
+
+	if(!bodyBegin)
+	{
+		bodyBegin = bodyEnd;
+	}
+	entryPoint.BodyBegin = unsigned(bodyBegin - source);
+	entryPoint.BodyEnd = unsigned(bodyEnd - source);
+
+	ParseRewrites(parsed, entryPoint);
+
+	ParsedSegment segment = { 0, 0, int(parsed.EntryPoints.size()) };
+	parsed.Segments.push_back(segment);
+	parsed.EntryPoints.push_back(std::move(entryPoint));
+
+	return ShaderTranslator::Ok;
+}
+
+void ShaderTranslatorImpl::ParseRewrites(const ParsedShader& parsed, ParsedEntryPoint& entryPoint)
+{
+	const FrozenUniverse& frozen = *parsed.Frozen;
+	const char* body = parsed.Source.GetData() + entryPoint.BodyBegin;
+	const unsigned size = entryPoint.BodyEnd - entryPoint.BodyBegin;
+
+	// Rewrites are keyed by their start - the same start always yields the same
+	// rewrite, so the paths with kept and removed CONTEXT_IF blocks share them.
+	CountedMap<unsigned, unsigned> rewritesByBegin;
+	CountedVector<unsigned> pending;
+	// Only built for bodies with CONTEXT_IFs
+	std::unique_ptr<BraceIndex> braces;
+
+	// The walks from the ends of different rewrites agree past their first character that isn't whitespace.
+	// Keyed by such a character, the match the walk after it finds and where that walk ended.
+	struct ScannedSpan
+	{
+		unsigned End;
+		CodeTranslation Match;
+	};
+	CountedMap<unsigned, ScannedSpan> scanned;
+
+	auto Scan = [&](unsigned from) -> CodeTranslation
+	{
+		unsigned first = from;
+		while(first < size && isspace((unsigned char)body[first]))
+		{
+			++first;
+		}
+		if(first == size)
+		{
+			return FindNextCodeTranslation(body + from, body + size);
+		}
+		// Only the first character depends on where the walk starts
+		CodeTranslation match = FindNextCodeTranslation(body + from, body + size, body + first + 1);
+		if(match.Type != CT_None)
+		{
+			return match;
+		}
+
+		auto span = scanned.upper_bound(first);
+		if(span != scanned.begin() && std::prev(span)->second.End > first)
+		{
+			return std::prev(span)->second.Match;
+		}
+
+		// Walk up to the next known span - if nothing is found before it, the rest is known too
+		const unsigned stop = span != scanned.end() ? span->first + 1 : size;
+		match = FindNextCodeTranslation(body + first + 1, body + size, body + stop);
+		ScannedSpan result = { size, match };
+		if(match.Type != CT_None)
+		{
+			result.End = unsigned(match.PrefixEnd - body);
+		}
+		else if(span != scanned.end())
+		{
+			result.End = span->first;
+			result.Match = span->second.Match;
+		}
+		scanned.insert(span, std::make_pair(first, result));
+		return result.Match;
+	};
+
+	auto Lex = [&](unsigned from) -> unsigned
+	{
+		const CodeTranslation match = Scan(from);
+		if(match.Type == CT_None)
+		{
+			return NO_REWRITE;
+		}
+		const unsigned begin = unsigned(match.Begin - body);
+		auto existing = rewritesByBegin.find(begin);
+		if(existing != rewritesByBegin.end())
+		{
+			return existing->second;
+		}
+
+		ParsedRewrite rewrite;
+		rewrite.Type = match.Type;
+		rewrite.Begin = begin;
+		rewrite.PrefixEnd = unsigned(match.PrefixEnd - body);
+		rewrite.End = unsigned(match.End - body);
+		rewrite.Symbol = NO_SYMBOL;
+		rewrite.IsSemantic = false;
+		rewrite.HasClosingBrace = false;
+		rewrite.SkipTo = size;
+		rewrite.Next = NO_REWRITE;
+		rewrite.SkipNext = NO_REWRITE;
+
+		switch(match.Type)
+		{
+		case CT_ContextIf:
+		case CT_ContextIfNot:
+			{
+				rewrite.Name.assign(match.NameBegin, match.NameEnd);
+				boost::to_upper(rewrite.Name);
+				rewrite.Symbol = frozen.FindSymbol(rewrite.Name);
+				// find the closing brace - the character right after the opening one is not inspected
+				if(!braces)
+				{
+					braces.reset(new BraceIndex(body, size));
+				}
+				unsigned closing = 0;
+				if(braces->FindClosing(rewrite.End + 1, closing))
+				{
+					rewrite.HasClosingBrace = true;
+					rewrite.SkipTo = closing + 1; // +1 is for the closing brace - we don't want it
+				}
+			}
+			break;
+		case CT_Output:
+			rewrite.Name.assign(match.NameBegin, match.NameEnd);
+			boost::to_upper(rewrite.Name);
+			rewrite.Symbol = frozen.FindSymbol(rewrite.Name);
+			rewrite.IsSemantic = rewrite.Symbol != NO_SYMBOL && frozen.IsSemantic(rewrite.Symbol);
+			break;
+		case CT_Polymorphic:
+			rewrite.Name.assign(match.FunctionBegin, match.FunctionEnd);
+			for(unsigned i = 0; i < parsed.Polymorphics.size(); ++i)
+			{
+				if(parsed.Polymorphics[i].Name == rewrite.Name)
+				{
+					rewrite.Candidates.push_back(i);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+
+		const unsigned index = unsigned(entryPoint.Rewrites.size());
+		entryPoint.Rewrites.push_back(std::move(rewrite));
+		rewritesByBegin[begin] = index;
+		pending.push_back(index);
+		return index;
+	};
+
+	entryPoint.FirstRewrite = Lex(0);
+	while(!pending.empty())
+	{
+		const unsigned index = pending.back();
+		pending.pop_back();
+
+		const unsigned next = Lex(entryPoint.Rewrites[index].End);
+		entryPoint.Rewrites[index].Next = next;
+
+		if(entryPoint.Rewrites[index].HasClosingBrace)
+		{
+			const unsigned skipNext = Lex(entryPoint.Rewrites[index].SkipTo);
+			entryPoint.Rewrites[index].SkipNext = skipNext;
+		}
+	}
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ParseShader(SourceView shader
+																		, const ShaderTranslationUniverse* universe
+																		, ParsedShader& parsed)
+{
+	static const std::regex polyRegular("\\s*polymorphic\\s+(\\w+)");
+	static const std::regex vsRegular("\\s*vertex_shader\\s+((\\w+)\\s+(\\w+)\\(([\\w\\s,]+)\\)(\\s+:\\s*\\w+)?)(\\s+needs\\s+((\\w[,\\s]*)*))?");
+	static const std::regex psRegular("\\s*pixel_shader\\s+((\\w+)\\s+(\\w+)\\(([\\w\\s,]+)\\)(\\s+:\\s*\\w+)?)(\\s+needs\\s+((\\w[,\\s]*)*))?");
+
+	TraceScope trace(m_Tracer, "ParseShader", m_Permutation);
+	StageTimer timer(m_Stats, &TranslationStats::BodyScanTime);
+
+	parsed.Source = shader;
+	parsed.SourceHash = HashBytes(shader.GetData(), shader.GetSize());
+	parsed.Universe = universe;
+	parsed.UniverseGeneration = universe->GetGeneration();
+	parsed.Frozen = universe->GetFrozen();
+
+	const char* source = parsed.Source.GetData();
+	LineReader lines(source, source + parsed.Source.GetSize());
+
+	const char* lineBegin;
+	const char* lineEnd;
+	while(lines.Next(lineBegin, lineEnd))
+	{
+		DeclarationMatch match;
+		ShaderTranslator::ShaderTranslatorError err = ShaderTranslator::Ok;
+		// Poly
+		if(HasKeyword(lineBegin, lineEnd, "polymorphic") && std::regex_search(lineBegin, lineEnd, match, polyRegular))
+		{
+			timer.Switch(&TranslationStats::PolymorphicParseTime);
+			TraceScope trace(m_Tracer, "ParsePolymorphic", m_Permutation);
+			err = ParsePolymorphic(lines, parsed, String(match[1].first, match[1].second));
+			timer.Switch(&TranslationStats::BodyScanTime);
+		}
+		// VS
+		else if(HasKeyword(lineBegin, lineEnd, "vertex_shader") && std::regex_search(lineBegin, lineEnd, match, vsRegular))
+		{
+			err = ParseEntryPoint(lines, parsed, VertexShader, match);
+		}
+		// PS
+		else if(HasKeyword(lineBegin, lineEnd, "pixel_shader") && std::regex_search(lineBegin, lineEnd, match, psRegular))
+		{
+			err = ParseEntryPoint(lines, parsed, PixelShader, match);
+		}
+		// Verbatim line - merge it with the previous one when they are adjacent
+		else
+		{
+			const unsigned begin = unsigned(lineBegin - source);
+			const unsigned end = unsigned(lines.GetCursor() - source);
+			if(!parsed.Segments.empty() && parsed.Segments.back().EntryPoint < 0 && parsed.Segments.back().End == begin)
+			{
+				parsed.Segments.back().End = end;
+			}
+			else
+			{
+				ParsedSegment segment = { begin, end, -1 };
+				parsed.Segments.push_back(segment);
+			}
+		}
+
+		if(err != ShaderTranslator::Ok)
+		{
+			return err;
+		}
+	}
+
+	return ShaderTranslator::Ok;
+}
+
+}
@@ -0,0 +1,207 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationPermutations.h"
+#include "ShaderTranslationIR.h"
+
+namespace translator
+{
+
+namespace
+{
+bool Contains(const ShaderTranslationParams& params, const ShaderTranslationParams& bindings)
+{
+	for(auto binding = bindings.cbegin(); binding != bindings.cend(); ++binding)
+	{
+		auto found = params.find(binding->first);
+		if(found == params.cend() || found->second != binding->second)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+}
+
+PermutationEnumerator::PermutationEnumerator(const ParsedShader& parsed)
+	: m_Started(false)
+	, m_Finished(false)
+{
+	// A polymorphic may be declared in several blocks - merge them
+	for(auto declaration = parsed.Polymorphics.cbegin(); declaration != parsed.Polymorphics.cend(); ++declaration)
+	{
+		auto polymorphic = std::find_if(m_Polymorphics.begin(), m_Polymorphics.end(), [&](const Polymorphic& existing) { return existing.Name == declaration->Name; });
+		if(polymorphic == m_Polymorphics.end())
+		{
+			m_Polymorphics.push_back(Polymorphic());
+			polymorphic = m_Polymorphics.end() - 1;
+			polymorphic->Name = declaration->Name;
+		}
+		if(std::find(polymorphic->Atoms.cbegin(), polymorphic->Atoms.cend(), declaration->Atom) == polymorphic->Atoms.cend())
+		{
+			polymorphic->Atoms.push_back(declaration->Atom);
+		}
+	}
+	m_Choices.resize(m_Polymorphics.size());
+}
+
+bool PermutationEnumerator::Restrict(const String& polymorphic, const std::vector<String>& atoms)
+{
+	auto restricted = std::find_if(m_Polymorphics.begin(), m_Polymorphics.end(), [&](const Polymorphic& existing) { return existing.Name == polymorphic; });
+	if(restricted == m_Polymorphics.end())
+	{
+		return false;
+	}
+
+	std::vector<String> allowed;
+	for(auto atom = atoms.cbegin(); atom != atoms.cend(); ++atom)
+	{
+		if(std::find(restricted->Atoms.cbegin(), restricted->Atoms.cend(), *atom) == restricted->Atoms.cend())
+		{
+			return false;
+		}
+		if(std::find(allowed.cbegin(), allowed.cend(), *atom) == allowed.cend())
+		{
+			allowed.push_back(*atom);
+		}
+	}
+
+	restricted->Atoms.swap(allowed);
+	Reset();
+	return true;
+}
+
+bool PermutationEnumerator::Exclude(const ShaderTranslationParams& bindings)
+{
+	return AddRule(bindings, ShaderTranslationParams());
+}
+
+bool PermutationEnumerator::Require(const ShaderTranslationParams& when, const ShaderTranslationParams& then)
+{
+	// Requiring nothing allows everything
+	if(then.empty())
+	{
+		return IsDeclared(when);
+	}
+	return AddRule(when, then);
+}
+
+bool PermutationEnumerator::AddRule(const ShaderTranslationParams& when, const ShaderTranslationParams& then)
+{
+	if(!IsDeclared(when) || !IsDeclared(then))
+	{
+		return false;
+	}
+
+	Rule rule;
+	rule.When = when;
+	rule.Then = then;
+	m_Rules.push_back(rule);
+	Reset();
+	return true;
+}
+
+bool PermutationEnumerator::IsDeclared(const ShaderTranslationParams& bindings) const
+{
+	for(auto binding = bindings.cbegin(); binding != bindings.cend(); ++binding)
+	{
+		auto polymorphic = std::find_if(m_Polymorphics.cbegin(), m_Polymorphics.cend(), [&](const Polymorphic& existing) { return existing.Name == binding->first; });
+		if(polymorphic == m_Polymorphics.cend()
+			|| std::find(polymorphic->Atoms.cbegin(), polymorphic->Atoms.cend(), binding->second) == polymorphic->Atoms.cend())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void PermutationEnumerator::Reset()
+{
+	std::fill(m_Choices.begin(), m_Choices.end(), 0);
+	m_Started = false;
+	m_Finished = false;
+}
+
+bool PermutationEnumerator::Next(ShaderTranslationParams& params)
+{
+	while(!m_Finished)
+	{
+		if(!m_Started)
+		{
+			m_Started = true;
+			// A polymorphic restricted to no atoms leaves nothing to bind
+			m_Finished = std::any_of(m_Polymorphics.cbegin(), m_Polymorphics.cend(), [](const Polymorphic& polymorphic) { return polymorphic.Atoms.empty(); });
+		}
+		else
+		{
+			m_Finished = !Advance();
+		}
+		if(m_Finished)
+		{
+			break;
+		}
+
+		ShaderTranslationParams candidate;
+		Fill(candidate);
+		if(IsAllowed(candidate))
+		{
+			params.swap(candidate);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool PermutationEnumerator::Advance()
+{
+	for(size_t i = m_Choices.size(); i-- > 0;)
+	{
+		if(++m_Choices[i] < m_Polymorphics[i].Atoms.size())
+		{
+			return true;
+		}
+		m_Choices[i] = 0;
+	}
+	return false;
+}
+
+void PermutationEnumerator::Fill(ShaderTranslationParams& params) const
+{
+	params.clear();
+	for(size_t i = 0; i < m_Polymorphics.size(); ++i)
+	{
+		params.insert(std::make_pair(m_Polymorphics[i].Name, m_Polymorphics[i].Atoms[m_Choices[i]]));
+	}
+}
+
+bool PermutationEnumerator::IsAllowed(const ShaderTranslationParams& params) const
+{
+	for(auto rule = m_Rules.cbegin(); rule != m_Rules.cend(); ++rule)
+	{
+		if(Contains(params, rule->When) && (rule->Then.empty() || !Contains(params, rule->Then)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+unsigned long long PermutationEnumerator::GetUpperBound() const
+{
+	unsigned long long count = 1;
+	for(auto polymorphic = m_Polymorphics.cbegin(); polymorphic != m_Polymorphics.cend(); ++polymorphic)
+	{
+		count *= polymorphic->Atoms.size();
+	}
+	return count;
+}
+
+void PermutationSet::Clear()
+{
+	*this = PermutationSet();
+}
+
+}
@@ -0,0 +1,79 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+namespace translator
+{
+
+class ParsedShader;
+
+// Walks the bindings the polymorphic declarations of a shader allow, one combination at a time.
+// Rules narrow the combinations down; adding a rule starts the walk over.
+class PermutationEnumerator
+{
+public:
+	// The shader must outlive the enumerator
+	explicit PermutationEnumerator(const ParsedShader& parsed);
+
+	// The rules fail if the shader declares no such polymorphic or atom.
+	// Only the given atoms are bound to the polymorphic.
+	bool Restrict(const String& polymorphic, const std::vector<String>& atoms);
+	// Combinations that contain all of the bindings are skipped
+	bool Exclude(const ShaderTranslationParams& bindings);
+	// Combinations that contain all of the first bindings must contain all of the second ones as well
+	bool Require(const ShaderTranslationParams& when, const ShaderTranslationParams& then);
+
+	void Reset();
+	// False when there are no more combinations
+	bool Next(ShaderTranslationParams& params);
+
+	// The number of combinations without the exclusions and requirements
+	unsigned long long GetUpperBound() const;
+
+private:
+	struct Polymorphic
+	{
+		String Name;
+		std::vector<String> Atoms;
+	};
+
+	// An exclusion has no Then bindings
+	struct Rule
+	{
+		ShaderTranslationParams When;
+		ShaderTranslationParams Then;
+	};
+
+	bool AddRule(const ShaderTranslationParams& when, const ShaderTranslationParams& then);
+	bool IsDeclared(const ShaderTranslationParams& bindings) const;
+	bool Advance();
+	void Fill(ShaderTranslationParams& params) const;
+	bool IsAllowed(const ShaderTranslationParams& params) const;
+
+	// In declaration order - the last one changes fastest
+	std::vector<Polymorphic> m_Polymorphics;
+	std::vector<Rule> m_Rules;
+	std::vector<size_t> m_Choices;
+	bool m_Started;
+	bool m_Finished;
+};
+
+// The distinct outputs of the permutations of a shader
+struct PermutationSet
+{
+	// In the order they were first produced
+	std::vector<std::string> Shaders;
+	// The enumerated bindings and the index in Shaders of their output
+	std::vector<ShaderTranslationParams> Permutations;
+	std::vector<unsigned> ShaderIndices;
+	// HashParams of every permutation to the index in Shaders of its output
+	std::map<unsigned long long, unsigned> ShaderByKey;
+
+	void Clear();
+};
+
+}
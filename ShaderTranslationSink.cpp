@@ -0,0 +1,107 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationSink.h"
+#include "ShaderTranslationContext.h"
+
+#include <cerrno>
+#include <climits>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace translator
+{
+
+CallbackOutputSink::CallbackOutputSink(const Callback& callback)
+	: m_Callback(callback)
+{}
+
+void CallbackOutputSink::Write(const char* data, size_t size)
+{
+	m_Callback(data, size);
+}
+
+BufferOutputSink::BufferOutputSink(char* buffer, size_t capacity)
+	: m_Buffer(buffer)
+	, m_Capacity(capacity)
+	, m_Size(0)
+{}
+
+void BufferOutputSink::Write(const char* data, size_t size)
+{
+	if(m_Size < m_Capacity)
+	{
+		memcpy(m_Buffer + m_Size, data, std::min(size, m_Capacity - m_Size));
+	}
+	m_Size += size;
+}
+
+size_t BufferOutputSink::GetSize() const
+{
+	return m_Size;
+}
+
+bool BufferOutputSink::HasOverflowed() const
+{
+	return m_Size > m_Capacity;
+}
+
+FileOutputSink::FileOutputSink(int fd)
+	: m_Fd(fd)
+	, m_Failed(false)
+{}
+
+void FileOutputSink::Write(const char* data, size_t size)
+{
+	while(size && !m_Failed)
+	{
+#ifdef _WIN32
+		const int written = _write(m_Fd, data, unsigned(std::min<size_t>(size, INT_MAX)));
+#else
+		const ssize_t written = ::write(m_Fd, data, size);
+#endif
+		if(written < 0)
+		{
+			if(errno != EINTR)
+			{
+				m_Failed = true;
+			}
+			continue;
+		}
+		data += written;
+		size -= size_t(written);
+	}
+}
+
+bool FileOutputSink::HasFailed() const
+{
+	return m_Failed;
+}
+
+StringOutputSink::StringOutputSink(std::string& output)
+	: m_Output(output)
+	, m_Moved(0)
+{}
+
+void StringOutputSink::Write(const char* data, size_t size)
+{
+	if(m_Output.size() + size > m_Output.capacity())
+	{
+		HeapAllocationCounter::Count();
+		m_Moved += m_Output.size();
+	}
+	m_Output.append(data, size);
+}
+
+size_t StringOutputSink::GetMovedBytes() const
+{
+	return m_Moved;
+}
+
+}
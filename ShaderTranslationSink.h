@@ -0,0 +1,85 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include <functional>
+
+namespace translator
+{
+
+// Receives the translated shader piece by piece, in order.
+// Nothing is written when the translation fails.
+class ShaderOutputSink
+{
+public:
+	virtual ~ShaderOutputSink() {}
+
+	virtual void Write(const char* data, size_t size) = 0;
+};
+
+class CallbackOutputSink : public ShaderOutputSink
+{
+public:
+	typedef std::function<void (const char* data, size_t size)> Callback;
+
+	explicit CallbackOutputSink(const Callback& callback);
+
+	virtual void Write(const char* data, size_t size) override;
+
+private:
+	Callback m_Callback;
+};
+
+// Writes into a fixed buffer. What does not fit is dropped, but still counted,
+// so that the caller can retry with a buffer of GetSize() bytes.
+class BufferOutputSink : public ShaderOutputSink
+{
+public:
+	BufferOutputSink(char* buffer, size_t capacity);
+
+	virtual void Write(const char* data, size_t size) override;
+
+	// The size of the whole output, even if it did not fit
+	size_t GetSize() const;
+	bool HasOverflowed() const;
+
+private:
+	char* m_Buffer;
+	size_t m_Capacity;
+	size_t m_Size;
+};
+
+// Writes to a file descriptor that stays owned by the caller
+class FileOutputSink : public ShaderOutputSink
+{
+public:
+	explicit FileOutputSink(int fd);
+
+	virtual void Write(const char* data, size_t size) override;
+
+	// True if any write has failed - the rest of the output is dropped after that
+	bool HasFailed() const;
+
+private:
+	int m_Fd;
+	bool m_Failed;
+};
+
+class StringOutputSink : public ShaderOutputSink
+{
+public:
+	explicit StringOutputSink(std::string& output);
+
+	virtual void Write(const char* data, size_t size) override;
+
+	// The bytes moved when the string had to grow
+	size_t GetMovedBytes() const;
+
+private:
+	std::string& m_Output;
+	size_t m_Moved;
+};
+
+}
@@ -0,0 +1,75 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationSourceFile.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace translator
+{
+
+struct ShaderSourceFile::Mapping
+{
+	boost::interprocess::file_mapping File;
+	boost::interprocess::mapped_region Region;
+};
+
+bool ShaderSourceFile::Open(const char* path)
+{
+	Close();
+	m_Error.clear();
+
+	try
+	{
+		std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>();
+		// Empty files can't be mapped - they stay without a region
+		if(boost::filesystem::file_size(path))
+		{
+			boost::interprocess::file_mapping file(path, boost::interprocess::read_only);
+			boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+			mapping->File.swap(file);
+			mapping->Region.swap(region);
+		}
+		m_Mapping = mapping;
+	}
+	catch(std::exception& ex)
+	{
+		m_Error = "Unable to map file ";
+		m_Error += path;
+		m_Error += ": ";
+		m_Error += ex.what();
+		return false;
+	}
+	return true;
+}
+
+void ShaderSourceFile::Close()
+{
+	m_Mapping.reset();
+}
+
+SourceView ShaderSourceFile::GetView() const
+{
+	if(!m_Mapping || !m_Mapping->Region.get_size())
+	{
+		return SourceView("", 0);
+	}
+	return SourceView(static_cast<const char*>(m_Mapping->Region.get_address()), m_Mapping->Region.get_size());
+}
+
+std::shared_ptr<const void> ShaderSourceFile::GetOwner() const
+{
+	return m_Mapping;
+}
+
+const std::string& ShaderSourceFile::GetLastError() const
+{
+	return m_Error;
+}
+
+}
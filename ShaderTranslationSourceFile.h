@@ -0,0 +1,35 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslationTypes.h"
+
+namespace translator
+{
+
+// A shader file mapped in memory instead of read. The shaders parsed from it
+// read the mapped bytes in place and keep the mapping alive after it is closed.
+class ShaderSourceFile
+{
+public:
+	// False if the file can't be opened or mapped - GetLastError tells why
+	bool Open(const char* path);
+	void Close();
+
+	// Empty until a file is open
+	SourceView GetView() const;
+	// Keeps the mapped memory valid while held
+	std::shared_ptr<const void> GetOwner() const;
+
+	const std::string& GetLastError() const;
+
+private:
+	struct Mapping;
+
+	std::shared_ptr<const Mapping> m_Mapping;
+	std::string m_Error;
+};
+
+}
@@ -0,0 +1,41 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+namespace translator
+{
+
+// Where the time and the memory of one translation went. Times are wall clock microseconds.
+// A translation served by a cache only sets CacheHit and BytesEmitted.
+struct TranslationStats
+{
+	// Parsing
+	double PolymorphicParseTime;
+	double BodyScanTime;
+	// Instantiation
+	double ExpansionTime;
+	double StructEmissionTime;
+	double AssemblyTime;
+
+	unsigned AtomsExpanded;
+	unsigned CombinatorsExpanded;
+	unsigned ContextIfsResolved;
+
+	unsigned long long BytesEmitted;
+	// Copied again when the string the output is built in had to grow - 0 for sinks
+	unsigned long long BytesMoved;
+	// Every heap allocation of the translator: the scratch memory chunks, the strings made
+	// without a context, the containers of the parsed shader and of the instantiation and the
+	// growth of a string output. The standard library allocates a few more for the regular
+	// expressions that match the polymorphic and entry point declarations.
+	unsigned long long HeapAllocations;
+	// Chunks the scratch memory took from the heap - already counted in HeapAllocations
+	unsigned long long ArenaChunkAllocations;
+	// The most scratch memory in use at once
+	size_t ArenaHighWaterMark;
+	bool CacheHit;
+};
+
+}
@@ -0,0 +1,215 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationThreadPool.h"
+
+namespace translator
+{
+
+TranslationThreadPool::TranslationThreadPool(unsigned workers)
+	: m_Generation(0)
+	, m_Running(0)
+	, m_Shutdown(false)
+	, m_Task(nullptr)
+{
+	if(!workers)
+	{
+		workers = std::max(1u, boost::thread::hardware_concurrency());
+	}
+
+	m_Queues.reset(new WorkerQueue[workers]);
+	for(unsigned i = 0; i < workers; ++i)
+	{
+		m_Queues[i].Begin = 0;
+		m_Queues[i].End = 0;
+	}
+
+	m_Threads.reserve(workers);
+	for(unsigned i = 0; i < workers; ++i)
+	{
+		m_Threads.emplace_back(new boost::thread(&TranslationThreadPool::WorkerMain, this, i));
+	}
+}
+
+TranslationThreadPool::~TranslationThreadPool()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(m_Mutex);
+		m_Shutdown = true;
+	}
+	m_WorkAvailable.notify_all();
+
+	for(auto thread = m_Threads.begin(); thread != m_Threads.end(); ++thread)
+	{
+		(*thread)->join();
+	}
+}
+
+unsigned TranslationThreadPool::GetWorkerCount() const
+{
+	return unsigned(m_Threads.size());
+}
+
+bool TranslationThreadPool::GetCurrentWorker(unsigned& worker) const
+{
+	const boost::thread::id current = boost::this_thread::get_id();
+	for(unsigned i = 0; i < m_Threads.size(); ++i)
+	{
+		if(m_Threads[i]->get_id() == current)
+		{
+			worker = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TranslationThreadPool::ParallelFor(unsigned count, const Task& task)
+{
+	if(!count)
+	{
+		return;
+	}
+
+	unsigned worker = 0;
+	if(GetCurrentWorker(worker))
+	{
+		for(unsigned i = 0; i < count; ++i)
+		{
+			task(i, worker);
+		}
+		return;
+	}
+
+	boost::lock_guard<boost::mutex> dispatch(m_DispatchMutex);
+
+	// Deal contiguous ranges - neighbouring items tend to share data
+	const unsigned workers = GetWorkerCount();
+	const unsigned perWorker = count / workers;
+	const unsigned remainder = count % workers;
+	unsigned begin = 0;
+	for(unsigned i = 0; i < workers; ++i)
+	{
+		const unsigned size = perWorker + (i < remainder ? 1 : 0);
+		boost::lock_guard<boost::mutex> lock(m_Queues[i].Mutex);
+		m_Queues[i].Begin = begin;
+		m_Queues[i].End = begin + size;
+		begin += size;
+	}
+
+	boost::unique_lock<boost::mutex> lock(m_Mutex);
+	m_Task = &task;
+	m_Exception = nullptr;
+	m_Running = workers;
+	++m_Generation;
+	m_WorkAvailable.notify_all();
+
+	while(m_Running)
+	{
+		m_WorkDone.wait(lock);
+	}
+	m_Task = nullptr;
+
+	if(m_Exception)
+	{
+		std::exception_ptr exception = m_Exception;
+		m_Exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
+
+void TranslationThreadPool::WorkerMain(unsigned worker)
+{
+	unsigned generation = 0;
+	for(;;)
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(m_Mutex);
+			while(!m_Shutdown && m_Generation == generation)
+			{
+				m_WorkAvailable.wait(lock);
+			}
+			if(m_Shutdown)
+			{
+				return;
+			}
+			generation = m_Generation;
+		}
+
+		RunTasks(worker);
+
+		boost::lock_guard<boost::mutex> lock(m_Mutex);
+		if(!--m_Running)
+		{
+			m_WorkDone.notify_all();
+		}
+	}
+}
+
+void TranslationThreadPool::RunTasks(unsigned worker)
+{
+	unsigned index;
+	while(Pop(worker, index) || Steal(worker, index))
+	{
+		try
+		{
+			(*m_Task)(index, worker);
+		}
+		catch(...)
+		{
+			boost::lock_guard<boost::mutex> lock(m_Mutex);
+			if(!m_Exception)
+			{
+				m_Exception = std::current_exception();
+			}
+		}
+	}
+}
+
+bool TranslationThreadPool::Pop(unsigned worker, unsigned& index)
+{
+	WorkerQueue& queue = m_Queues[worker];
+	boost::lock_guard<boost::mutex> lock(queue.Mutex);
+	if(queue.Begin == queue.End)
+	{
+		return false;
+	}
+	index = queue.Begin++;
+	return true;
+}
+
+bool TranslationThreadPool::Steal(unsigned worker, unsigned& index)
+{
+	const unsigned workers = GetWorkerCount();
+	for(unsigned offset = 1; offset < workers; ++offset)
+	{
+		WorkerQueue& victim = m_Queues[(worker + offset) % workers];
+		unsigned begin;
+		unsigned end;
+		{
+			boost::lock_guard<boost::mutex> lock(victim.Mutex);
+			const unsigned available = victim.End - victim.Begin;
+			if(!available)
+			{
+				continue;
+			}
+			// Take the upper half, the owner keeps working from the front
+			end = victim.End;
+			begin = end - (available + 1) / 2;
+			victim.End = begin;
+		}
+
+		index = begin;
+		WorkerQueue& own = m_Queues[worker];
+		boost::lock_guard<boost::mutex> lock(own.Mutex);
+		own.Begin = begin + 1;
+		own.End = end;
+		return true;
+	}
+	return false;
+}
+
+}
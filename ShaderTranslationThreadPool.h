@@ -0,0 +1,61 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include <functional>
+#include <exception>
+
+namespace translator
+{
+
+// A fixed set of worker threads that run index ranges. Every ParallelFor call
+// deals the indices to the workers in contiguous ranges; a worker that runs out
+// of work steals half of the remaining range of another one.
+class TranslationThreadPool : boost::noncopyable
+{
+public:
+	typedef std::function<void (unsigned index, unsigned worker)> Task;
+
+	// 0 workers means one per hardware thread
+	explicit TranslationThreadPool(unsigned workers = 0);
+	~TranslationThreadPool();
+
+	unsigned GetWorkerCount() const;
+
+	// Runs task for every index in [0, count) and returns when all of them are done.
+	// The first exception thrown by a task is rethrown here. Calls made from
+	// a worker of the same pool run inline on that worker.
+	void ParallelFor(unsigned count, const Task& task);
+
+private:
+	struct WorkerQueue
+	{
+		boost::mutex Mutex;
+		unsigned Begin;
+		unsigned End;
+	};
+
+	void WorkerMain(unsigned worker);
+	void RunTasks(unsigned worker);
+	bool Pop(unsigned worker, unsigned& index);
+	bool Steal(unsigned worker, unsigned& index);
+	bool GetCurrentWorker(unsigned& worker) const;
+
+	std::vector<std::unique_ptr<boost::thread>> m_Threads;
+	std::unique_ptr<WorkerQueue[]> m_Queues;
+
+	boost::mutex m_DispatchMutex;
+	boost::mutex m_Mutex;
+	boost::condition_variable m_WorkAvailable;
+	boost::condition_variable m_WorkDone;
+	unsigned m_Generation;
+	unsigned m_Running;
+	bool m_Shutdown;
+
+	const Task* m_Task;
+	std::exception_ptr m_Exception;
+};
+
+}
@@ -0,0 +1,129 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslationTracer.h"
+
+#include <fstream>
+#include <iomanip>
+
+namespace translator
+{
+
+namespace
+{
+std::atomic<unsigned long long> sTracerCounter(0);
+
+// The buffer the thread recorded into last. Tracers are told apart by an ID
+// rather than their address, which a new tracer could reuse.
+struct LastThreadBuffer
+{
+	unsigned long long TracerId;
+	void* Buffer;
+};
+thread_local LastThreadBuffer tLastBuffer = { 0, nullptr };
+}
+
+TranslationTracer::TranslationTracer()
+	: m_Id(++sTracerCounter)
+	, m_Start(std::chrono::steady_clock::now())
+{}
+
+TranslationTracer::~TranslationTracer()
+{}
+
+void TranslationTracer::Begin(const char* name, const TracePermutation& permutation)
+{
+	Record(name, permutation, 'B');
+}
+
+void TranslationTracer::End(const char* name, const TracePermutation& permutation)
+{
+	Record(name, permutation, 'E');
+}
+
+void TranslationTracer::Record(const char* name, const TracePermutation& permutation, char phase)
+{
+	TraceEvent event;
+	event.Name = name;
+	event.Permutation = permutation;
+	event.Timestamp = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_Start).count();
+	event.Phase = phase;
+	GetThreadBuffer()->Events.push_back(event);
+}
+
+TranslationTracer::ThreadBuffer* TranslationTracer::GetThreadBuffer()
+{
+	if(tLastBuffer.TracerId == m_Id)
+	{
+		return static_cast<ThreadBuffer*>(tLastBuffer.Buffer);
+	}
+
+	ThreadBuffer* buffer = RegisterThread();
+	tLastBuffer.TracerId = m_Id;
+	tLastBuffer.Buffer = buffer;
+	return buffer;
+}
+
+TranslationTracer::ThreadBuffer* TranslationTracer::RegisterThread()
+{
+	boost::lock_guard<boost::mutex> lock(m_ThreadsMutex);
+	std::unique_ptr<ThreadBuffer>& buffer = m_Threads[boost::this_thread::get_id()];
+	if(!buffer)
+	{
+		buffer.reset(new ThreadBuffer);
+		buffer->ThreadId = unsigned(m_Threads.size());
+	}
+	return buffer.get();
+}
+
+void TranslationTracer::Clear()
+{
+	boost::lock_guard<boost::mutex> lock(m_ThreadsMutex);
+	for(auto thread = m_Threads.begin(); thread != m_Threads.end(); ++thread)
+	{
+		thread->second->Events.clear();
+	}
+}
+
+void TranslationTracer::WriteChromeTrace(std::ostream& stream) const
+{
+	boost::lock_guard<boost::mutex> lock(m_ThreadsMutex);
+
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for(auto thread = m_Threads.cbegin(); thread != m_Threads.cend(); ++thread)
+	{
+		const ThreadBuffer& buffer = *thread->second;
+		stream << (first ? "\n" : ",\n");
+		first = false;
+		stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.ThreadId
+			<< ",\"args\":{\"name\":\"translator " << buffer.ThreadId << "\"}}";
+
+		for(auto event = buffer.Events.cbegin(); event != buffer.Events.cend(); ++event)
+		{
+			stream << ",\n{\"name\":\"" << event->Name << "\",\"ph\":\"" << event->Phase
+				<< "\",\"ts\":" << std::fixed << std::setprecision(3) << event->Timestamp
+				<< ",\"pid\":1,\"tid\":" << buffer.ThreadId
+				<< ",\"args\":{\"permutation\":" << event->Permutation.Index
+				<< ",\"key\":\"" << std::hex << std::setw(16) << std::setfill('0') << event->Permutation.Key << std::dec << std::setfill(' ')
+				<< "\"}}";
+		}
+	}
+	stream << "\n]}\n";
+}
+
+bool TranslationTracer::WriteChromeTrace(const char* path) const
+{
+	std::ofstream fout(path);
+	if(!fout.is_open())
+	{
+		return false;
+	}
+	WriteChromeTrace(fout);
+	return fout.good();
+}
+
+}
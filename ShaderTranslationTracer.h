@@ -0,0 +1,96 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include <iosfwd>
+
+namespace translator
+{
+
+// Which permutation an event belongs to
+struct TracePermutation
+{
+	// HashParams of the bindings
+	unsigned long long Key;
+	// Position in the batch, -1 outside of batches
+	int Index;
+};
+
+// Records begin and end events of translations and their stages. Every thread
+// appends to a buffer of its own, so recording takes no locks once a thread has
+// recorded its first event. Write the trace only when no translation is running.
+class TranslationTracer : boost::noncopyable
+{
+public:
+	TranslationTracer();
+	~TranslationTracer();
+
+	// The name must outlive the tracer - the stages use string literals
+	void Begin(const char* name, const TracePermutation& permutation);
+	void End(const char* name, const TracePermutation& permutation);
+
+	// Drops all events recorded so far
+	void Clear();
+
+	// Chrome trace event JSON, also loaded by Perfetto
+	void WriteChromeTrace(std::ostream& stream) const;
+	bool WriteChromeTrace(const char* path) const;
+
+private:
+	struct TraceEvent
+	{
+		const char* Name;
+		TracePermutation Permutation;
+		double Timestamp;
+		char Phase;
+	};
+
+	struct ThreadBuffer
+	{
+		unsigned ThreadId;
+		std::vector<TraceEvent> Events;
+	};
+
+	void Record(const char* name, const TracePermutation& permutation, char phase);
+	ThreadBuffer* GetThreadBuffer();
+	ThreadBuffer* RegisterThread();
+
+	const unsigned long long m_Id;
+	const std::chrono::steady_clock::time_point m_Start;
+
+	mutable boost::mutex m_ThreadsMutex;
+	std::map<boost::thread::id, std::unique_ptr<ThreadBuffer>> m_Threads;
+};
+
+// Records the begin event of a stage now and its end when the scope is left - does nothing without a tracer
+class TraceScope : boost::noncopyable
+{
+public:
+	TraceScope(TranslationTracer* tracer, const char* name, const TracePermutation& permutation)
+		: m_Tracer(tracer)
+		, m_Name(name)
+		, m_Permutation(permutation)
+	{
+		if(m_Tracer)
+		{
+			m_Tracer->Begin(m_Name, m_Permutation);
+		}
+	}
+
+	~TraceScope()
+	{
+		if(m_Tracer)
+		{
+			m_Tracer->End(m_Name, m_Permutation);
+		}
+	}
+
+private:
+	TranslationTracer* m_Tracer;
+	const char* m_Name;
+	TracePermutation m_Permutation;
+};
+
+}
@@ -4,67 +4,10 @@
 //
 #pragma once
 
-namespace translator
-{
+#include "ShaderTranslationContext.h"
 
-class TlsScratchAllocator : boost::noncopyable
+namespace translator
 {
-public:
-	static bool Create(unsigned size)
-	{
-		if(sPtr.get())
-		{
-			return false;
-		}
-		sPtr.reset(new TlsScratchAllocator(size));
-		return true;
-	}
-
-	static bool Destroy()
-	{
-	   	if(!sPtr.get())
-		{
-			return false;
-		}
-		sPtr.reset(nullptr);
-		return true;
-	}
-
-	static TlsScratchAllocator* Get()
-	{
-		return sPtr.get();
-	}
-
-	void* Allocate(unsigned bytes)
-	{
-		auto ptr = m_Ptr;
-		m_Ptr += bytes;
-		if(m_Ptr >= m_Size)
-		{
-			throw std::bad_alloc();
-		}
-		return m_Memory.get() + ptr;
-	}
-
-	void Deallocate(void* ptr)
-	{}
-
-private:
-	TlsScratchAllocator(unsigned size)
-		: m_Size(size)
-		, m_Ptr(0)
-		, m_Memory(new char[size])
-	{}
-
-	~TlsScratchAllocator() {}
-
-	std::unique_ptr<char[]> m_Memory;
-	unsigned m_Size;
-	unsigned m_Ptr;
-
-	friend class boost::thread_specific_ptr<TlsScratchAllocator>;
-	static boost::thread_specific_ptr<TlsScratchAllocator> sPtr;
-};
 
 template<typename T>
 class StdAllocator {
@@ -84,18 +27,19 @@ public :
     };
 
 public : 
-    inline explicit StdAllocator(bool scratch = false)
-		: m_IsScratch(scratch)
+    // Without a context the memory comes from the heap
+    inline explicit StdAllocator(TranslationContext* context = nullptr)
+		: m_Context(context)
 	{}
     
 	inline ~StdAllocator() {}
     inline StdAllocator(const StdAllocator& rhs)
-		: m_IsScratch(rhs.m_IsScratch)
+		: m_Context(rhs.m_Context)
 	{}
 
     template<typename U>
     inline explicit StdAllocator(const StdAllocator<U>& rhs)
-		: m_IsScratch(rhs.m_IsScratch) 
+		: m_Context(rhs.m_Context) 
 	{}
 
     inline pointer address(reference r) { return &r; }
@@ -103,24 +47,21 @@ public :
 
     inline pointer allocate(size_type cnt, typename std::allocator<void>::const_pointer = 0) 
 	{ 
-		if(m_IsScratch)
+		if(m_Context)
 		{
-			auto allocator = TlsScratchAllocator::Get();
-			assert(allocator);
-			return reinterpret_cast<pointer>(allocator->Allocate(cnt * sizeof (T)));
+			return reinterpret_cast<pointer>(m_Context->Allocate(cnt * sizeof (T)));
 		}
 		else
 		{
+			HeapAllocationCounter::Count();
 			return reinterpret_cast<pointer>(malloc(cnt * sizeof (T)));
 		}
     }
-    inline void deallocate(pointer p, size_type) 
+    inline void deallocate(pointer p, size_type cnt) 
 	{
-		if(m_IsScratch)
+		if(m_Context)
 		{
-			auto allocator = TlsScratchAllocator::Get();
-			assert(allocator);
-			allocator->Deallocate(p);
+			m_Context->Deallocate(p, cnt * sizeof (T));
 		}
 		else
 		{
@@ -136,21 +77,80 @@ public :
     inline void construct(pointer p, const T& t) { new(p) T(t); }
     inline void destroy(pointer p) { p->~T(); }
 
-    inline bool operator==(StdAllocator const&) { return true; }
-    inline bool operator!=(StdAllocator const& a) { return !operator==(a); }
+    inline bool operator==(StdAllocator const& a) const { return m_Context == a.m_Context; }
+    inline bool operator!=(StdAllocator const& a) const { return !operator==(a); }
 
 private:
 	template<typename U> friend class StdAllocator;
-	bool m_IsScratch;
+	TranslationContext* m_Context;
 };
 
 typedef std::basic_string<char, std::char_traits<char>, StdAllocator<char>> String;
 
+// The heap allocator of the containers a translation builds - its allocations are counted
+// in TranslationStats::HeapAllocations
+template<typename T>
+class CountedAllocator : public std::allocator<T>
+{
+public:
+	template<typename U>
+	struct rebind {
+		typedef CountedAllocator<U> other;
+	};
+
+	CountedAllocator() {}
+
+	template<typename U>
+	CountedAllocator(const CountedAllocator<U>&) {}
+
+	T* allocate(size_t count, const void* = nullptr)
+	{
+		HeapAllocationCounter::Count();
+		return std::allocator<T>::allocate(count);
+	}
+};
+
+template<typename T>
+using CountedVector = std::vector<T, CountedAllocator<T>>;
+template<typename Key, typename Value>
+using CountedMap = std::map<Key, Value, std::less<Key>, CountedAllocator<std::pair<const Key, Value>>>;
+
+// Shader text owned by the caller - read in place, never copied
+class SourceView
+{
+public:
+	SourceView(const char* data, size_t size)
+		: m_Data(data)
+		, m_Size(size)
+	{}
+
+	SourceView(const char* str)
+		: m_Data(str)
+		, m_Size(strlen(str))
+	{}
+
+	SourceView(const std::string& str)
+		: m_Data(str.data())
+		, m_Size(str.size())
+	{}
+
+	const char* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+
+private:
+	const char* m_Data;
+	size_t m_Size;
+};
+
+// Polymorphic name to atom bindings
+typedef std::map<String, String> ShaderTranslationParams;
+
+// A string in the memory of the current translation context
 class ScratchString : public String
 {
 public:
 	ScratchString()
-		: String(allocator_type(true))
+		: String(allocator_type(TranslationContext::GetCurrent()))
 	{}
 
 	ScratchString(const ScratchString& rhs)
@@ -162,20 +162,20 @@ public:
 	{}
 
 	explicit ScratchString(const String& rhs)
-		: String(rhs.cbegin(), rhs.cend(), allocator_type(true))
+		: String(rhs.cbegin(), rhs.cend(), allocator_type(TranslationContext::GetCurrent()))
 	{}
 
 	ScratchString(const char* ptr, size_type count)
-		: String(ptr, count, allocator_type(true))
+		: String(ptr, count, allocator_type(TranslationContext::GetCurrent()))
 	{}
 
 	ScratchString(const char* ptr)
-		: String(ptr, allocator_type(true))
+		: String(ptr, allocator_type(TranslationContext::GetCurrent()))
 	{}
 
 	template<class _Iter>
 	ScratchString(_Iter first, _Iter last)
-		: String(first, last, allocator_type(true))
+		: String(first, last, allocator_type(TranslationContext::GetCurrent()))
 	{}
 
 	ScratchString& operator=(const ScratchString& rhs)
@@ -4,33 +4,685 @@
 //
 #include "stdafx.h"
 #include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationFrozenUniverse.h"
 #include "ShaderTranslationUtilities.h"
+#include "ShaderTranslationThreadPool.h"
+
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 namespace translator
 {
 
 static const String EMPTY_STRING = String("");
 
+static std::atomic<unsigned long long> sGenerationCounter(0);
+
 class ShaderTranslationUniverseImpl
 {
 public:		
+	ShaderTranslationUniverseImpl();
+
 	const std::string& GetError();
 	
 	ShaderTranslationUniverse::TranslationUniverseError AddSemantics(const char* data);
 	ShaderTranslationUniverse::TranslationUniverseError AddCombinators(const char* data);
 	ShaderTranslationUniverse::TranslationUniverseError AddAtoms(const char* data);
 
+	ShaderTranslationUniverse::TranslationUniverseError AddLibraryFiles(const std::vector<ShaderTranslationUniverse::LibraryFile>& files, TranslationThreadPool* pool);
+
+	ShaderTranslationUniverse::TranslationUniverseError SaveSnapshot(const char* path) const;
+	ShaderTranslationUniverse::TranslationUniverseError LoadSnapshot(const char* path);
+
 	const ShaderSemantics& GetSemantics() const;
 	const Combinators& GetCombinators() const;
 	const Atoms& GetAtoms() const;
 
+	unsigned long long GetGeneration() const;
+	unsigned long long GetContentHash() const;
+
+	void Freeze();
+	FrozenUniversePtr GetFrozen() const;
+
 private:
-	std::string m_Error;
-	ShaderSemantics m_Semantics;
-	Combinators m_Combinators;
-	Atoms m_Atoms;
+	// The definitions of a source in order of appearance with their lines
+	struct DefinitionLine
+	{
+		String Name;
+		size_t Line;
+		ShaderSemantic Semantic;
+	};
+	struct DefinitionLines
+	{
+		std::vector<DefinitionLine> Semantics;
+		std::vector<DefinitionLine> Atoms;
+		std::vector<DefinitionLine> Combinators;
+	};
+
+	void Modified();
+	FrozenUniversePtr BuildFrozen() const;
+	// Fills the maps of a universe loaded from a snapshot from its frozen image
+	void Thaw() const;
+
+	mutable std::string m_Error;
+	// Set only while parsing library files
+	DefinitionLines* m_Lines;
+	// Empty after loading a snapshot until they are used or the universe is modified
+	mutable ShaderSemantics m_Semantics;
+	mutable Combinators m_Combinators;
+	mutable Atoms m_Atoms;
+	mutable std::atomic<bool> m_Thawed;
+	unsigned long long m_Generation;
+
+	mutable boost::mutex m_ContentHashMutex;
+	mutable unsigned long long m_ContentHash;
+	mutable unsigned long long m_ContentHashGeneration;
+
+	mutable boost::mutex m_FrozenMutex;
+	// A loaded snapshot is kept mapped by the frozen universe read from it
+	mutable FrozenUniversePtr m_Frozen;
+};
+
+ShaderTranslationUniverseImpl::ShaderTranslationUniverseImpl()
+	: m_Lines(nullptr)
+	, m_Thawed(true)
+	, m_Generation(++sGenerationCounter)
+	, m_ContentHash(0)
+	, m_ContentHashGeneration(0)
+{}
+
+void ShaderTranslationUniverseImpl::Modified()
+{
+	// The contents are changed in the maps, so they need all of them
+	Thaw();
+	m_Generation = ++sGenerationCounter;
+
+	boost::lock_guard<boost::mutex> lock(m_FrozenMutex);
+	m_Frozen.reset();
+}
+
+void ShaderTranslationUniverseImpl::Freeze()
+{
+	GetFrozen();
+}
+
+FrozenUniversePtr ShaderTranslationUniverseImpl::GetFrozen() const
+{
+	boost::lock_guard<boost::mutex> lock(m_FrozenMutex);
+	if(!m_Frozen)
+	{
+		m_Frozen = BuildFrozen();
+	}
+	return m_Frozen;
+}
+
+namespace
+{
+enum VisitState
+{
+	NotVisited,
+	Visiting,
+	Visited
 };
 
+// Depth-first over the needs - the path holds the return types of the combinators on the stack
+bool VisitCombinator(const Combinators& combinators, Combinators::const_iterator combinator, std::map<String, VisitState>& states, std::vector<String>& path)
+{
+	VisitState& state = states[combinator->first];
+	if(state == Visited)
+	{
+		return false;
+	}
+	path.push_back(combinator->first);
+	if(state == Visiting)
+	{
+		return true;
+	}
+
+	state = Visiting;
+	for(auto need = combinator->second.Needs.cbegin(); need != combinator->second.Needs.cend(); ++need)
+	{
+		auto next = combinators.find(*need);
+		if(next != combinators.end() && VisitCombinator(combinators, next, states, path))
+		{
+			return true;
+		}
+	}
+	state = Visited;
+	path.pop_back();
+	return false;
+}
+
+// Combinators that need each other directly or indirectly can never be expanded
+bool FindCombinatorCycle(const Combinators& combinators, std::string& error)
+{
+	std::map<String, VisitState> states;
+	std::vector<String> path;
+	for(auto it = combinators.cbegin(); it != combinators.cend(); ++it)
+	{
+		if(VisitCombinator(combinators, it, states, path))
+		{
+			// The path may start before the cycle does
+			auto first = std::find(path.cbegin(), path.cend(), path.back());
+			std::ostringstream message;
+			message << "combinator cycle: ";
+			for(auto type = first; type != path.cend(); ++type)
+			{
+				message << (type != first ? " -> " : "") << *type;
+			}
+			error = message.str();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsIdentifierChar(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+// Finds every "return expression;" in the source - "return" has to be a whole word
+void SplitReturns(ExpandableFunction& function)
+{
+	static const char RETURN_KEYWORD[] = "return";
+	static const size_t RETURN_LENGTH = sizeof(RETURN_KEYWORD) - 1;
+
+	const String& source = function.Source;
+	function.Returns.clear();
+	for(size_t position = source.find(RETURN_KEYWORD); position != String::npos; position = source.find(RETURN_KEYWORD, position))
+	{
+		const size_t begin = position;
+		position += RETURN_LENGTH;
+		if((begin && IsIdentifierChar(source[begin - 1])) || position == source.size() || !isspace((unsigned char)source[position]))
+		{
+			continue;
+		}
+
+		size_t expression = position;
+		while(expression < source.size() && isspace((unsigned char)source[expression]))
+		{
+			++expression;
+		}
+		const size_t end = source.find(';', expression);
+		if(end == String::npos)
+		{
+			break;
+		}
+
+		const ReturnStatement statement = { begin, end + 1, expression, end };
+		function.Returns.push_back(statement);
+		position = end + 1;
+	}
+}
+
+// The image is the snapshot - all offsets are from its start so that it can be mapped anywhere
+static const char SNAPSHOT_MAGIC[8] = { 'S', 'T', 'U', 'N', 'I', 'V', 'R', 'S' };
+static const unsigned SNAPSHOT_VERSION = 3;
+// Catches snapshots taken on a machine of the other endianness
+static const unsigned SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// A function of the frozen universe while it is built
+struct FunctionBuild
+{
+	const ExpandableFunction* Function;
+	unsigned Index;
+	SymbolId ReturnType;
+	std::vector<SymbolId> Needs;
+	unsigned ExpansionBegin;
+	// The closure - combinators dependencies first, the rest sorted by ID
+	std::vector<unsigned> Combinators;
+	std::vector<SymbolId> Semantics;
+	std::vector<SymbolId> Textures;
+	std::vector<SymbolId> Samplers;
+};
+
+struct FrozenBuild
+{
+	std::vector<FrozenSymbolRecord> Symbols;
+	// Atoms first, then combinators
+	std::vector<FunctionBuild> Functions;
+	unsigned AtomCount;
+	std::vector<ExpansionStep> Expansion;
+};
+
+// Appends the steps of a function after the ones of the combinators it needs. A needed combinator
+// is only entered by its step, so each function's steps are kept once however many need it.
+void BuildExpansion(FrozenBuild& frozen, FunctionBuild& function, std::vector<VisitState>& states)
+{
+	std::set<SymbolId> semantics;
+	std::set<SymbolId> textures;
+	std::set<SymbolId> samplers;
+	std::vector<unsigned>& combinators = function.Combinators;
+	std::vector<bool> added(states.size());
+	auto addCombinator = [&combinators, &added](unsigned combinator)
+	{
+		if(!added[combinator])
+		{
+			added[combinator] = true;
+			combinators.push_back(combinator);
+		}
+	};
+
+	for(auto need = function.Needs.cbegin(); need != function.Needs.cend(); ++need)
+	{
+		const FrozenSymbolRecord& symbol = frozen.Symbols[*need];
+		if(symbol.Combinator == NO_FUNCTION)
+		{
+			((symbol.Flags & FSF_Texture) ? textures : (symbol.Flags & FSF_Sampler) ? samplers : semantics).insert(*need);
+			continue;
+		}
+
+		FunctionBuild& combinator = frozen.Functions[frozen.AtomCount + symbol.Combinator];
+		VisitState& state = states[symbol.Combinator];
+		if(state == Visiting)
+		{
+			// Only a cycle leads here and loading rejects those
+			continue;
+		}
+		if(state == NotVisited)
+		{
+			state = Visiting;
+			BuildExpansion(frozen, combinator, states);
+			state = Visited;
+		}
+
+		std::for_each(combinator.Combinators.cbegin(), combinator.Combinators.cend(), addCombinator);
+		addCombinator(symbol.Combinator);
+		semantics.insert(combinator.Semantics.cbegin(), combinator.Semantics.cend());
+		textures.insert(combinator.Textures.cbegin(), combinator.Textures.cend());
+		samplers.insert(combinator.Samplers.cbegin(), combinator.Samplers.cend());
+	}
+
+	// The needed combinators are done - the steps of this one go in a range of their own
+	function.ExpansionBegin = unsigned(frozen.Expansion.size());
+	for(auto need = function.Needs.cbegin(); need != function.Needs.cend(); ++need)
+	{
+		const FrozenSymbolRecord& symbol = frozen.Symbols[*need];
+		if(symbol.Combinator == NO_FUNCTION)
+		{
+			const ExpansionStep step = { ExpansionStep::RequireInput, *need, NO_FUNCTION };
+			frozen.Expansion.push_back(step);
+		}
+		else if(states[symbol.Combinator] == Visited)
+		{
+			const ExpansionStep enter = { ExpansionStep::EnterCombinator, *need, frozen.AtomCount + symbol.Combinator };
+			frozen.Expansion.push_back(enter);
+		}
+	}
+	const ExpansionStep emit = { ExpansionStep::EmitFunction, function.ReturnType, function.Index };
+	frozen.Expansion.push_back(emit);
+
+	function.Semantics.assign(semantics.cbegin(), semantics.cend());
+	function.Textures.assign(textures.cbegin(), textures.cend());
+	function.Samplers.assign(samplers.cbegin(), samplers.cend());
+}
+
+// Gathers the arrays of an image
+class ImageWriter
+{
+public:
+	FrozenStringRecord AddString(const String& str)
+	{
+		// Types, semantics and needs repeat a lot - store them once
+		auto it = m_StringOffsets.find(str);
+		if(it == m_StringOffsets.end())
+		{
+			it = m_StringOffsets.insert(std::make_pair(str, unsigned(m_Strings.size()))).first;
+			m_Strings.append(str.data(), str.size());
+		}
+		const FrozenStringRecord result = { it->second, unsigned(str.size()) };
+		return result;
+	}
+
+	FrozenRange AddIds(const std::vector<unsigned>& ids)
+	{
+		const FrozenRange range = { unsigned(m_Ids.size()), unsigned(ids.size()) };
+		m_Ids.insert(m_Ids.end(), ids.cbegin(), ids.cend());
+		return range;
+	}
+
+	FrozenRange AddReturns(const std::vector<ReturnStatement>& returns)
+	{
+		const FrozenRange range = { unsigned(m_Returns.size()), unsigned(returns.size()) };
+		for(auto statement = returns.cbegin(); statement != returns.cend(); ++statement)
+		{
+			const FrozenReturn saved = { unsigned(statement->Begin), unsigned(statement->End), unsigned(statement->ExpressionBegin), unsigned(statement->ExpressionEnd) };
+			m_Returns.push_back(saved);
+		}
+		return range;
+	}
+
+	std::vector<unsigned> m_Ids;
+	std::vector<FrozenReturn> m_Returns;
+	std::string m_Strings;
+
+private:
+	std::map<String, unsigned> m_StringOffsets;
+};
+
+// An open addressing table with at least one free slot, so that every lookup ends
+template<typename GetName>
+std::vector<unsigned> BuildTable(unsigned count, GetName getName)
+{
+	unsigned size = 1;
+	while(size < 2 * count)
+	{
+		size *= 2;
+	}
+	std::vector<unsigned> table(size, unsigned(-1));
+	for(unsigned index = 0; index < count; ++index)
+	{
+		const String& name = getName(index);
+		unsigned slot = FrozenUniverse::GetTableSlot(name.data(), name.size(), size - 1);
+		while(table[slot] != unsigned(-1))
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+		table[slot] = index;
+	}
+	return table;
+}
+
+template<typename T>
+void WriteArray(std::vector<char>& image, unsigned offset, const std::vector<T>& records)
+{
+	if(!records.empty())
+	{
+		memcpy(image.data() + offset, records.data(), records.size() * sizeof(T));
+	}
+}
+
+String ToString(const FrozenString& str)
+{
+	return String(str.begin(), str.end());
+}
+}
+
+FrozenUniversePtr ShaderTranslationUniverseImpl::BuildFrozen() const
+{
+	FrozenBuild frozen;
+	ImageWriter writer;
+
+	// Gather all names - the set orders them so that IDs follow the names
+	std::set<String> names;
+	std::set<String> hlslSemantics;
+	for(auto it = m_Semantics.cbegin(); it != m_Semantics.cend(); ++it)
+	{
+		names.insert(it->first);
+		hlslSemantics.insert(it->second.HLSLSemantic);
+	}
+	auto AddFunctionNames = [&names](const std::map<String, ExpandableFunction>& functions)
+	{
+		for(auto it = functions.cbegin(); it != functions.cend(); ++it)
+		{
+			if(it->second.ReturnType != VOID_TYPE)
+			{
+				names.insert(it->second.ReturnType);
+			}
+			names.insert(it->second.Needs.cbegin(), it->second.Needs.cend());
+		}
+	};
+	AddFunctionNames(m_Atoms);
+	AddFunctionNames(m_Combinators);
+	for(auto it = m_Combinators.cbegin(); it != m_Combinators.cend(); ++it)
+	{
+		names.insert(it->first);
+	}
+
+	const std::vector<String> symbolNames(names.cbegin(), names.cend());
+	const std::vector<String> hlslSemanticNames(hlslSemantics.cbegin(), hlslSemantics.cend());
+	auto findSymbol = [&symbolNames](const String& name)
+	{
+		return SymbolId(std::lower_bound(symbolNames.cbegin(), symbolNames.cend(), name) - symbolNames.cbegin());
+	};
+
+	frozen.Symbols.reserve(symbolNames.size());
+	for(auto name = symbolNames.cbegin(); name != symbolNames.cend(); ++name)
+	{
+		FrozenSymbolRecord symbol;
+		symbol.Name = writer.AddString(*name);
+		symbol.LowerName = writer.AddString(boost::to_lower_copy(*name));
+		symbol.Type = writer.AddString(EMPTY_STRING);
+		symbol.HLSLSemantic = symbol.Type;
+		symbol.HLSLSemanticIndex = 0;
+		symbol.Combinator = NO_FUNCTION;
+		symbol.Flags = (name->find(MAP_PREFIX) == 0 ? FSF_Texture : 0) | (name->find(SAMPLER_PREFIX) == 0 ? FSF_Sampler : 0);
+
+		auto semantic = m_Semantics.find(*name);
+		if(semantic != m_Semantics.end())
+		{
+			symbol.Flags |= FSF_Semantic;
+			symbol.Type = writer.AddString(semantic->second.Type);
+			symbol.HLSLSemantic = writer.AddString(semantic->second.HLSLSemantic);
+			symbol.HLSLSemanticIndex = unsigned(std::lower_bound(hlslSemanticNames.cbegin(), hlslSemanticNames.cend(), semantic->second.HLSLSemantic) - hlslSemanticNames.cbegin());
+		}
+		frozen.Symbols.push_back(symbol);
+	}
+
+	frozen.AtomCount = unsigned(m_Atoms.size());
+	frozen.Functions.reserve(m_Atoms.size() + m_Combinators.size());
+	auto FreezeFunctions = [&](const std::map<String, ExpandableFunction>& functions)
+	{
+		for(auto it = functions.cbegin(); it != functions.cend(); ++it)
+		{
+			FunctionBuild function;
+			function.Function = &it->second;
+			function.Index = unsigned(frozen.Functions.size());
+			function.ReturnType = it->second.ReturnType != VOID_TYPE ? findSymbol(it->second.ReturnType) : NO_SYMBOL;
+			function.ExpansionBegin = 0;
+			function.Needs.reserve(it->second.Needs.size());
+			for(auto need = it->second.Needs.cbegin(); need != it->second.Needs.cend(); ++need)
+			{
+				function.Needs.push_back(findSymbol(*need));
+			}
+			frozen.Functions.push_back(function);
+		}
+	};
+	FreezeFunctions(m_Atoms);
+	FreezeFunctions(m_Combinators);
+
+	unsigned index = 0;
+	for(auto it = m_Combinators.cbegin(); it != m_Combinators.cend(); ++it, ++index)
+	{
+		frozen.Symbols[findSymbol(it->first)].Combinator = index;
+	}
+
+	// Combinators first, so that the atoms enter their finished expansions
+	std::vector<VisitState> states(m_Combinators.size(), NotVisited);
+	for(unsigned i = 0; i < states.size(); ++i)
+	{
+		if(states[i] == NotVisited)
+		{
+			states[i] = Visiting;
+			BuildExpansion(frozen, frozen.Functions[frozen.AtomCount + i], states);
+			states[i] = Visited;
+		}
+	}
+	for(unsigned i = 0; i < frozen.AtomCount; ++i)
+	{
+		BuildExpansion(frozen, frozen.Functions[i], states);
+	}
+
+	std::vector<FrozenFunctionRecord> functions;
+	functions.reserve(frozen.Functions.size());
+	for(auto it = frozen.Functions.cbegin(); it != frozen.Functions.cend(); ++it)
+	{
+		const ExpandableFunction& definition = *it->Function;
+		FrozenFunctionRecord function;
+		function.ReturnType = writer.AddString(definition.ReturnType);
+		function.LowerReturnType = writer.AddString(boost::to_lower_copy(definition.ReturnType));
+		function.Name = writer.AddString(definition.Name);
+		function.Params = writer.AddString(definition.Params);
+		function.Source = writer.AddString(definition.Source);
+		function.ReturnSymbol = it->ReturnType;
+		function.Needs = writer.AddIds(it->Needs);
+		function.Returns = writer.AddReturns(definition.Returns);
+		function.ExpansionBegin = it->ExpansionBegin;
+		function.ClosureCombinators = writer.AddIds(it->Combinators);
+		function.ClosureSemantics = writer.AddIds(it->Semantics);
+		function.ClosureTextures = writer.AddIds(it->Textures);
+		function.ClosureSamplers = writer.AddIds(it->Samplers);
+		functions.push_back(function);
+	}
+
+	const std::vector<unsigned> symbolTable = BuildTable(unsigned(symbolNames.size()), [&symbolNames](unsigned id) -> const String& { return symbolNames[id]; });
+	const std::vector<unsigned> atomTable = BuildTable(frozen.AtomCount, [&frozen](unsigned index) -> const String& { return frozen.Functions[index].Function->Name; });
+
+	FrozenImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.Magic, SNAPSHOT_MAGIC, sizeof(header.Magic));
+	header.Version = SNAPSHOT_VERSION;
+	header.ByteOrder = SNAPSHOT_BYTE_ORDER;
+	header.ContentHash = GetContentHash();
+	header.HLSLSemanticCount = unsigned(hlslSemanticNames.size());
+	header.AtomCount = frozen.AtomCount;
+	header.CombinatorCount = unsigned(m_Combinators.size());
+	header.SymbolsOffset = sizeof(FrozenImageHeader);
+	header.SymbolCount = unsigned(frozen.Symbols.size());
+	header.FunctionsOffset = unsigned(header.SymbolsOffset + frozen.Symbols.size() * sizeof(FrozenSymbolRecord));
+	header.IdsOffset = unsigned(header.FunctionsOffset + functions.size() * sizeof(FrozenFunctionRecord));
+	header.IdCount = unsigned(writer.m_Ids.size());
+	header.ReturnsOffset = unsigned(header.IdsOffset + writer.m_Ids.size() * sizeof(unsigned));
+	header.ReturnCount = unsigned(writer.m_Returns.size());
+	header.ExpansionOffset = unsigned(header.ReturnsOffset + writer.m_Returns.size() * sizeof(FrozenReturn));
+	header.ExpansionCount = unsigned(frozen.Expansion.size());
+	header.SymbolTableOffset = unsigned(header.ExpansionOffset + frozen.Expansion.size() * sizeof(ExpansionStep));
+	header.SymbolTableSize = unsigned(symbolTable.size());
+	header.AtomTableOffset = unsigned(header.SymbolTableOffset + symbolTable.size() * sizeof(unsigned));
+	header.AtomTableSize = unsigned(atomTable.size());
+	header.StringsOffset = unsigned(header.AtomTableOffset + atomTable.size() * sizeof(unsigned));
+	header.StringsSize = unsigned(writer.m_Strings.size());
+	header.Size = header.StringsOffset + writer.m_Strings.size();
+
+	// The heap keeps the records aligned as a mapping would
+	std::shared_ptr<std::vector<char>> image = std::make_shared<std::vector<char>>(size_t(header.Size));
+	memcpy(image->data(), &header, sizeof(header));
+	WriteArray(*image, header.SymbolsOffset, frozen.Symbols);
+	WriteArray(*image, header.FunctionsOffset, functions);
+	WriteArray(*image, header.IdsOffset, writer.m_Ids);
+	WriteArray(*image, header.ReturnsOffset, writer.m_Returns);
+	WriteArray(*image, header.ExpansionOffset, frozen.Expansion);
+	WriteArray(*image, header.SymbolTableOffset, symbolTable);
+	WriteArray(*image, header.AtomTableOffset, atomTable);
+	std::copy(writer.m_Strings.cbegin(), writer.m_Strings.cend(), image->begin() + header.StringsOffset);
+
+	return std::make_shared<FrozenUniverse>(image->data(), image);
+}
+
+void ShaderTranslationUniverseImpl::Thaw() const
+{
+	if(m_Thawed.load(std::memory_order_acquire))
+	{
+		return;
+	}
+
+	boost::lock_guard<boost::mutex> lock(m_FrozenMutex);
+	if(m_Thawed.load(std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	// The records are sorted like the maps, so every insertion is at the end
+	const FrozenUniverse& frozen = *m_Frozen;
+	for(SymbolId id = 0; id < frozen.GetSymbolCount(); ++id)
+	{
+		const FrozenSymbol symbol = frozen.GetSymbol(id);
+		if(symbol.IsSemantic)
+		{
+			ShaderSemantic semantic;
+			semantic.Name = ToString(symbol.Name);
+			semantic.Type = ToString(symbol.Type);
+			semantic.HLSLSemantic = ToString(symbol.HLSLSemantic);
+			m_Semantics.insert(m_Semantics.end(), std::make_pair(semantic.Name, semantic));
+		}
+	}
+
+	auto thawFunction = [&frozen](const FrozenFunction& function, ExpandableFunction& definition)
+	{
+		definition.ReturnType = ToString(function.ReturnTypeName);
+		definition.Name = ToString(function.Name);
+		definition.Params = ToString(function.Params);
+		definition.Source = ToString(function.Source);
+		for(auto need = function.Needs.cbegin(); need != function.Needs.cend(); ++need)
+		{
+			definition.Needs.insert(definition.Needs.end(), ToString(frozen.GetSymbol(*need).Name));
+		}
+		for(auto statement = function.Returns.cbegin(); statement != function.Returns.cend(); ++statement)
+		{
+			const ReturnStatement thawed = { statement->Begin, statement->End, statement->ExpressionBegin, statement->ExpressionEnd };
+			definition.Returns.push_back(thawed);
+		}
+	};
+	for(unsigned i = 0; i < frozen.GetAtomCount(); ++i)
+	{
+		const FrozenFunction atom = frozen.GetAtom(i);
+		thawFunction(atom, m_Atoms.insert(m_Atoms.end(), std::make_pair(ToString(atom.Name), ExpandableFunction()))->second);
+	}
+	for(unsigned i = 0; i < frozen.GetCombinatorCount(); ++i)
+	{
+		const FrozenFunction combinator = frozen.GetCombinator(i);
+		thawFunction(combinator, m_Combinators.insert(m_Combinators.end(), std::make_pair(ToString(combinator.ReturnTypeName), ExpandableFunction()))->second);
+	}
+
+	m_Thawed.store(true, std::memory_order_release);
+}
+
+unsigned long long ShaderTranslationUniverseImpl::GetGeneration() const
+{
+	return m_Generation;
+}
+
+namespace
+{
+unsigned long long HashString(const String& str, unsigned long long hash)
+{
+	// include the terminator so that adjacent strings can't run into each other
+	return HashBytes(str.c_str(), str.size() + 1, hash);
+}
+
+unsigned long long HashFunctions(const std::map<String, ExpandableFunction>& functions, unsigned long long hash)
+{
+	for(auto it = functions.cbegin(); it != functions.cend(); ++it)
+	{
+		hash = HashString(it->first, hash);
+		hash = HashString(it->second.ReturnType, hash);
+		hash = HashString(it->second.Name, hash);
+		hash = HashString(it->second.Params, hash);
+		for(auto need = it->second.Needs.cbegin(); need != it->second.Needs.cend(); ++need)
+		{
+			hash = HashString(*need, hash);
+		}
+		hash = HashString(it->second.Source, hash);
+	}
+	return hash;
+}
+}
+
+unsigned long long ShaderTranslationUniverseImpl::GetContentHash() const
+{
+	boost::lock_guard<boost::mutex> lock(m_ContentHashMutex);
+	if(m_ContentHashGeneration != m_Generation)
+	{
+		unsigned long long hash = HASH_SEED;
+		for(auto it = m_Semantics.cbegin(); it != m_Semantics.cend(); ++it)
+		{
+			hash = HashString(it->second.Name, hash);
+			hash = HashString(it->second.Type, hash);
+			hash = HashString(it->second.HLSLSemantic, hash);
+		}
+		hash = HashBytes("atoms", 6, hash);
+		hash = HashFunctions(m_Atoms, hash);
+		hash = HashBytes("combinators", 12, hash);
+		hash = HashFunctions(m_Combinators, hash);
+
+		m_ContentHash = hash;
+		m_ContentHashGeneration = m_Generation;
+	}
+	return m_ContentHash;
+}
+
 const std::string& ShaderTranslationUniverseImpl::GetError()
 {
 	return m_Error;
@@ -38,13 +690,18 @@ const std::string& ShaderTranslationUniverseImpl::GetError()
 
 ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImpl::AddSemantics(const char* data)
 {
+	Modified();
+
 	std::istringstream fin(data);
 
 	const std::regex regular("(\\w+)\\s+(\\w+)\\s*:\\s*(\\w+);");
 
+	size_t lineNumber = 0;
 	String line;
-	while(!std::getline(fin, line).eof())
+	while(!GetLine(fin, line).eof())
 	{
+		++lineNumber;
+
 		String::const_iterator start, end;
 		start = line.begin();
 		end = line.end();
@@ -57,6 +714,11 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			semantic.HLSLSemantic.assign(match[3].first, match[3].second);
 
 			m_Semantics[semantic.Name] = semantic;
+			if(m_Lines)
+			{
+				DefinitionLine definition = { semantic.Name, lineNumber, semantic };
+				m_Lines->Semantics.push_back(definition);
+			}
 
 			start = match[0].second;
 		}
@@ -67,6 +729,11 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 
 ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImpl::AddCombinators(const char* data)
 {
+	Modified();
+
+	// Nothing is added unless all combinators parse and none of them closes a cycle
+	Combinators combinators(m_Combinators);
+
 	std::istringstream fin(data);
 	
 	const std::regex regular("combinator\\s+(\\w+)\\s+(\\w+)\\((.*)\\)(\\s+needs\\s+((\\w[,\\s]*)*))?");
@@ -74,7 +741,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 	size_t lineNumber = 0;
 	String line;
 	String needs;
-	while(!std::getline(fin, line).eof())
+	while(!GetLine(fin, line).eof())
 	{
 		++lineNumber;
 
@@ -86,6 +753,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 		{
 			// parse a combinator signature
 			ExpandableFunction conc;
+			const size_t signatureLine = lineNumber;
 
 			conc.ReturnType.assign(match[1].first, match[1].second);
 			conc.Name.assign(match[2].first, match[2].second);
@@ -94,7 +762,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			{
 				needs.assign(match[5].first, match[5].second);
 				
-				boost::algorithm::split(conc.Needs, needs, boost::algorithm::is_any_of(", "), boost::algorithm::token_compress_on);
+				boost::algorithm::split(conc.Needs, needs, boost::algorithm::is_any_of(", \r"), boost::algorithm::token_compress_on);
 				// Remove empties
 				conc.Needs.erase(EMPTY_STRING);
 			}
@@ -103,7 +771,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			size_t scopes = 0;
 			size_t lineStart = 0;
 			std::ostringstream source;
-			while(!std::getline(fin, line).eof())
+			while(!GetLine(fin, line).eof())
 			{
 				++lineNumber;
 				if(startPosition == std::string::npos)
@@ -137,16 +805,30 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			}
 
 			conc.Source = source.str().c_str();
-			m_Combinators[conc.ReturnType] = conc;
+			SplitReturns(conc);
+			if(m_Lines)
+			{
+				DefinitionLine definition = { conc.ReturnType, signatureLine, ShaderSemantic() };
+				m_Lines->Combinators.push_back(definition);
+			}
+			combinators[conc.ReturnType] = conc;
 			break;
 		}
 	}
 
+	if(FindCombinatorCycle(combinators, m_Error))
+	{
+		return ShaderTranslationUniverse::CombinatorCycle;
+	}
+	m_Combinators.swap(combinators);
+
 	return ShaderTranslationUniverse::Ok;
 }
 
 ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImpl::AddAtoms(const char* data)
 {
+	Modified();
+
 	const std::regex regular("atom\\s+(\\w+)\\s+(\\w+)\\((.*)\\)(\\s+needs\\s+((\\w[,\\s]*)*))?");	
 
 	std::istringstream fin(data);
@@ -154,7 +836,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 	size_t lineNumber = 0;
 	String line;
 	String needs;
-	while(!std::getline(fin, line).eof())
+	while(!GetLine(fin, line).eof())
 	{
 		++lineNumber;
 	
@@ -166,6 +848,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 		{
 			// parse a atom signature
 			ExpandableFunction atom;
+			const size_t signatureLine = lineNumber;
 	
 			atom.ReturnType.assign(match[1].first, match[1].second);
 			atom.Name.assign(match[2].first, match[2].second);
@@ -174,7 +857,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			{
 				needs.assign(match[5].first, match[5].second);
 	
-				boost::algorithm::split(atom.Needs, needs, boost::algorithm::is_any_of(", "), boost::algorithm::token_compress_on);
+				boost::algorithm::split(atom.Needs, needs, boost::algorithm::is_any_of(", \r"), boost::algorithm::token_compress_on);
 				// Remove empties
 				atom.Needs.erase(EMPTY_STRING);
 			}
@@ -183,7 +866,7 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			size_t scopes = 0;
 			size_t lineStart = 0;
 			std::ostringstream source;
-			while(!std::getline(fin, line).eof())
+			while(!GetLine(fin, line).eof())
 			{
 				++lineNumber;
 				if(startPosition == std::string::npos)
@@ -217,6 +900,12 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 			}
 	
 			atom.Source = source.str().c_str();
+			SplitReturns(atom);
+			if(m_Lines)
+			{
+				DefinitionLine definition = { atom.Name, signatureLine, ShaderSemantic() };
+				m_Lines->Atoms.push_back(definition);
+			}
 			m_Atoms[atom.Name] = atom;
 			break;
 		}
@@ -225,16 +914,463 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImp
 	return ShaderTranslationUniverse::Ok;
 }
 	 
+namespace
+{
+bool ReadLibraryFile(const std::string& path, std::string& contents)
+{
+	std::ifstream fin(path.c_str());
+	if(!fin.is_open())
+	{
+		return false;
+	}
+	contents.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+	return !fin.bad();
+}
+
+bool SameSemantic(const ShaderSemantic& lhs, const ShaderSemantic& rhs)
+{
+	return lhs.Type == rhs.Type && lhs.HLSLSemantic == rhs.HLSLSemantic;
+}
+
+// Where a definition of the merged library comes from
+struct DefinitionOrigin
+{
+	const std::string* File;
+	size_t Line;
+};
+
+std::ostream& operator<<(std::ostream& stream, const DefinitionOrigin& origin)
+{
+	if(!origin.File)
+	{
+		return stream << "the universe";
+	}
+	return stream << *origin.File << ":" << origin.Line;
+}
+}
+
+ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImpl::AddLibraryFiles(const std::vector<ShaderTranslationUniverse::LibraryFile>& files, TranslationThreadPool* pool)
+{
+	struct PartialUniverse
+	{
+		PartialUniverse()
+			: Error(ShaderTranslationUniverse::Ok)
+		{}
+
+		ShaderTranslationUniverseImpl Universe;
+		DefinitionLines Lines;
+		ShaderTranslationUniverse::TranslationUniverseError Error;
+	};
+	std::vector<std::unique_ptr<PartialUniverse>> partials(files.size());
+
+	std::unique_ptr<TranslationThreadPool> ownedPool;
+	if(!pool)
+	{
+		ownedPool.reset(new TranslationThreadPool);
+		pool = ownedPool.get();
+	}
+
+	// Every file is parsed on its own into a partial universe
+	pool->ParallelFor(unsigned(files.size()), [&](unsigned index, unsigned)
+	{
+		const ShaderTranslationUniverse::LibraryFile& file = files[index];
+		std::unique_ptr<PartialUniverse> partial(new PartialUniverse);
+		partial->Universe.m_Lines = &partial->Lines;
+
+		std::string contents;
+		if(!ReadLibraryFile(file.Path, contents))
+		{
+			partial->Universe.m_Error = "Unable to read file";
+			partial->Error = ShaderTranslationUniverse::UnreadableFile;
+		}
+		else
+		{
+			switch(file.Content)
+			{
+			case ShaderTranslationUniverse::SemanticsLibrary:
+				partial->Error = partial->Universe.AddSemantics(contents.c_str());
+				break;
+			case ShaderTranslationUniverse::AtomsLibrary:
+				partial->Error = partial->Universe.AddAtoms(contents.c_str());
+				break;
+			case ShaderTranslationUniverse::CombinatorsLibrary:
+				partial->Error = partial->Universe.AddCombinators(contents.c_str());
+				break;
+			default:
+				partial->Universe.m_Error = "Invalid library content";
+				partial->Error = ShaderTranslationUniverse::InvalidLibrary;
+				break;
+			}
+		}
+		partials[index] = std::move(partial);
+	});
+
+	for(unsigned i = 0; i < files.size(); ++i)
+	{
+		if(partials[i]->Error != ShaderTranslationUniverse::Ok)
+		{
+			m_Error = files[i].Path + ": " + partials[i]->Universe.m_Error;
+			return partials[i]->Error;
+		}
+	}
+
+	// Merge in the order of the files so that the result does not depend on the scheduling
+	Thaw();
+	std::map<String, DefinitionOrigin> semanticOrigins;
+	std::map<String, DefinitionOrigin> atomOrigins;
+	std::map<String, DefinitionOrigin> combinatorOrigins;
+	const DefinitionOrigin universeOrigin = { nullptr, 0 };
+	for(auto it = m_Semantics.cbegin(); it != m_Semantics.cend(); ++it)
+	{
+		semanticOrigins.insert(std::make_pair(it->first, universeOrigin));
+	}
+	for(auto it = m_Atoms.cbegin(); it != m_Atoms.cend(); ++it)
+	{
+		atomOrigins.insert(std::make_pair(it->first, universeOrigin));
+	}
+	for(auto it = m_Combinators.cbegin(); it != m_Combinators.cend(); ++it)
+	{
+		combinatorOrigins.insert(std::make_pair(it->first, universeOrigin));
+	}
+
+	ShaderSemantics semantics(m_Semantics);
+	std::ostringstream conflicts;
+	for(unsigned i = 0; i < files.size(); ++i)
+	{
+		const PartialUniverse& partial = *partials[i];
+		for(auto it = partial.Lines.Semantics.cbegin(); it != partial.Lines.Semantics.cend(); ++it)
+		{
+			const DefinitionOrigin origin = { &files[i].Path, it->Line };
+			// Several teams may declare the same semantic - only different declarations conflict
+			auto existing = semantics.find(it->Name);
+			if(existing != semantics.end() && !SameSemantic(existing->second, it->Semantic))
+			{
+				conflicts << origin << ": semantic " << it->Name << " conflicts with the one defined at " << semanticOrigins[it->Name] << std::endl;
+				continue;
+			}
+			semantics[it->Name] = it->Semantic;
+			semanticOrigins.insert(std::make_pair(it->Name, origin));
+		}
+
+		for(auto it = partial.Lines.Atoms.cbegin(); it != partial.Lines.Atoms.cend(); ++it)
+		{
+			const DefinitionOrigin origin = { &files[i].Path, it->Line };
+			auto inserted = atomOrigins.insert(std::make_pair(it->Name, origin));
+			if(!inserted.second)
+			{
+				conflicts << origin << ": atom " << it->Name << " is already defined at " << inserted.first->second << std::endl;
+			}
+		}
+
+		for(auto it = partial.Lines.Combinators.cbegin(); it != partial.Lines.Combinators.cend(); ++it)
+		{
+			const DefinitionOrigin origin = { &files[i].Path, it->Line };
+			auto inserted = combinatorOrigins.insert(std::make_pair(it->Name, origin));
+			if(!inserted.second)
+			{
+				conflicts << origin << ": combinator for " << it->Name << " is already defined at " << inserted.first->second << std::endl;
+			}
+		}
+	}
+
+	const std::string conflictList = conflicts.str();
+	if(!conflictList.empty())
+	{
+		m_Error = conflictList;
+		return ShaderTranslationUniverse::DefinitionConflict;
+	}
+
+	// Combinators of different files may need each other
+	Combinators combinators(m_Combinators);
+	for(unsigned i = 0; i < files.size(); ++i)
+	{
+		const ShaderTranslationUniverseImpl& partial = partials[i]->Universe;
+		combinators.insert(partial.m_Combinators.cbegin(), partial.m_Combinators.cend());
+	}
+	if(FindCombinatorCycle(combinators, m_Error))
+	{
+		return ShaderTranslationUniverse::CombinatorCycle;
+	}
+
+	Modified();
+	m_Semantics.swap(semantics);
+	m_Combinators.swap(combinators);
+	for(unsigned i = 0; i < files.size(); ++i)
+	{
+		const ShaderTranslationUniverseImpl& partial = partials[i]->Universe;
+		m_Atoms.insert(partial.m_Atoms.cbegin(), partial.m_Atoms.cend());
+	}
+
+	return ShaderTranslationUniverse::Ok;
+}
+
+namespace
+{
+bool IsInRange(unsigned long long offset, unsigned long long count, unsigned long long size)
+{
+	return offset <= size && count <= size - offset;
+}
+
+// Checks that count records of T at offset fit in an image of size bytes and are aligned for T
+template<typename T>
+bool IsInImage(unsigned long long offset, unsigned long long count, unsigned long long size)
+{
+	return offset % alignof(T) == 0 && offset <= size && count <= (size - offset) / sizeof(T);
+}
+
+bool IsValidTable(const unsigned* table, unsigned size, unsigned count)
+{
+	if(!size || (size & (size - 1)) || size <= count)
+	{
+		return false;
+	}
+	unsigned used = 0;
+	for(unsigned slot = 0; slot < size; ++slot)
+	{
+		if(table[slot] != unsigned(-1))
+		{
+			if(table[slot] >= count)
+			{
+				return false;
+			}
+			++used;
+		}
+	}
+	return used == count;
+}
+
+// Everything the frozen universe reads from an image is checked once here, so that a broken snapshot
+// can't make it read outside of the image or walk an expansion forever
+bool IsValidImage(const char* image, unsigned long long size, std::string& error)
+{
+	if(reinterpret_cast<uintptr_t>(image) % alignof(FrozenImageHeader))
+	{
+		error = "Snapshot is not aligned";
+		return false;
+	}
+	if(size < sizeof(FrozenImageHeader))
+	{
+		error = "Snapshot is truncated";
+		return false;
+	}
+	const FrozenImageHeader& header = *reinterpret_cast<const FrozenImageHeader*>(image);
+	if(memcmp(header.Magic, SNAPSHOT_MAGIC, sizeof(header.Magic)) || header.ByteOrder != SNAPSHOT_BYTE_ORDER)
+	{
+		error = "Not a universe snapshot";
+		return false;
+	}
+	if(header.Version != SNAPSHOT_VERSION)
+	{
+		std::ostringstream message;
+		message << "Unsupported snapshot version " << header.Version << ", expected " << SNAPSHOT_VERSION;
+		error = message.str();
+		return false;
+	}
+
+	error = "Snapshot is corrupted";
+	const unsigned long long functionCount = (unsigned long long)header.AtomCount + header.CombinatorCount;
+	if(header.Size != size
+		|| !IsInImage<FrozenSymbolRecord>(header.SymbolsOffset, header.SymbolCount, size)
+		|| !IsInImage<FrozenFunctionRecord>(header.FunctionsOffset, functionCount, size)
+		|| !IsInImage<unsigned>(header.IdsOffset, header.IdCount, size)
+		|| !IsInImage<FrozenReturn>(header.ReturnsOffset, header.ReturnCount, size)
+		|| !IsInImage<ExpansionStep>(header.ExpansionOffset, header.ExpansionCount, size)
+		|| !IsInImage<unsigned>(header.SymbolTableOffset, header.SymbolTableSize, size)
+		|| !IsInImage<unsigned>(header.AtomTableOffset, header.AtomTableSize, size)
+		|| !IsInRange(header.StringsOffset, header.StringsSize, size))
+	{
+		return false;
+	}
+
+	auto isString = [&header](const FrozenStringRecord& str)
+	{
+		return IsInRange(str.Offset, str.Size, header.StringsSize);
+	};
+	const unsigned* ids = reinterpret_cast<const unsigned*>(image + header.IdsOffset);
+	auto isIds = [&](const FrozenRange& range, unsigned long long count)
+	{
+		return IsInRange(range.Begin, range.Count, header.IdCount)
+			&& std::all_of(ids + range.Begin, ids + range.Begin + range.Count, [count](unsigned id) { return id < count; });
+	};
+
+	const FrozenSymbolRecord* symbols = reinterpret_cast<const FrozenSymbolRecord*>(image + header.SymbolsOffset);
+	for(unsigned i = 0; i < header.SymbolCount; ++i)
+	{
+		const FrozenSymbolRecord& symbol = symbols[i];
+		if(!isString(symbol.Name) || !isString(symbol.LowerName) || !isString(symbol.Type) || !isString(symbol.HLSLSemantic)
+			|| (symbol.Flags & ~unsigned(FSF_Semantic | FSF_Texture | FSF_Sampler))
+			|| ((symbol.Flags & FSF_Semantic) && symbol.HLSLSemanticIndex >= header.HLSLSemanticCount)
+			|| (symbol.Combinator != NO_FUNCTION && symbol.Combinator >= header.CombinatorCount))
+		{
+			return false;
+		}
+	}
+
+	const ExpansionStep* expansion = reinterpret_cast<const ExpansionStep*>(image + header.ExpansionOffset);
+	const FrozenReturn* returns = reinterpret_cast<const FrozenReturn*>(image + header.ReturnsOffset);
+	const FrozenFunctionRecord* functions = reinterpret_cast<const FrozenFunctionRecord*>(image + header.FunctionsOffset);
+	for(unsigned i = 0; i < functionCount; ++i)
+	{
+		const FrozenFunctionRecord& function = functions[i];
+		if(!isString(function.ReturnType) || !isString(function.LowerReturnType) || !isString(function.Name)
+			|| !isString(function.Params) || !isString(function.Source)
+			|| (function.ReturnSymbol != NO_SYMBOL && function.ReturnSymbol >= header.SymbolCount)
+			|| !isIds(function.Needs, header.SymbolCount)
+			|| !isIds(function.ClosureCombinators, header.CombinatorCount)
+			|| !isIds(function.ClosureSemantics, header.SymbolCount)
+			|| !isIds(function.ClosureTextures, header.SymbolCount)
+			|| !isIds(function.ClosureSamplers, header.SymbolCount)
+			|| !IsInRange(function.Returns.Begin, function.Returns.Count, header.ReturnCount)
+			// The steps of a function start after the ones another function ends with
+			|| function.ExpansionBegin >= header.ExpansionCount
+			|| (function.ExpansionBegin && expansion[function.ExpansionBegin - 1].Type != ExpansionStep::EmitFunction))
+		{
+			return false;
+		}
+		// The returns were found when the function was added - only check that they are in the source
+		// and in order, as they are emitted with the source between them
+		unsigned position = 0;
+		for(unsigned index = 0; index < function.Returns.Count; ++index)
+		{
+			const FrozenReturn& saved = returns[function.Returns.Begin + index];
+			if(saved.Begin < position || saved.Begin > saved.ExpressionBegin || saved.ExpressionBegin > saved.ExpressionEnd
+				|| saved.ExpressionEnd >= saved.End || saved.End > function.Source.Size)
+			{
+				return false;
+			}
+			position = saved.End;
+		}
+	}
+
+	// A combinator may only be entered if its steps end before the ones that enter it start, so that
+	// every walk reaches the step that emits its function
+	unsigned rangeBegin = 0;
+	for(unsigned i = 0; i < header.ExpansionCount; ++i)
+	{
+		const ExpansionStep& step = expansion[i];
+		switch(step.Type)
+		{
+		case ExpansionStep::RequireInput:
+			if(step.Symbol >= header.SymbolCount)
+			{
+				return false;
+			}
+			break;
+		case ExpansionStep::EnterCombinator:
+			if(step.Symbol >= header.SymbolCount || step.Function >= functionCount || functions[step.Function].ExpansionBegin >= rangeBegin)
+			{
+				return false;
+			}
+			break;
+		case ExpansionStep::EmitFunction:
+			if(step.Function >= functionCount)
+			{
+				return false;
+			}
+			rangeBegin = i + 1;
+			break;
+		default:
+			return false;
+		}
+	}
+	if(rangeBegin != header.ExpansionCount)
+	{
+		return false;
+	}
+
+	if(!IsValidTable(reinterpret_cast<const unsigned*>(image + header.SymbolTableOffset), header.SymbolTableSize, header.SymbolCount)
+		|| !IsValidTable(reinterpret_cast<const unsigned*>(image + header.AtomTableOffset), header.AtomTableSize, header.AtomCount))
+	{
+		return false;
+	}
+
+	error.clear();
+	return true;
+}
+}
+
+ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImpl::SaveSnapshot(const char* path) const
+{
+	// The snapshot is the frozen image as it is
+	const FrozenUniversePtr frozen = GetFrozen();
+
+	std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+	if(!fout.is_open())
+	{
+		m_Error = "Unable to open snapshot for writing: ";
+		m_Error += path;
+		return ShaderTranslationUniverse::InvalidSnapshot;
+	}
+
+	fout.write(frozen->GetImage(), std::streamsize(frozen->GetHeader().Size));
+	if(!fout.flush())
+	{
+		m_Error = "Unable to write snapshot: ";
+		m_Error += path;
+		return ShaderTranslationUniverse::InvalidSnapshot;
+	}
+
+	return ShaderTranslationUniverse::Ok;
+}
+
+ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverseImpl::LoadSnapshot(const char* path)
+{
+	namespace ipc = boost::interprocess;
+
+	// The frozen universe reads the mapping and keeps it alive
+	std::shared_ptr<ipc::mapped_region> region;
+	try
+	{
+		ipc::file_mapping mapping(path, ipc::read_only);
+		region = std::make_shared<ipc::mapped_region>(mapping, ipc::read_only);
+	}
+	catch(const ipc::interprocess_exception& e)
+	{
+		m_Error = "Unable to map snapshot ";
+		m_Error += path;
+		m_Error += ": ";
+		m_Error += e.what();
+		return ShaderTranslationUniverse::InvalidSnapshot;
+	}
+
+	const char* image = static_cast<const char*>(region->get_address());
+	if(!IsValidImage(image, region->get_size(), m_Error))
+	{
+		return ShaderTranslationUniverse::InvalidSnapshot;
+	}
+	FrozenUniversePtr frozen = std::make_shared<FrozenUniverse>(image, region);
+
+	m_Generation = ++sGenerationCounter;
+	{
+		boost::lock_guard<boost::mutex> lock(m_FrozenMutex);
+		m_Frozen = frozen;
+		m_Semantics.clear();
+		m_Atoms.clear();
+		m_Combinators.clear();
+		m_Thawed.store(false, std::memory_order_release);
+	}
+
+	// The contents are the ones the hash was taken of
+	boost::lock_guard<boost::mutex> lock(m_ContentHashMutex);
+	m_ContentHash = frozen->GetHeader().ContentHash;
+	m_ContentHashGeneration = m_Generation;
+
+	return ShaderTranslationUniverse::Ok;
+}
+
 const ShaderSemantics& ShaderTranslationUniverseImpl::GetSemantics() const
 {
+	Thaw();
 	return m_Semantics;
 }
 const Combinators& ShaderTranslationUniverseImpl::GetCombinators() const
 {
+	Thaw();
 	return m_Combinators;
 }
 const Atoms& ShaderTranslationUniverseImpl::GetAtoms() const
 {
+	Thaw();
 	return m_Atoms;
 }
 
@@ -263,6 +1399,21 @@ ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverse::A
 	return m_Impl->AddAtoms(data);
 }
 
+ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverse::AddLibraryFiles(const std::vector<LibraryFile>& files, TranslationThreadPool* pool)
+{
+	return m_Impl->AddLibraryFiles(files, pool);
+}
+
+ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverse::SaveSnapshot(const char* path) const
+{
+	return m_Impl->SaveSnapshot(path);
+}
+
+ShaderTranslationUniverse::TranslationUniverseError ShaderTranslationUniverse::LoadSnapshot(const char* path)
+{
+	return m_Impl->LoadSnapshot(path);
+}
+
 const ShaderSemantics& ShaderTranslationUniverse::GetSemantics() const
 {
 	return m_Impl->GetSemantics();
@@ -278,6 +1429,26 @@ const Atoms& ShaderTranslationUniverse::GetAtoms() const
 	return m_Impl->GetAtoms();
 }
 
+unsigned long long ShaderTranslationUniverse::GetGeneration() const
+{
+	return m_Impl->GetGeneration();
+}
+
+unsigned long long ShaderTranslationUniverse::GetContentHash() const
+{
+	return m_Impl->GetContentHash();
+}
+
+void ShaderTranslationUniverse::Freeze()
+{
+	m_Impl->Freeze();
+}
+
+FrozenUniversePtr ShaderTranslationUniverse::GetFrozen() const
+{
+	return m_Impl->GetFrozen();
+}
+
 const std::string& ShaderTranslationUniverse::GetLastError() const
 {
 	return m_Impl->GetError();	
@@ -10,6 +10,10 @@ namespace translator
 {
 
 class ShaderTranslationUniverseImpl;
+class TranslationThreadPool;
+class FrozenUniverse;
+typedef std::shared_ptr<const FrozenUniverse> FrozenUniversePtr;
+
 struct ShaderSemantic
 {
 	String Name;
@@ -18,6 +22,15 @@ struct ShaderSemantic
 };
 typedef std::map<String, ShaderSemantic> ShaderSemantics;
 
+// A "return expression;" statement as offsets in the source of a function
+struct ReturnStatement
+{
+	size_t Begin;
+	size_t End;
+	size_t ExpressionBegin;
+	size_t ExpressionEnd;
+};
+
 struct ExpandableFunction
 {
 	String ReturnType;
@@ -25,6 +38,8 @@ struct ExpandableFunction
 	String Params;
 	std::set<String> Needs;
 	String Source;
+	// Found when the function is added - expanding assigns each expression to the context instead
+	std::vector<ReturnStatement> Returns;
 };
 typedef std::map<String, ExpandableFunction> Combinators;
 typedef std::map<String, ExpandableFunction> Atoms;
@@ -38,20 +53,64 @@ public:
 		Ok,
 		InvalidSemantic,
 		Invalidcombinator,
-		InvalidAtom
+		InvalidAtom,
+		InvalidSnapshot,
+		UnreadableFile,
+		DefinitionConflict,
+		CombinatorCycle,
+		InvalidLibrary
+	};
+
+	enum LibraryContent
+	{
+		SemanticsLibrary,
+		AtomsLibrary,
+		CombinatorsLibrary
+	};
+
+	struct LibraryFile
+	{
+		std::string Path;
+		LibraryContent Content;
 	};
 
 	ShaderTranslationUniverse();
 	~ShaderTranslationUniverse();
 	
 	TranslationUniverseError AddSemantics(const char* data);
+	// Combinators that need each other directly or through others are rejected
 	TranslationUniverseError AddCombinators(const char* data);
 	TranslationUniverseError AddAtoms(const char* data);
 
+	// Parses the files in parallel and merges them in the given order. Duplicate atoms,
+	// combinators for the same return type and differing declarations of a semantic are
+	// conflicts - all of them are reported with their files and lines and nothing is added.
+	// Without a pool one with a worker per hardware thread is used.
+	TranslationUniverseError AddLibraryFiles(const std::vector<LibraryFile>& files, TranslationThreadPool* pool = nullptr);
+
+	// A snapshot is the frozen index of the universe as a versioned, position-independent file.
+	// Loading maps it read-only and only validates it - translations read the mapped records, so
+	// processes loading the same snapshot share its pages. The mapping is kept until the universe
+	// is modified or destroyed. The maps below are built from it the first time they are asked for.
+	// Loading replaces the current contents; on failure they are left untouched.
+	TranslationUniverseError SaveSnapshot(const char* path) const;
+	TranslationUniverseError LoadSnapshot(const char* path);
+
 	const ShaderSemantics& GetSemantics() const;
 	const Combinators& GetCombinators() const;
 	const Atoms& GetAtoms() const;
 
+	// Changes whenever the universe is modified. Generations are unique across all universes.
+	unsigned long long GetGeneration() const;
+	// A hash of all semantics, atoms and combinators - equal contents give equal hashes in any process
+	unsigned long long GetContentHash() const;
+
+	// Interns all names into integer IDs and builds the hashed indices translations work with, in the
+	// image a snapshot saves.
+	// Translating freezes the universe on demand; modifying it drops the index.
+	void Freeze();
+	FrozenUniversePtr GetFrozen() const;
+
 	const std::string& GetLastError() const;
 
 private:
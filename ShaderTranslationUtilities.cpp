@@ -27,4 +27,232 @@ void FindAndCountBraces(std::ostringstream& source, const String& line, size_t l
 	}
 }
 
-}
\ No newline at end of file
+std::istream& GetLine(std::istream& in, String& line)
+{
+	std::getline(in, line);
+	if(!line.empty() && line[line.size() - 1] == '\r')
+	{
+		line.erase(line.size() - 1);
+	}
+	return in;
+}
+
+unsigned long long HashBytes(const char* data, size_t size, unsigned long long seed)
+{
+	unsigned long long hash = seed;
+	for(const char* end = data + size; data != end; ++data)
+	{
+		hash ^= static_cast<unsigned char>(*data);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+namespace
+{
+
+inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool IsWord(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+inline bool SkipLiteral(const char*& ptr, const char* end, const char* literal)
+{
+	const char* cursor = ptr;
+	for(; *literal; ++literal, ++cursor)
+	{
+		if(cursor == end || *cursor != *literal)
+		{
+			return false;
+		}
+	}
+	ptr = cursor;
+	return true;
+}
+
+// Skips one or more characters satisfying the predicate
+template<typename Predicate>
+inline bool SkipSome(const char*& ptr, const char* end, Predicate predicate)
+{
+	const char* cursor = ptr;
+	while(cursor != end && predicate(*cursor))
+	{
+		++cursor;
+	}
+	if(cursor == ptr)
+	{
+		return false;
+	}
+	ptr = cursor;
+	return true;
+}
+
+// context.(\w+)\s+=\s+(\w+)\(\);
+bool MatchPolymorphic(const char* ptr, const char* end, CodeTranslation& result)
+{
+	if(!SkipLiteral(ptr, end, "context."))
+	{
+		return false;
+	}
+	result.NameBegin = ptr;
+	if(!SkipSome(ptr, end, IsWord))
+	{
+		return false;
+	}
+	result.NameEnd = ptr;
+	if(!SkipSome(ptr, end, IsSpace) || !SkipLiteral(ptr, end, "=") || !SkipSome(ptr, end, IsSpace))
+	{
+		return false;
+	}
+	result.FunctionBegin = ptr;
+	if(!SkipSome(ptr, end, IsWord))
+	{
+		return false;
+	}
+	result.FunctionEnd = ptr;
+	if(!SkipLiteral(ptr, end, "();"))
+	{
+		return false;
+	}
+	result.End = ptr;
+	return true;
+}
+
+// output.(\w+)\s+=.*
+bool MatchOutput(const char* ptr, const char* end, CodeTranslation& result)
+{
+	if(!SkipLiteral(ptr, end, "output."))
+	{
+		return false;
+	}
+	result.NameBegin = ptr;
+	if(!SkipSome(ptr, end, IsWord))
+	{
+		return false;
+	}
+	result.NameEnd = ptr;
+	if(!SkipSome(ptr, end, IsSpace) || !SkipLiteral(ptr, end, "="))
+	{
+		return false;
+	}
+	while(ptr != end && *ptr != '\n' && *ptr != '\r')
+	{
+		++ptr;
+	}
+	result.End = ptr;
+	return true;
+}
+
+// CONTEXT_IF(NOT)?\(context\.(\w+)\)( )*\{
+bool MatchContextIf(const char* ptr, const char* end, CodeTranslation& result)
+{
+	if(!SkipLiteral(ptr, end, "CONTEXT_IF"))
+	{
+		return false;
+	}
+	const CodeTranslationType type = SkipLiteral(ptr, end, "NOT") ? CT_ContextIfNot : CT_ContextIf;
+	if(!SkipLiteral(ptr, end, "(context."))
+	{
+		return false;
+	}
+	result.NameBegin = ptr;
+	if(!SkipSome(ptr, end, IsWord))
+	{
+		return false;
+	}
+	result.NameEnd = ptr;
+	if(!SkipLiteral(ptr, end, ")"))
+	{
+		return false;
+	}
+	while(ptr != end && *ptr == ' ')
+	{
+		++ptr;
+	}
+	if(!SkipLiteral(ptr, end, "{"))
+	{
+		return false;
+	}
+	result.Type = type;
+	result.End = ptr;
+	return true;
+}
+
+}
+
+CodeTranslation FindNextCodeTranslation(const char* start, const char* end)
+{
+	return FindNextCodeTranslation(start, end, end);
+}
+
+CodeTranslation FindNextCodeTranslation(const char* start, const char* end, const char* stop)
+{
+	CodeTranslation result = { CT_None, end, end, end, end, end, end, end };
+
+	// The whitespace run preceding the current character and the first new line in it
+	const char* run = nullptr;
+	const char* newLine = nullptr;
+	for(const char* ptr = start; ptr != stop; ++ptr)
+	{
+		const char c = *ptr;
+		if(IsSpace(c))
+		{
+			if(!run)
+			{
+				run = ptr;
+			}
+			if(c == '\n' && !newLine)
+			{
+				newLine = ptr;
+			}
+			continue;
+		}
+
+		if(run)
+		{
+			if(c == 'C' && MatchContextIf(ptr, end, result))
+			{
+				result.Begin = run;
+				result.PrefixEnd = ptr;
+				return result;
+			}
+			// (\n+)\s+ needs at least one more whitespace after the first new line
+			if(newLine && ptr - newLine >= 2)
+			{
+				if(c == 'c' && MatchPolymorphic(ptr, end, result))
+				{
+					result.Type = CT_Polymorphic;
+				}
+				else if(c == 'o' && MatchOutput(ptr, end, result))
+				{
+					result.Type = CT_Output;
+				}
+
+				if(result.Type != CT_None)
+				{
+					// \n+ is greedy but must leave one character for \s+. The '\r' of a CRLF
+					// ending belongs to the new line, as if the source was read in text mode.
+					const char* prefixEnd = newLine;
+					while(prefixEnd + 1 < ptr && (*prefixEnd == '\n' || (*prefixEnd == '\r' && prefixEnd[1] == '\n')))
+					{
+						++prefixEnd;
+					}
+					result.Begin = newLine;
+					result.PrefixEnd = prefixEnd;
+					return result;
+				}
+			}
+		}
+		run = nullptr;
+		newLine = nullptr;
+	}
+
+	return result;
+}
+
+}
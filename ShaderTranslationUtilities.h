@@ -11,4 +11,48 @@ namespace translator
 
 void FindAndCountBraces(std::ostringstream& source, const String& line, size_t lineStart, size_t& scopes);
 
-}
\ No newline at end of file
+// std::getline that leaves out the '\r' of a CRLF ending, as a read in text mode would
+std::istream& GetLine(std::istream& in, String& line);
+
+static const unsigned long long HASH_SEED = 14695981039346656037ULL;
+
+// 64-bit FNV-1a - pass the previous result as seed to hash several pieces
+unsigned long long HashBytes(const char* data, size_t size, unsigned long long seed = HASH_SEED);
+
+enum CodeTranslationType
+{
+	CT_Polymorphic = 0,
+	CT_Output,
+	CT_ContextIf,
+	CT_ContextIfNot,
+	CT_None
+};
+
+// A rewrite point inside a shader body. Begin/PrefixEnd delimit the leading
+// whitespace that is kept verbatim, End is one past the last matched character.
+// Name is the context/output field, Function is the called polymorphic.
+struct CodeTranslation
+{
+	CodeTranslationType Type;
+	const char* Begin;
+	const char* PrefixEnd;
+	const char* End;
+	const char* NameBegin;
+	const char* NameEnd;
+	const char* FunctionBegin;
+	const char* FunctionEnd;
+};
+
+// Finds the first rewrite point in [start, end) in a single linear walk.
+// Recognises the same constructs as the original regular expressions:
+//  (\n+)\s+context\.(\w+)\s+=\s+(\w+)\(\);
+//  (\n+)\s+output\.(\w+)\s+=.*
+//  (\s+)CONTEXT_IF\(context\.(\w+)\)( )*\{
+//  (\s+)CONTEXT_IFNOT\(context\.(\w+)\)( )*\{
+// Only rewrite points starting before stop are looked for - a match may still extend up to end.
+// The walk forgets everything at each character that isn't whitespace, so two walks that pass
+// the same such character without a match find the same rewrite point after it.
+CodeTranslation FindNextCodeTranslation(const char* start, const char* end, const char* stop);
+CodeTranslation FindNextCodeTranslation(const char* start, const char* end);
+
+}
@@ -3,18 +3,14 @@
 // Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
 //
 #include "stdafx.h"
-#include "ShaderTranslator.h"
-#include "ShaderTranslationUniverse.h"
-#include "ShaderTranslationUtilities.h"
+#include "ShaderTranslatorImpl.h"
 
 namespace translator
 {
 
-boost::thread_specific_ptr<TlsScratchAllocator> TlsScratchAllocator::sPtr;
-
-static const char* MAP_PREFIX       = "MAP_";
-static const char* SAMPLER_PREFIX   = "SAMPLER_";
-static const char* VOID_TYPE        = "VOID";
+const char* MAP_PREFIX              = "MAP_";
+const char* SAMPLER_PREFIX          = "SAMPLER_";
+const char* VOID_TYPE               = "VOID";
 static const char* VS_POSITION      = "float4 Position : POSITION;";
 static const char* PS_POSITION      = "float4 Position : SV_POSITION;";
 static const char* TEXCOORD_STRING  = "TEXCOORD";
@@ -22,651 +18,1756 @@ static const char* VS_INPUT_STRING  = "VS_INPUT";
 static const char* VS_OUTPUT_STRING = "VS_OUTPUT";
 static const char* PS_INPUT_STRING  = "PS_INPUT";
 static const char* POSITION_STRING  = "POSITION";
+static const char* OUTPUT_PREFIX    = "output.";
+static const char* PACKED_PREFIX    = "packed";
+static const char* COMPONENTS       = "xyzw";
 
-enum TranslatorShaderType
-{
-	VertexShader,
-	PixelShader
-};
-
-typedef std::multimap<ScratchString, ScratchString>	Polymorphics;
-struct ParsingState
+// Where the semantics passed between the stages live when they are packed into vectors
+struct InterpolatorLayout
 {
-	Polymorphics Functions;
-	std::vector<ScratchString> Code;
-};
-
-class ShaderTranslatorImpl
-{
-public:
-	const std::string& GetError();
-
-	ShaderTranslator::ShaderTranslatorError TranslateToHLSL(const std::string& shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, std::string& output);
-
-private:
-	struct CodeState
+	// A TEXCOORD register - either a vector shared by several semantics or
+	// a semantic of a type that can't be packed, which may take several registers
+	struct Register
 	{
-		TranslatorShaderType Type;
-		ScratchString InputName;
-		ScratchString OutputName;
-		ScratchString ShaderSignature;
-
-		std::set<ScratchString> InputSemantics;
-		std::set<ScratchString> OutputSemantics;
-		std::set<ScratchString> ContextSemantics;
-		std::set<ScratchString> AvailableSemantics;
-		std::set<ScratchString> InputTextures;
-		std::set<ScratchString> InputSamplers;
+		FrozenString Type;
+		// NO_SYMBOL for shared vectors
+		SymbolId Symbol;
+		unsigned Index;
+		unsigned Components;
+		unsigned Rows;
+	};
 
-		ScratchString InnerSource;
+	struct Location
+	{
+		SymbolId Semantic;
+		unsigned Register;
+		unsigned Component;
+		unsigned Size;
 	};
 
-	ShaderTranslator::ShaderTranslatorError ParsePolymorphic(std::istream& stream, Polymorphics& polys, const ShaderTranslationUniverse* universe, const ScratchString& name);
-	ShaderTranslator::ShaderTranslatorError ParseShader(std::istream& stream, ParsingState& state, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, TranslatorShaderType type, std::match_results<ScratchString::const_iterator>& match);
-	ShaderTranslator::ShaderTranslatorError ExpandFunction(const ExpandableFunction& function, CodeState& state, const ShaderTranslationUniverse* universe, ScratchString& output);
-	ShaderTranslator::ShaderTranslatorError ExpandShaderInput(std::ostringstream& inputStruct, CodeState& codeState, const ShaderSemantics& semantics);
+	CountedVector<Register> Registers;
+	// Sorted by semantic
+	CountedVector<Location> Locations;
 
-private:
-	std::string m_Error;
+	const Location* Find(SymbolId semantic) const
+	{
+		auto location = std::lower_bound(Locations.cbegin(), Locations.cend(), semantic, [](const Location& lhs, SymbolId rhs) { return lhs.Semantic < rhs; });
+		return location != Locations.cend() && location->Semantic == semantic ? &*location : nullptr;
+	}
+
+	// "packed0.xy" for a packed semantic, its own name otherwise
+	void WriteMember(OutputWriter& writer, const Location& location, const FrozenSymbol& symbol) const
+	{
+		const Register& reg = Registers[location.Register];
+		if(reg.Symbol != NO_SYMBOL)
+		{
+			writer << symbol.LowerName;
+			return;
+		}
+		writer << PACKED_PREFIX << (unsigned long long)reg.Index << ".";
+		writer.Write(COMPONENTS + location.Component, location.Size);
+	}
 };
 
-const std::string& ShaderTranslatorImpl::GetError()
+namespace
 {
-	return m_Error;
-}
+// Scalars and vectors of these share the vector type of their kind
+static const struct PackableType
+{
+	const char* Scalar;
+	const char* Vector;
+} PACKABLE_TYPES[] =
+{
+	{ "float", "float4" },
+	{ "half", "float4" },
+	{ "int", "int4" },
+	{ "uint", "uint4" }
+};
 
-ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ExpandFunction(const ExpandableFunction& function, CodeState& state, const ShaderTranslationUniverse* universe, ScratchString& output)
+bool GetPackedVector(const FrozenString& type, const char*& vector, unsigned& size)
 {
-	const Combinators& combinators = universe->GetCombinators();
-	// Check all needs
-	std::for_each(function.Needs.begin(), function.Needs.end(), [&](const String& need)
+	for(size_t i = 0; i < sizeof(PACKABLE_TYPES) / sizeof(PACKABLE_TYPES[0]); ++i)
 	{
-		auto found = std::find(state.AvailableSemantics.begin(), state.AvailableSemantics.end(), need);
-		if(found == state.AvailableSemantics.end())
+		const size_t length = strlen(PACKABLE_TYPES[i].Scalar);
+		if(type.size() < length || memcmp(type.data(), PACKABLE_TYPES[i].Scalar, length) != 0)
 		{
-			auto combinator = combinators.find(need);
-			if(combinator != combinators.end())
-			{
-				ExpandFunction(combinator->second, state, universe, output);
-			}
-			else
-			{
-				if(need.find(MAP_PREFIX) == 0)
-				{
-					state.InputTextures.insert(ScratchString(need));
-				}
-				else if(need.find(SAMPLER_PREFIX) == 0)
-				{
-					state.InputSamplers.insert(ScratchString(need));
-				}
-				else
-				{
-					state.InputSemantics.insert(ScratchString(need));
-					state.ContextSemantics.insert(ScratchString(need));
-					state.AvailableSemantics.insert(ScratchString(need));
-				}
-			}
+			continue;
 		}
-	});
-	
-	if(function.ReturnType != VOID_TYPE)
-	{
-		state.ContextSemantics.insert(ScratchString(function.ReturnType));
-		state.AvailableSemantics.insert(ScratchString(function.ReturnType));
+		if(type.size() == length)
+		{
+			size = 1;
+		}
+		else if(type.size() == length + 1 && type[length] >= '1' && type[length] <= '4')
+		{
+			size = type[length] - '0';
+		}
+		else
+		{
+			continue;
+		}
+		vector = PACKABLE_TYPES[i].Vector;
+		return true;
 	}
-	
-	output.append("\n{ // ");
-	output.append(function.Name.begin(), function.Name.end());
-
-	static const std::regex returnStatementFinder("return\\s+(.*);");
-	std::match_results<ScratchString::const_iterator> match;
-	auto start = function.Source.begin();
-	auto end = function.Source.end();
-	if(std::regex_search(start, end, match, returnStatementFinder))
-	{
-		output.append(start, match[0].first);
+	return false;
+}
 
-		output.append("context.");
-		output.append(boost::algorithm::to_lower_copy(function.ReturnType));
-		output.append(" = ");
-		output.append(match[1].first, match[1].second);
-		output.append(";");
-		output.append(match[0].second, end);
-	}
-	else
+// Matrices take a register per row
+unsigned GetRegisterCount(const FrozenString& type)
+{
+	const char* separator = std::find(type.begin(), type.end(), 'x');
+	if(separator != type.end() && separator != type.begin() && separator[-1] >= '1' && separator[-1] <= '4')
 	{
-		output.append(start, end);
+		return separator[-1] - '0';
 	}
-	output.append("}\n");			
-	return ShaderTranslator::Ok;
+	return 1;
 }
 
-ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ParsePolymorphic(std::istream& stream, Polymorphics& polys, const ShaderTranslationUniverse* universe, const ScratchString& name)
+// Packs the larger semantics first, each into the first vector of its kind with enough room left.
+// Equal sets of semantics always get equal layouts, so a vertex shader and a pixel shader that
+// pass the same semantics agree on them. Linked files build one for all of their stages.
+void BuildInterpolatorLayout(const SymbolSet& semantics, const ParsedShader& parsed, InterpolatorLayout& layout)
 {
-	std::ostringstream source;
-	ScratchString line;
-	bool inCode = false;
-	bool end = false;
-	while(!std::getline(stream, line).eof() && !end)
+	struct Candidate
+	{
+		SymbolId Semantic;
+		const char* Vector;
+		unsigned Size;
+	};
+	CountedVector<Candidate> packable;
+	CountedVector<SymbolId> unpackable;
+	for(SymbolId semantic = semantics.First(); semantic != NO_SYMBOL; semantic = semantics.Next(semantic))
 	{
-		if(!inCode && (line.find('{') != ScratchString::npos))
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		if(symbol.IsTexture || symbol.IsSampler || !symbol.IsSemantic || symbol.Name == POSITION_STRING)
 		{
-			inCode = true;
+			continue;
 		}
-		else if(inCode)
+		Candidate candidate = { semantic, nullptr, 0 };
+		if(GetPackedVector(symbol.Type, candidate.Vector, candidate.Size))
 		{
-			for(size_t i = 0; i < line.size(); ++i)
-			{
-				if(line[i] == '}')
-				{
-					end = true;
-					break;
-				}
-				source << line[i];
-			}
+			packable.push_back(candidate);
+		}
+		else
+		{
+			unpackable.push_back(semantic);
 		}
 	}
+	std::stable_sort(packable.begin(), packable.end(), [](const Candidate& lhs, const Candidate& rhs) { return lhs.Size > rhs.Size; });
 
-	if(stream.eof() && !end)
+	unsigned index = 0;
+	for(auto candidate = packable.cbegin(); candidate != packable.cend(); ++candidate)
 	{
-		m_Error = "Error parsing polymorphic types - EOF";
-		return ShaderTranslator::PolymorphicParsingError;
+		auto reg = std::find_if(layout.Registers.begin(), layout.Registers.end(), [&](const InterpolatorLayout::Register& existing)
+		{
+			return existing.Type == candidate->Vector && existing.Components + candidate->Size <= 4;
+		});
+		if(reg == layout.Registers.end())
+		{
+			const InterpolatorLayout::Register shared = { candidate->Vector, NO_SYMBOL, index++, 0, 1 };
+			layout.Registers.push_back(shared);
+			reg = layout.Registers.end() - 1;
+		}
+		const InterpolatorLayout::Location location = { candidate->Semantic, unsigned(reg - layout.Registers.begin()), reg->Components, candidate->Size };
+		layout.Locations.push_back(location);
+		reg->Components += candidate->Size;
 	}
 
-	const auto& atoms = universe->GetAtoms();
-	auto CheckAtom = [&atoms](const ScratchString& atom) -> bool { return atoms.find(atom) != atoms.end(); };
+	for(auto semantic = unpackable.cbegin(); semantic != unpackable.cend(); ++semantic)
+	{
+		const FrozenSymbol& symbol = parsed.GetSymbol(*semantic);
+		const InterpolatorLayout::Register own = { symbol.Type, *semantic, index, 0, GetRegisterCount(symbol.Type) };
+		index += own.Rows;
+		const InterpolatorLayout::Location location = { *semantic, unsigned(layout.Registers.size()), 0, 0 };
+		layout.Registers.push_back(own);
+		layout.Locations.push_back(location);
+	}
 
-	std::vector<ScratchString> ptrs;
-	boost::algorithm::split(ptrs, source.str(), boost::algorithm::is_any_of(", "), boost::algorithm::token_compress_on);
+	std::sort(layout.Locations.begin(), layout.Locations.end(), [](const InterpolatorLayout::Location& lhs, const InterpolatorLayout::Location& rhs) { return lhs.Semantic < rhs.Semantic; });
+}
 
-	for(auto it = ptrs.begin(); it != ptrs.end(); ++it)
+// Gives every semantic a TEXCOORD of its own in the order of the IDs, as the unpacked stages number them
+void BuildTexcoordLayout(const SymbolSet& semantics, const ParsedShader& parsed, InterpolatorLayout& layout)
+{
+	for(SymbolId semantic = semantics.First(); semantic != NO_SYMBOL; semantic = semantics.Next(semantic))
 	{
-		boost::trim(*it);
-		if(!CheckAtom(*it))
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		if(symbol.IsTexture || symbol.IsSampler || !symbol.IsSemantic || symbol.Name == POSITION_STRING)
 		{
-			m_Error = "Unknown atom used: ";
-			m_Error.append(it->c_str());
-			return ShaderTranslator::UnknownAtomUsed;
+			continue;
 		}
-		polys.insert(std::make_pair(name, *it));
+		const unsigned index = unsigned(layout.Registers.size());
+		const InterpolatorLayout::Register own = { symbol.Type, semantic, index, 0, 1 };
+		const InterpolatorLayout::Location location = { semantic, index, 0, 0 };
+		layout.Registers.push_back(own);
+		layout.Locations.push_back(location);
 	}
-	
-	return ShaderTranslator::Ok;
 }
 
-ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ExpandShaderInput(std::ostringstream& inputStruct, CodeState& codeState, const ShaderSemantics& semantics)
+// The TEXCOORD of an unpacked semantic - the linked one if there is such, the next after them otherwise
+unsigned GetTexcoord(const InterpolatorLayout* texcoords, SymbolId semantic, unsigned& counter)
 {
-	inputStruct << "struct " << codeState.InputName << " { " << std::endl;
-	
-	switch(codeState.Type)
+	const InterpolatorLayout::Location* location = texcoords ? texcoords->Find(semantic) : nullptr;
+	if(location)
 	{
-	case VertexShader:
-		inputStruct << VS_POSITION << std::endl;
-		break;
-	case PixelShader:
-		inputStruct << PS_POSITION << std::endl;
-		break;
+		return texcoords->Registers[location->Register].Index;
 	}
+	return (texcoords ? unsigned(texcoords->Registers.size()) : 0) + counter++;
+}
 
-	std::map<ScratchString, size_t> semanticCounters;
-	for(auto semantic = codeState.InputSemantics.cbegin(); semantic != codeState.InputSemantics.cend(); ++semantic)
+// The members of a packed struct, each shared vector followed by the semantics in it
+void EmitInterpolatorRegisters(OutputWriter& writer, const InterpolatorLayout& layout, const ParsedShader& parsed, const char* indent)
+{
+	for(size_t i = 0; i < layout.Registers.size(); ++i)
 	{
-		if(semantic->find(MAP_PREFIX) == 0)
-		{
-			codeState.InputTextures.insert(*semantic);						
-			continue;
-		}
-		else if(semantic->find(SAMPLER_PREFIX) == 0)
+		const InterpolatorLayout::Register& reg = layout.Registers[i];
+		writer << indent << reg.Type << " ";
+		if(reg.Symbol != NO_SYMBOL)
 		{
-			codeState.InputSamplers.insert(*semantic);
-			continue;
+			writer << parsed.GetSymbol(reg.Symbol).LowerName;
 		}
-				
-		auto regSemantic = semantics.find(*semantic);
-		if(regSemantic == semantics.end())
+		else
 		{
-			m_Error = "Unknown semantic found: ";
-			m_Error.append(semantic->begin(), semantic->end());
-			return ShaderTranslator::UnknownSemantic;
+			writer << PACKED_PREFIX << (unsigned long long)reg.Index;
 		}
-		inputStruct << regSemantic->second.Type << " " << boost::to_lower_copy(regSemantic->second.Name) << " : ";
-
-		switch(codeState.Type)
+		writer << " : " << TEXCOORD_STRING << (unsigned long long)reg.Index << ";";
+		if(reg.Symbol == NO_SYMBOL)
 		{
-		case VertexShader:
-			inputStruct << regSemantic->second.HLSLSemantic	<< semanticCounters[ScratchString(regSemantic->second.HLSLSemantic)]++;
-			break;
-		case PixelShader:
-			inputStruct << TEXCOORD_STRING << semanticCounters[TEXCOORD_STRING]++;
-			break;
+			writer << " //";
+			for(auto location = layout.Locations.cbegin(); location != layout.Locations.cend(); ++location)
+			{
+				if(location->Register == i)
+				{
+					writer << " " << parsed.GetSymbol(location->Semantic).LowerName;
+				}
+			}
 		}
-		inputStruct << ";" << std::endl;
+		writer << "\n";
 	}
-	inputStruct << "};" << std::endl;
-
-	return ShaderTranslator::Ok;
 }
 
-ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ParseShader(std::istream& stream
-																		, ParsingState& state
-																		, const ShaderTranslationParams& params
-																		, const ShaderTranslationUniverse* universe
-																		, TranslatorShaderType type
-																		, std::match_results<ScratchString::const_iterator>& match)
+// Adds the semantics read as "context.name" between begin and end
+void CollectContextReads(const char* begin, const char* end, const FrozenUniverse& frozen, SymbolSet& reads)
 {
-	CodeState codeState;
-	switch(type)
+	static const char CONTEXT_PREFIX[] = "context.";
+	const size_t prefixLength = sizeof(CONTEXT_PREFIX) - 1;
+	for(const char* match = std::search(begin, end, CONTEXT_PREFIX, CONTEXT_PREFIX + prefixLength); match != end; match = std::search(match, end, CONTEXT_PREFIX, CONTEXT_PREFIX + prefixLength))
 	{
-	case VertexShader:
-		codeState.InputName = VS_INPUT_STRING;
-		codeState.OutputName = VS_OUTPUT_STRING;
-		break;
-	case PixelShader:
-		codeState.InputName = PS_INPUT_STRING;
-		break;
-	default:
-		return ShaderTranslator::UnknownShaderType;
-		break;
+		const bool isWhole = match == begin || !(isalnum((unsigned char)match[-1]) || match[-1] == '_');
+		match += prefixLength;
+		const char* nameEnd = match;
+		while(nameEnd != end && (isalnum((unsigned char)*nameEnd) || *nameEnd == '_'))
+		{
+			++nameEnd;
+		}
+		if(isWhole && nameEnd != match)
+		{
+			String name(match, nameEnd);
+			boost::to_upper(name);
+			const SymbolId symbol = frozen.FindSymbol(name);
+			if(symbol != NO_SYMBOL)
+			{
+				reads.Insert(symbol);
+			}
+		}
+		match = nameEnd;
 	}
-	codeState.Type = type;
-	
-	codeState.ShaderSignature.assign(match[1].first, match[1].second);
-
-	const ShaderSemantics& semantics = universe->GetSemantics();
-	auto CheckSemantic = [semantics](const ScratchString& semantic) -> bool { return semantics.find(semantic) != semantics.end(); };
-
-	// Check the needs of the shader itself
-	ScratchString temp(match[7].first, match[7].second);
-	std::vector<ScratchString> shaderNeeds;
-	boost::algorithm::split(shaderNeeds, temp, boost::algorithm::is_any_of(", "), boost::algorithm::token_compress_on);
-	// Remove empties
-	shaderNeeds.erase(std::remove_if(shaderNeeds.begin(), shaderNeeds.end(), [](const ScratchString& str) -> bool { return str.empty(); }), shaderNeeds.end());
+}
 
-	for(auto it = shaderNeeds.cbegin(); it != shaderNeeds.cend(); ++it)
+// Marks the output writes of a vertex shader that the linked pixel shaders don't read and the polymorphic
+// calls whose results nothing else reads any more. Plain code is left to the HLSL compiler.
+void FindUnlinkedRewrites(const ParsedShader& parsed, const ParsedEntryPoint& entryPoint, const ShaderTranslationParams& params, const SymbolSet& linked, CountedVector<bool>& dropped)
+{
+	const FrozenUniverse& frozen = *parsed.Frozen;
+	const CountedVector<ParsedRewrite>& rewrites = entryPoint.Rewrites;
+	dropped.assign(rewrites.size(), false);
+
+	// The atoms of the polymorphic calls that may be dropped - the others report their errors when instantiated
+	CountedVector<unsigned> atoms(rewrites.size(), NO_FUNCTION);
+	// The code outside them and the dropped writes - its reads don't change
+	CountedVector<std::pair<unsigned, unsigned>> removable;
+	for(size_t i = 0; i < rewrites.size(); ++i)
 	{
-		if(it->find(MAP_PREFIX) == 0)
-		{
-			codeState.InputTextures.insert(*it);
-		}
-		else if(it->find(SAMPLER_PREFIX) == 0)
+		const ParsedRewrite& rewrite = rewrites[i];
+		if(rewrite.Type == CT_Output)
 		{
-			codeState.InputSamplers.insert(*it);
+			dropped[i] = rewrite.IsSemantic && rewrite.Name != POSITION_STRING && !linked.Contains(rewrite.Symbol);
 		}
-		else
+		else if(rewrite.Type == CT_Polymorphic && !rewrite.Candidates.empty())
 		{
-			if(!CheckSemantic(*it))
+			auto atom = params.find(rewrite.Name);
+			if(atom == params.end())
 			{
-				m_Error = "Unknown semantic found: ";
-				m_Error.append(it->begin(), it->end());
-				return ShaderTranslator::UnknownSemantic;
+				continue;
 			}
-
-			// If it is already available - skip it
-			if(codeState.AvailableSemantics.find(*it) == codeState.AvailableSemantics.end())
+			auto candidate = std::find_if(rewrite.Candidates.cbegin(), rewrite.Candidates.cend(), [&](unsigned candidate) { return parsed.Polymorphics[candidate].Atom == atom->second; });
+			if(candidate == rewrite.Candidates.cend())
+			{
+				continue;
+			}
+			const unsigned atomId = parsed.Polymorphics[*candidate].AtomId;
+			if(frozen.GetAtom(atomId).ReturnType != NO_SYMBOL)
 			{
-				codeState.InputSemantics.insert(*it);
-				codeState.ContextSemantics.insert(*it);
-				codeState.AvailableSemantics.insert(*it);
+				atoms[i] = atomId;
 			}
 		}
+
+		if(dropped[i] || atoms[i] != NO_FUNCTION)
+		{
+			removable.push_back(std::make_pair(rewrite.Begin, rewrite.End));
+		}
+	}
+
+	const char* body = parsed.Source.GetData() + entryPoint.BodyBegin;
+	SymbolSet codeReads;
+	codeReads.Resize(frozen.GetSymbolCount());
+	std::sort(removable.begin(), removable.end());
+	unsigned position = 0;
+	for(auto span = removable.cbegin(); span != removable.cend(); ++span)
+	{
+		CollectContextReads(body + position, body + std::max(position, span->first), frozen, codeReads);
+		position = std::max(position, span->second);
 	}
+	CollectContextReads(body + position, body + (entryPoint.BodyEnd - entryPoint.BodyBegin), frozen, codeReads);
 
-	// Inner code parsing
-	ScratchString line;
-	size_t startPosition = ScratchString::npos;
-	size_t scopes = 0;
-	size_t lineStart = 0;
-	std::ostringstream leCode;
-	while(!std::getline(stream, line).eof())
+	// Dropping a call may leave the calls it read from unread
+	for(bool changed = true; changed;)
 	{
-		if(startPosition == ScratchString::npos)
+		changed = false;
+		SymbolSet reads = codeReads;
+		for(size_t i = 0; i < atoms.size(); ++i)
 		{
-			startPosition = line.find("{");
-			if(startPosition != ScratchString::npos)
+			if(atoms[i] != NO_FUNCTION && !dropped[i])
 			{
-				++scopes;						
+				const FrozenFunction atom = frozen.GetAtom(atoms[i]);
+				std::for_each(atom.Needs.cbegin(), atom.Needs.cend(), [&](SymbolId need) { reads.Insert(need); });
+				std::for_each(atom.Closure.Semantics.cbegin(), atom.Closure.Semantics.cend(), [&](SymbolId need) { reads.Insert(need); });
 			}
-			lineStart = startPosition + 1;
-			line = line.substr(lineStart).c_str();
 		}
-		else
+		for(size_t i = 0; i < atoms.size(); ++i)
 		{
-			lineStart = 0;
+			if(atoms[i] != NO_FUNCTION && !dropped[i] && !reads.Contains(frozen.GetAtom(atoms[i]).ReturnType))
+			{
+				dropped[i] = true;
+				changed = true;
+			}
 		}
+	}
+}
+}
 
-		FindAndCountBraces(leCode, line, lineStart, scopes);
-		
-		if(!scopes) break;
-		leCode << std::endl;
+OutputWriter::OutputWriter(ShaderOutputSink& sink)
+	: m_Sink(sink)
+	, m_Size(0)
+	, m_Written(0)
+{}
+
+void OutputWriter::Write(const char* data, size_t size)
+{
+	if(m_Size + size > BUFFER_SIZE)
+	{
+		Flush();
+		// Large pieces like the verbatim parts of the source go straight through
+		if(size > BUFFER_SIZE)
+		{
+			m_Sink.Write(data, size);
+			m_Written += size;
+			return;
+		}
 	}
+	memcpy(m_Buffer + m_Size, data, size);
+	m_Size += size;
+}
 
-	if (scopes != 0)
+void OutputWriter::Flush()
+{
+	if(m_Size)
 	{
-		m_Error = "Unexpected end of file";
-		return ShaderTranslator::UnexpectedEOF;
+		m_Sink.Write(m_Buffer, m_Size);
+		m_Written += m_Size;
+		m_Size = 0;
 	}
+}
+
+unsigned long long OutputWriter::GetWritten() const
+{
+	return m_Written;
+}
+
+OutputWriter& OutputWriter::operator<<(const char* str)
+{
+	Write(str, strlen(str));
+	return *this;
+}
+
+OutputWriter& OutputWriter::operator<<(const String& str)
+{
+	Write(str.data(), str.size());
+	return *this;
+}
 
-	ScratchString shaderCode = leCode.str().c_str();
+OutputWriter& OutputWriter::operator<<(const FrozenString& str)
+{
+	Write(str.data(), str.size());
+	return *this;
+}
 
-	enum CurrentTranslation
+OutputWriter& OutputWriter::operator<<(unsigned long long number)
+{
+	char digits[24];
+	char* end = digits + sizeof(digits);
+	char* begin = end;
+	do
 	{
-		CT_Polymorphic = 0,
-		CT_Output,
-		CT_ContextIf,
-		CT_ContextIfNot,
-		CT_None
-	};
-	
-	static const std::regex codeTranslations[] = 
+		*--begin = char('0' + number % 10);
+		number /= 10;
+	} while(number);
+	Write(begin, end - begin);
+	return *this;
+}
+
+ShaderTranslatorImpl::ShaderTranslatorImpl()
+	: m_Stats(nullptr)
+	, m_Dependencies(nullptr)
+	, m_Tracer(nullptr)
+	, m_PackInterpolators(false)
+	, m_LinkStages(false)
+	, m_BindingLayout(nullptr)
+	, m_ParallelEntryPoints(false)
+	, m_ThreadPool(nullptr)
+	, m_DiskCache(nullptr)
+{}
+
+void ShaderTranslatorImpl::SetTracePermutation(const ShaderTranslationParams& params, int index)
+{
+	m_Permutation.Key = m_Tracer ? HashParams(params) : 0;
+	m_Permutation.Index = index;
+}
+
+ShaderTranslatorImpl::StatsScope::StatsScope(ShaderTranslatorImpl& translator, TranslationStats* stats, TranslationContext& context)
+	: m_Translator(translator)
+	, m_Previous(translator.m_Stats)
+	, m_Context(context)
+	, m_ChunkAllocations(context.GetChunkAllocations())
+	, m_HeapAllocations(stats ? &stats->HeapAllocations : nullptr)
+{
+	if(stats)
 	{
-		std::regex("(\\n+)\\s+context\\.(\\w+)\\s+=\\s+(\\w+)\\(\\);"),
-		std::regex("(\\n+)\\s+output\\.(\\w+)\\s+=.*"),
-		std::regex("(\\s+)CONTEXT_IF\\(context\\.(\\w+)\\)( )*\\{"),
-		std::regex("(\\s+)CONTEXT_IFNOT\\(context\\.(\\w+)\\)( )*\\{")
-	};
+		*stats = TranslationStats();
+	}
+	m_Translator.m_Stats = stats;
+}
 
-	ScratchString::const_iterator start, end;
-	start = shaderCode.begin();
-	end = shaderCode.end();
-	bool contextIf = false;
-	while(start != shaderCode.end())
+ShaderTranslatorImpl::StatsScope::~StatsScope()
+{
+	TranslationStats* stats = m_Translator.m_Stats;
+	if(stats && !stats->CacheHit)
 	{
-		std::match_results<ScratchString::const_iterator> match;
-		std::match_results<ScratchString::const_iterator> trymatch;
+		// Added to the chunks the entry points took in the memory of the workers
+		stats->ArenaChunkAllocations += m_Context.GetChunkAllocations() - m_ChunkAllocations;
+		stats->ArenaHighWaterMark = m_Context.GetPeakSinceReset();
+	}
+	m_Translator.m_Stats = m_Previous;
+}
 
-		CurrentTranslation currentTranslation = CT_None;
-		// Search for all the code that needs translation
-		for(int translationIdx = 0; translationIdx < CT_None; ++translationIdx)
-		{
-			bool available = std::regex_search(start, end, trymatch, codeTranslations[translationIdx]);
+ShaderTranslatorImpl::DependenciesScope::DependenciesScope(ShaderTranslatorImpl& translator, TranslationDependencies* dependencies)
+	: m_Translator(translator)
+	, m_Previous(translator.m_Dependencies)
+{
+	if(dependencies)
+	{
+		dependencies->Clear();
+	}
+	m_Translator.m_Dependencies = dependencies;
+}
 
-			if(available && (match.empty() || (trymatch[0].first < match[0].first)))
-			{
-				match = trymatch;
-				currentTranslation = (CurrentTranslation)translationIdx;
-			}
-		}
+ShaderTranslatorImpl::DependenciesScope::~DependenciesScope()
+{
+	m_Translator.m_Dependencies = m_Previous;
+}
+
+const std::string& ShaderTranslatorImpl::GetError()
+{
+	return m_Error;
+}
 
-		contextIf = false;
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ExpandFunction(const FrozenFunction& function, CodeState& state, const FrozenUniverse& frozen, ScratchString& output)
+{
+	TraceScope trace(m_Tracer, "ExpandFunction", m_Permutation);
 
-		switch(currentTranslation)
+	// The steps are the needs resolved in advance - only what's already available changes the walk.
+	// Entering a combinator walks its steps and returns to the step after the one that entered it.
+	std::vector<unsigned, StdAllocator<unsigned>> returns((StdAllocator<unsigned>(TranslationContext::GetCurrent())));
+	for(unsigned index = function.ExpansionBegin;;)
+	{
+		const ExpansionStep& step = frozen.GetExpansionStep(index);
+		switch(step.Type)
 		{
-		case CT_ContextIf:
-			contextIf = true;
-		case CT_ContextIfNot:
+		case ExpansionStep::RequireInput:
+			if(!state.AvailableSemantics.Contains(step.Symbol))
 			{
-				codeState.InnerSource.append(start, match[1].second);
-				// if there is such a value in the context - expand the code - otherwise remove it
-				ScratchString valueRequired(match[2].first, match[2].second);
-				boost::to_upper(valueRequired);
-				// find the closing brace
-				auto braceFind = match[0].second;
-				int ifScopes = 1;
-				while(braceFind != end && ifScopes)
+				const FrozenSymbol symbol = frozen.GetSymbol(step.Symbol);
+				// Adding a combinator for the input would change the expansion
+				if(m_Dependencies)
 				{
-					++braceFind;
-					if(*braceFind == '{')
-					{
-						++ifScopes;
-					}
-					else if(*braceFind == '}')
-					{
-						--ifScopes;
-					}
+					m_Dependencies->Combinators.LookedUp.insert(String(symbol.Name.begin(), symbol.Name.end()));
 				}
-				if(ifScopes)
+
+				if(symbol.IsTexture)
 				{
-					m_Error = "Unable to find closing brace for CONTEXT_IF statement on value ";
-					m_Error.append(valueRequired.begin(), valueRequired.end());
-					return ShaderTranslator::ContextIfNoEndBrace;
+					state.InputTextures.Insert(step.Symbol);
 				}
-
-				const bool isSemanticAvailable = codeState.AvailableSemantics.find(valueRequired) != codeState.AvailableSemantics.end();
-				
-				if((contextIf && isSemanticAvailable) || (!contextIf && !isSemanticAvailable))
+				else if(symbol.IsSampler)
 				{
-					// inject the code in the parsed source and NOT in the ready one to allow recursive ifs and nested polymorphics
-					const size_t ifIdx = match[0].first - shaderCode.begin(); 
-					shaderCode.erase(match[0].first, match[0].second);
-					ScratchString exp;
-					exp.append("{ // conditional if on semantic ");
-					exp.append(valueRequired);
-					shaderCode.insert(ifIdx, exp);
-
-					start = shaderCode.begin() + ifIdx;
-					end = shaderCode.end();
+					state.InputSamplers.Insert(step.Symbol);
 				}
 				else
 				{
-					start = braceFind + 1; // +1 is for the closing brace - we don't want it
+					state.InputSemantics.Insert(step.Symbol);
+					state.ContextSemantics.Insert(step.Symbol);
+					state.AvailableSemantics.Insert(step.Symbol);
 				}
 			}
-		break;
-		case CT_Output:
+			++index;
+			break;
+		case ExpansionStep::EnterCombinator:
+			if(state.AvailableSemantics.Contains(step.Symbol))
 			{
-				codeState.InnerSource.append(start, match[1].second);
-				
-				ScratchString semanticName(match[2].first, match[2].second);
-				boost::to_upper(semanticName);
-
-				if(codeState.Type == VertexShader && CheckSemantic(semanticName))
+				++index;
+			}
+			else
+			{
+				returns.push_back(index + 1);
+				index = frozen.GetExpansionBegin(step.Function);
+			}
+			break;
+		case ExpansionStep::EmitFunction:
+			if(step.Function != function.Index)
+			{
+				const FrozenFunction combinator = frozen.GetFunction(step.Function);
+				if(m_Stats)
 				{
-					codeState.OutputSemantics.insert(semanticName);
+					++m_Stats->CombinatorsExpanded;
 				}
-
-				codeState.InnerSource.append(match[0].first, match[0].second);
-				start = match[0].second;
+				if(m_Dependencies)
+				{
+					m_Dependencies->Combinators.Used.insert(String(combinator.ReturnTypeName.begin(), combinator.ReturnTypeName.end()));
+				}
+				EmitFunction(combinator, state, output);
 			}
-		break;
-		case CT_Polymorphic:
+			else
 			{
-				codeState.InnerSource.append(start, match[1].second);
-
-				// Add code
-				ScratchString functionName(match[3].first, match[3].second);
-				// Check if it is a valid polymorphic
-				auto polymorphicLower = state.Functions.lower_bound(functionName);
-				if(polymorphicLower != state.Functions.end() && polymorphicLower->first == functionName)
-				{
-					// Select the proper atom
-					auto atom = params.find(functionName);
-					if(atom == params.end())
-					{
-						m_Error = "Missing binding parameter for polymorphic ";
-						m_Error.append(functionName.begin(), functionName.end());
-						return ShaderTranslator::MissingBindingParameter;
-					}
+				EmitFunction(function, state, output);
+			}
+			if(returns.empty())
+			{
+				return ShaderTranslator::Ok;
+			}
+			index = returns.back();
+			returns.pop_back();
+			break;
+		}
+	}
+}
 
-					auto polymorphicUpper = state.Functions.upper_bound(functionName);
-					// Check if such a binding function exists
-					if(std::find_if(polymorphicLower, polymorphicUpper, [&atom](Polymorphics::value_type it) -> bool { return it.second == atom->second; } ) == state.Functions.end())
-					{
-						m_Error = "Undeclared binding parameter used for polymorphic ";
-						m_Error.append(functionName.c_str());
-						return ShaderTranslator::UndeclaredParam;
+void ShaderTranslatorImpl::EmitFunction(const FrozenFunction& function, CodeState& state, ScratchString& output)
+{
+	if(function.ReturnType != NO_SYMBOL)
+	{
+		state.ContextSemantics.Insert(function.ReturnType);
+		state.AvailableSemantics.Insert(function.ReturnType);
+	}
+	
+	output.append("\n{ // ");
+	output.append(function.Name.begin(), function.Name.end());
+
+	const FrozenString& source = function.Source;
+	size_t position = 0;
+	for(auto statement = function.Returns.cbegin(); statement != function.Returns.cend(); ++statement)
+	{
+		output.append(source.data() + position, source.data() + statement->Begin);
+		output.append("context.");
+		output.append(function.LowerReturnType.begin(), function.LowerReturnType.end());
+		output.append(" = ");
+		output.append(source.data() + statement->ExpressionBegin, source.data() + statement->ExpressionEnd);
+		output.append(";");
+		position = statement->End;
+	}
+	output.append(source.data() + position, source.data() + source.size());
+	output.append("}\n");
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::PrepareShaderInput(CodeState& codeState, const ParsedShader& parsed)
+{
+	TraceScope trace(m_Tracer, "PrepareShaderInput", m_Permutation);
+
+	for(SymbolId semantic = codeState.InputSemantics.First(); semantic != NO_SYMBOL; semantic = codeState.InputSemantics.Next(semantic))
+	{
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		if(symbol.IsTexture)
+		{
+			codeState.InputTextures.Insert(semantic);
+			continue;
+		}
+		else if(symbol.IsSampler)
+		{
+			codeState.InputSamplers.Insert(semantic);
+			continue;
+		}
+				
+		if(!symbol.IsSemantic)
+		{
+			m_Error = "Unknown semantic found: ";
+			m_Error.append(symbol.Name.begin(), symbol.Name.end());
+			return ShaderTranslator::UnknownSemantic;
+		}
+	}
+
+	for(SymbolId semantic = codeState.ContextSemantics.First(); semantic != NO_SYMBOL; semantic = codeState.ContextSemantics.Next(semantic))
+	{
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		if(!symbol.IsSemantic)
+		{
+			m_Error = "Unknown semantic found: ";
+			m_Error.append(symbol.Name.begin(), symbol.Name.end());
+			return ShaderTranslator::UnknownSemantic;
+		}
+	}
+
+	return ShaderTranslator::Ok;
+}
+
+void ShaderTranslatorImpl::RecordOutputWrite(CodeState& codeState, const char* body, const ParsedRewrite& rewrite)
+{
+	// The rewrite is pasted from its Begin - the write starts after the whitespace that follows the prefix
+	const char* write = body + rewrite.PrefixEnd;
+	while(write < body + rewrite.End && isspace((unsigned char)*write))
+	{
+		++write;
+	}
+
+	const size_t prefixLength = strlen(OUTPUT_PREFIX);
+	if(strncmp(write, OUTPUT_PREFIX, prefixLength) != 0)
+	{
+		return;
+	}
+	const OutputWrite output = { codeState.InnerSource.size() + (write - (body + rewrite.Begin)), prefixLength + rewrite.Name.size(), rewrite.Symbol };
+	codeState.OutputWrites.push_back(output);
+}
+
+void ShaderTranslatorImpl::RecordDependencies(const CodeState& codeState, const ParsedShader& parsed)
+{
+	auto recordSemantics = [&](const SymbolSet& symbols)
+	{
+		for(SymbolId semantic = symbols.First(); semantic != NO_SYMBOL; semantic = symbols.Next(semantic))
+		{
+			const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+			if(!symbol.IsTexture && !symbol.IsSampler)
+			{
+				m_Dependencies->Semantics.Used.insert(String(symbol.Name.begin(), symbol.Name.end()));
+			}
+		}
+	};
+	recordSemantics(codeState.InputSemantics);
+	recordSemantics(codeState.ContextSemantics);
+	recordSemantics(codeState.OutputSemantics);
+
+	for(SymbolId texture = codeState.InputTextures.First(); texture != NO_SYMBOL; texture = codeState.InputTextures.Next(texture))
+	{
+		const FrozenString name = parsed.GetSymbol(texture).Name;
+		m_Dependencies->Textures.insert(String(name.begin(), name.end()));
+	}
+	for(SymbolId sampler = codeState.InputSamplers.First(); sampler != NO_SYMBOL; sampler = codeState.InputSamplers.Next(sampler))
+	{
+		const FrozenString name = parsed.GetSymbol(sampler).Name;
+		m_Dependencies->Samplers.insert(String(name.begin(), name.end()));
+	}
+}
+
+void ShaderTranslatorImpl::EmitShaderInput(OutputWriter& writer, const CodeState& codeState, const ParsedShader& parsed, const InterpolatorLayout* packed, const InterpolatorLayout* texcoords)
+{
+	TraceScope trace(m_Tracer, "EmitShaderInput", m_Permutation);
+
+	writer << "struct " << codeState.InputName << " { \n";
+	
+	switch(codeState.Type)
+	{
+	case VertexShader:
+		writer << VS_POSITION << "\n";
+		break;
+	case PixelShader:
+		writer << PS_POSITION << "\n";
+		break;
+	}
+
+	if(packed)
+	{
+		EmitInterpolatorRegisters(writer, *packed, parsed, "");
+		writer << "};\n";
+		return;
+	}
+
+	CountedVector<unsigned> semanticCounters(parsed.Frozen->GetHLSLSemanticCount());
+	unsigned texcoordCounter = 0;
+	for(SymbolId semantic = codeState.InputSemantics.First(); semantic != NO_SYMBOL; semantic = codeState.InputSemantics.Next(semantic))
+	{
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		if(symbol.IsTexture || symbol.IsSampler)
+		{
+			continue;
+		}
+				
+		writer << symbol.Type << " " << symbol.LowerName << " : ";
+
+		switch(codeState.Type)
+		{
+		case VertexShader:
+			writer << symbol.HLSLSemantic << semanticCounters[symbol.HLSLSemanticIndex]++;
+			break;
+		case PixelShader:
+			writer << TEXCOORD_STRING << GetTexcoord(texcoords, semantic, texcoordCounter);
+			break;
+		}
+		writer << ";\n";
+	}
+	writer << "};\n";
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::InstantiateEntryPoint(const ParsedShader& parsed
+																					, const ParsedEntryPoint& entryPoint
+																					, const ShaderTranslationParams& params
+																					, const SymbolSet* linked
+																					, CodeState& codeState)
+{
+	const FrozenUniverse& frozen = *parsed.Frozen;
+	codeState.ResizeSymbols(parsed.GetSymbolCount());
+
+	CountedVector<bool> dropped;
+	if(linked && entryPoint.Type == VertexShader)
+	{
+		FindUnlinkedRewrites(parsed, entryPoint, params, *linked, dropped);
+	}
+
+	switch(entryPoint.Type)
+	{
+	case VertexShader:
+		codeState.InputName = VS_INPUT_STRING;
+		codeState.OutputName = VS_OUTPUT_STRING;
+		break;
+	case PixelShader:
+		codeState.InputName = PS_INPUT_STRING;
+		break;
+	default:
+		return ShaderTranslator::UnknownShaderType;
+		break;
+	}
+	codeState.Type = entryPoint.Type;
+	
+	codeState.ShaderSignature.assign(entryPoint.Signature.begin(), entryPoint.Signature.end());
+
+	// The needs of the shader itself - validated while parsing
+	for(auto it = entryPoint.Needs.cbegin(); it != entryPoint.Needs.cend(); ++it)
+	{
+		const SymbolId need = *it;
+		const FrozenSymbol& symbol = parsed.GetSymbol(need);
+		if(symbol.IsTexture)
+		{
+			codeState.InputTextures.Insert(need);
+		}
+		else if(symbol.IsSampler)
+		{
+			codeState.InputSamplers.Insert(need);
+		}
+		// If it is already available - skip it
+		else if(!codeState.AvailableSemantics.Contains(need))
+		{
+			codeState.InputSemantics.Insert(need);
+			codeState.ContextSemantics.Insert(need);
+			codeState.AvailableSemantics.Insert(need);
+		}
+	}
+
+	// Walk the rewrite points of the body
+	const char* body = parsed.Source.GetData() + entryPoint.BodyBegin;
+	const unsigned size = entryPoint.BodyEnd - entryPoint.BodyBegin;
+	unsigned position = 0;
+	for(unsigned index = entryPoint.FirstRewrite; index != NO_REWRITE;)
+	{
+		const ParsedRewrite& rewrite = entryPoint.Rewrites[index];
+		codeState.InnerSource.append(body + position, body + rewrite.PrefixEnd);
+
+		switch(rewrite.Type)
+		{
+		case CT_ContextIf:
+		case CT_ContextIfNot:
+			{
+				if(!rewrite.HasClosingBrace)
+				{
+					m_Error = "Unable to find closing brace for CONTEXT_IF statement on value ";
+					m_Error.append(rewrite.Name.begin(), rewrite.Name.end());
+					return ShaderTranslator::ContextIfNoEndBrace;
+				}
+
+				if(m_Stats)
+				{
+					++m_Stats->ContextIfsResolved;
+				}
+
+				// if there is such a value in the context - expand the code - otherwise remove it
+				const bool isSemanticAvailable = codeState.AvailableSemantics.Contains(rewrite.Symbol);
+				const bool contextIf = rewrite.Type == CT_ContextIf;
+				
+				if((contextIf && isSemanticAvailable) || (!contextIf && !isSemanticAvailable))
+				{
+					// keep scanning inside the block to allow recursive ifs and nested polymorphics
+					codeState.InnerSource.append("{ // conditional if on semantic ");
+					codeState.InnerSource.append(rewrite.Name.begin(), rewrite.Name.end());
+					position = rewrite.End;
+					index = rewrite.Next;
+				}
+				else
+				{
+					position = rewrite.SkipTo;
+					index = rewrite.SkipNext;
+				}
+			}
+		break;
+		case CT_Output:
+			{
+				// Nothing reads it - the whole line goes
+				if(!dropped.empty() && dropped[index])
+				{
+					position = rewrite.End;
+					index = rewrite.Next;
+					break;
+				}
+
+				if(codeState.Type == VertexShader)
+				{
+					if(rewrite.IsSemantic)
+					{
+						codeState.OutputSemantics.Insert(rewrite.Symbol);
+						if(m_PackInterpolators)
+						{
+							RecordOutputWrite(codeState, body, rewrite);
+						}
+					}
+					// Only known semantics are part of the output struct
+					else if(m_Dependencies)
+					{
+						m_Dependencies->Semantics.LookedUp.insert(rewrite.Name);
 					}
+				}
 
-					const auto& atoms = universe->GetAtoms();
-					auto atomDefinition = atoms.find(atom->second);
+				codeState.InnerSource.append(body + rewrite.Begin, body + rewrite.End);
+				position = rewrite.End;
+				index = rewrite.Next;
+			}
+		break;
+		case CT_Polymorphic:
+			{
+				// Check if it is a valid polymorphic
+				if(!rewrite.Candidates.empty())
+				{
+					// Select the proper atom
+					auto atom = params.find(rewrite.Name);
+					if(atom == params.end())
+					{
+						m_Error = "Missing binding parameter for polymorphic ";
+						m_Error.append(rewrite.Name.begin(), rewrite.Name.end());
+						return ShaderTranslator::MissingBindingParameter;
+					}
+
+					// Check if such a binding function exists
+					auto candidate = std::find_if(rewrite.Candidates.cbegin(), rewrite.Candidates.cend(), [&](unsigned candidate) -> bool { return parsed.Polymorphics[candidate].Atom == atom->second; } );
+					if(candidate == rewrite.Candidates.cend())
+					{
+						m_Error = "Undeclared binding parameter used for polymorphic ";
+						m_Error.append(rewrite.Name.c_str());
+						return ShaderTranslator::UndeclaredParam;
+					}
+
+					// An edit of a dropped atom may make it needed again
+					if(m_Dependencies)
+					{
+						m_Dependencies->Bindings.insert(*atom);
+						m_Dependencies->Atoms.Used.insert(atom->second);
+					}
+
+					if(!dropped.empty() && dropped[index])
+					{
+						position = rewrite.End;
+						index = rewrite.Next;
+						break;
+					}
 
 					ScratchString expandedAtom;
-					ShaderTranslator::ShaderTranslatorError err = ExpandFunction(atomDefinition->second, codeState, universe, expandedAtom);
+					if(m_Stats)
+					{
+						++m_Stats->AtomsExpanded;
+					}
+					ShaderTranslator::ShaderTranslatorError err = ExpandFunction(frozen.GetAtom(parsed.Polymorphics[*candidate].AtomId), codeState, frozen, expandedAtom);
 					if(err != ShaderTranslator::Ok)
 					{
 						return err;
 					}
 
-					codeState.InnerSource.append(expandedAtom);
+					codeState.InnerSource.append(expandedAtom);
+				}
+				// Not a polymorphic - paste the code as is
+				else
+				{
+					codeState.InnerSource.append(body + rewrite.Begin, body + rewrite.End);
+				}
+
+				position = rewrite.End;
+				index = rewrite.Next;
+			}
+		break;
+		default:
+		break;
+		}
+	}
+	codeState.InnerSource.append(body + position, body + size);
+
+	ShaderTranslator::ShaderTranslatorError err = PrepareShaderInput(codeState, parsed);
+	if(err == ShaderTranslator::Ok && m_Dependencies)
+	{
+		RecordDependencies(codeState, parsed);
+	}
+	return err;
+}
+
+namespace
+{
+// Symbols local to the shader are numbered after the ones of the universe,
+// so only when there are such the IDs can be out of the order of the names
+template<typename Function>
+void ForEachByName(const SymbolSet& symbols, const ParsedShader& parsed, Function function)
+{
+	if(parsed.LocalSymbols.empty())
+	{
+		for(SymbolId symbol = symbols.First(); symbol != NO_SYMBOL; symbol = symbols.Next(symbol))
+		{
+			function(parsed.GetSymbol(symbol));
+		}
+		return;
+	}
+
+	CountedVector<FrozenSymbol> sorted;
+	sorted.reserve(symbols.Count());
+	for(SymbolId symbol = symbols.First(); symbol != NO_SYMBOL; symbol = symbols.Next(symbol))
+	{
+		sorted.push_back(parsed.GetSymbol(symbol));
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const FrozenSymbol& lhs, const FrozenSymbol& rhs) { return lhs.Name < rhs.Name; });
+	for(auto symbol = sorted.cbegin(); symbol != sorted.cend(); ++symbol)
+	{
+		function(*symbol);
+	}
+}
+}
+
+void ShaderTranslatorImpl::EmitResources(OutputWriter& writer, const SymbolSet& textures, const SymbolSet& samplers, const ParsedShader& parsed)
+{
+	// Without a layout the registers are numbered from zero
+	unsigned textureCount = m_BindingLayout ? m_BindingLayout->GetTextureCount() : 0;
+	unsigned samplerCount = m_BindingLayout ? m_BindingLayout->GetSamplerCount() : 0;
+
+	writer << "//texture inputs \n";
+	ForEachByName(textures, parsed, [&](const FrozenSymbol& symbol)
+	{
+		unsigned slot = 0;
+		if(!m_BindingLayout || !m_BindingLayout->FindTexture(ScratchString(symbol.Name.begin(), symbol.Name.end()), slot))
+		{
+			slot = textureCount++;
+		}
+		writer << "Texture2D " << symbol.LowerName << " : register(t" << (unsigned long long)slot << ");\n";
+	});
+
+	writer << "//sampler inputs \n";
+	ForEachByName(samplers, parsed, [&](const FrozenSymbol& symbol)
+	{
+		unsigned slot = 0;
+		if(!m_BindingLayout || !m_BindingLayout->FindSampler(ScratchString(symbol.Name.begin(), symbol.Name.end()), slot))
+		{
+			slot = samplerCount++;
+		}
+		writer << "SamplerState " << symbol.LowerName << " : register(s" << (unsigned long long)slot << ");\n";
+	});
+}
+
+void ShaderTranslatorImpl::EmitEntryPoint(OutputWriter& writer, const CodeState& codeState, const ParsedShader& parsed, const InterpolatorLayout* linked)
+{
+	StageTimer timer(m_Stats, &TranslationStats::StructEmissionTime);
+	// With a layout the resources of the whole file are declared once
+	if(!m_BindingLayout)
+	{
+		EmitResources(writer, codeState.InputTextures, codeState.InputSamplers, parsed);
+	}
+
+	// The vertex shader packs its outputs, the pixel shader unpacks its inputs.
+	// Linked stages share the layout of the file instead of making their own.
+	InterpolatorLayout own;
+	const InterpolatorLayout& layout = linked ? *linked : own;
+	if(m_PackInterpolators && !linked)
+	{
+		BuildInterpolatorLayout(codeState.Type == VertexShader ? codeState.OutputSemantics : codeState.InputSemantics, parsed, own);
+	}
+	const bool packedInput = m_PackInterpolators && codeState.Type == PixelShader;
+	const bool packedOutput = m_PackInterpolators && codeState.Type == VertexShader;
+	const InterpolatorLayout* texcoords = m_PackInterpolators ? nullptr : linked;
+
+	writer << "//input \n";
+	EmitShaderInput(writer, codeState, parsed, packedInput ? &layout : nullptr, texcoords);
+	writer << "\n";
+
+	if(!codeState.OutputSemantics.Empty())
+	{
+		writer << "//output \n";
+		if(codeState.Type == VertexShader)
+		{
+			writer << "\n\tstruct " << codeState.OutputName << "{\n";
+			writer << "\t\t " << PS_POSITION << " \n";
+		
+			if(packedOutput)
+			{
+				EmitInterpolatorRegisters(writer, layout, parsed, "\t\t");
+			}
+			unsigned counter = 0;
+			for(SymbolId semantic = packedOutput ? NO_SYMBOL : codeState.OutputSemantics.First(); semantic != NO_SYMBOL; semantic = codeState.OutputSemantics.Next(semantic))
+			{
+				const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+				if(symbol.Name != POSITION_STRING)
+				{
+					writer << "\t\t" << symbol.Type << " " << symbol.LowerName << " : TEXCOORD" << GetTexcoord(texcoords, semantic, counter) << ";\n";
+				}
+			}
+
+			writer << "};\n";
+		}
+		writer << "\n";
+	}
+
+	timer.Switch(&TranslationStats::AssemblyTime);
+	writer << codeState.ShaderSignature << "\n{\n";
+
+	timer.Switch(&TranslationStats::StructEmissionTime);
+	writer << "\n\tstruct {\n";
+	for(SymbolId semantic = codeState.ContextSemantics.First(); semantic != NO_SYMBOL; semantic = codeState.ContextSemantics.Next(semantic))
+	{
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		writer << "\t\t" << symbol.Type << " " << symbol.LowerName << ";\n";
+	}
+	writer << "\t} context;\n";
+
+	writer << "\n\t//context population \n";
+	for(SymbolId semantic = codeState.InputSemantics.First(); semantic != NO_SYMBOL; semantic = codeState.InputSemantics.Next(semantic))
+	{
+		const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+		const InterpolatorLayout::Location* location = packedInput ? layout.Find(semantic) : nullptr;
+		writer << "\tcontext." << symbol.LowerName << " = input.";
+		if(location)
+		{
+			layout.WriteMember(writer, *location, symbol);
+		}
+		else
+		{
+			writer << symbol.LowerName;
+		}
+		writer << ";\n";
+	}
+	writer << "\n";
+
+	timer.Switch(&TranslationStats::AssemblyTime);
+	if(packedOutput)
+	{
+		// Point the output writes at the members of the packed vectors
+		const ScratchString& source = codeState.InnerSource;
+		size_t position = 0;
+		for(auto write = codeState.OutputWrites.cbegin(); write != codeState.OutputWrites.cend(); ++write)
+		{
+			const InterpolatorLayout::Location* location = layout.Find(write->Semantic);
+			if(!location)
+			{
+				continue;
+			}
+			writer.Write(source.data() + position, write->Offset - position);
+			writer << OUTPUT_PREFIX;
+			layout.WriteMember(writer, *location, parsed.GetSymbol(write->Semantic));
+			position = write->Offset + write->Length;
+		}
+		writer.Write(source.data() + position, source.size() - position);
+		writer << "}\n";
+	}
+	else
+	{
+		writer << codeState.InnerSource << "}\n";
+	}
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::ResolveEntryPoints(const ParsedShader& parsed
+																			, const ShaderTranslationParams& params
+																			, const CountedVector<int>& entryPoints
+																			, const SymbolSet* linked
+																			, CountedVector<std::unique_ptr<CodeState>>& states)
+{
+	// Recording writes to one set of dependencies - it stays on this thread
+	if(!m_ParallelEntryPoints || m_Dependencies || entryPoints.size() < 2 || GetThreadPool().GetWorkerCount() < 2)
+	{
+		for(auto entryPoint = entryPoints.cbegin(); entryPoint != entryPoints.cend(); ++entryPoint)
+		{
+			StageTimer timer(m_Stats, &TranslationStats::ExpansionTime);
+			HeapAllocationCounter::Count();
+			states[*entryPoint].reset(new CodeState);
+			ShaderTranslator::ShaderTranslatorError err = InstantiateEntryPoint(parsed, parsed.EntryPoints[*entryPoint], params, linked, *states[*entryPoint]);
+			if(err != ShaderTranslator::Ok)
+			{
+				return err;
+			}
+		}
+		return ShaderTranslator::Ok;
+	}
+
+	TranslationThreadPool& pool = GetThreadPool();
+	const unsigned workers = pool.GetWorkerCount();
+	while(m_EntryPointContexts.size() < workers)
+	{
+		m_EntryPointContexts.emplace_back(new TranslationContext);
+	}
+	unsigned long long chunkAllocations = 0;
+	for(unsigned worker = 0; worker < workers; ++worker)
+	{
+		chunkAllocations += m_EntryPointContexts[worker]->GetChunkAllocations();
+	}
+
+	struct Resolved
+	{
+		ShaderTranslator::ShaderTranslatorError Error;
+		std::string ErrorMessage;
+		TranslationStats Stats;
+	};
+	CountedVector<Resolved> resolved(entryPoints.size());
+	{
+		StageTimer timer(m_Stats, &TranslationStats::ExpansionTime);
+		pool.ParallelFor(unsigned(entryPoints.size()), [&](unsigned index, unsigned worker)
+		{
+			// The state is created in the memory of the worker, as are all its strings
+			TranslationContext::Scope scope(*m_EntryPointContexts[worker]);
+			Resolved& result = resolved[index];
+			result.Stats = TranslationStats();
+			HeapAllocationCounter heapAllocations(m_Stats ? &result.Stats.HeapAllocations : nullptr);
+			ShaderTranslatorImpl translator;
+			translator.m_Stats = m_Stats ? &result.Stats : nullptr;
+			translator.m_Tracer = m_Tracer;
+			translator.m_Permutation = m_Permutation;
+			translator.m_PackInterpolators = m_PackInterpolators;
+			translator.m_LinkStages = m_LinkStages;
+			translator.m_BindingLayout = m_BindingLayout;
+
+			const int entryPoint = entryPoints[index];
+			HeapAllocationCounter::Count();
+			states[entryPoint].reset(new CodeState);
+			result.Error = translator.InstantiateEntryPoint(parsed, parsed.EntryPoints[entryPoint], params, linked, *states[entryPoint]);
+			if(result.Error != ShaderTranslator::Ok)
+			{
+				result.ErrorMessage = translator.GetError();
+			}
+		});
+	}
+
+	if(m_Stats)
+	{
+		for(unsigned worker = 0; worker < workers; ++worker)
+		{
+			m_Stats->ArenaChunkAllocations += m_EntryPointContexts[worker]->GetChunkAllocations();
+		}
+		m_Stats->ArenaChunkAllocations -= chunkAllocations;
+		// All of the entry points ran, even after one that failed
+		for(auto result = resolved.cbegin(); result != resolved.cend(); ++result)
+		{
+			m_Stats->HeapAllocations += result->Stats.HeapAllocations;
+		}
+	}
+
+	// Counted as if they went one after another - up to the first that failed
+	for(auto result = resolved.cbegin(); result != resolved.cend(); ++result)
+	{
+		if(m_Stats)
+		{
+			m_Stats->AtomsExpanded += result->Stats.AtomsExpanded;
+			m_Stats->CombinatorsExpanded += result->Stats.CombinatorsExpanded;
+			m_Stats->ContextIfsResolved += result->Stats.ContextIfsResolved;
+		}
+		if(result->Error != ShaderTranslator::Ok)
+		{
+			m_Error = result->ErrorMessage;
+			return result->Error;
+		}
+	}
+	return ShaderTranslator::Ok;
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::InstantiateShader(const ParsedShader& parsed
+																			, const ShaderTranslationParams& params
+																			, ShaderOutputSink& sink)
+{
+	// Parsing checked that every atom of the polymorphic declarations exists
+	if(m_Dependencies)
+	{
+		for(auto polymorphic = parsed.Polymorphics.cbegin(); polymorphic != parsed.Polymorphics.cend(); ++polymorphic)
+		{
+			m_Dependencies->Atoms.LookedUp.insert(polymorphic->Atom);
+		}
+	}
+
+	const auto hasType = [&](TranslatorShaderType type) { return std::any_of(parsed.EntryPoints.cbegin(), parsed.EntryPoints.cend(), [type](const ParsedEntryPoint& entryPoint) { return entryPoint.Type == type; }); };
+	const bool link = m_LinkStages && hasType(VertexShader) && hasType(PixelShader);
+
+	// Resolve all entry points first so that nothing is written if any of them fails.
+	// When linking the pixel shaders go first - the vertex shaders only write what they read.
+	CountedVector<std::unique_ptr<CodeState>> states(parsed.EntryPoints.size());
+	SymbolSet linked;
+	CountedVector<int> entryPoints;
+	// The states of the pixel shaders are still needed while the vertex shaders are resolved
+	for(auto context = m_EntryPointContexts.begin(); context != m_EntryPointContexts.end(); ++context)
+	{
+		(*context)->Reset();
+	}
+	for(int pass = link ? 0 : 1; pass < 2; ++pass)
+	{
+		entryPoints.clear();
+		for(auto segment = parsed.Segments.cbegin(); segment != parsed.Segments.cend(); ++segment)
+		{
+			if(segment->EntryPoint >= 0 && (!link || (parsed.EntryPoints[segment->EntryPoint].Type == PixelShader) == (pass == 0)))
+			{
+				entryPoints.push_back(segment->EntryPoint);
+			}
+		}
+
+		ShaderTranslator::ShaderTranslatorError err = ResolveEntryPoints(parsed, params, entryPoints, link ? &linked : nullptr, states);
+		if(err != ShaderTranslator::Ok)
+		{
+			return err;
+		}
+
+		if(link && pass == 0)
+		{
+			for(auto entryPoint = entryPoints.cbegin(); entryPoint != entryPoints.cend(); ++entryPoint)
+			{
+				const SymbolSet& inputs = states[*entryPoint]->InputSemantics;
+				for(SymbolId semantic = inputs.First(); semantic != NO_SYMBOL; semantic = inputs.Next(semantic))
+				{
+					linked.Insert(semantic);
+				}
+			}
+		}
+	}
+
+	InterpolatorLayout interpolators;
+	if(link)
+	{
+		SymbolSet written;
+		for(size_t i = 0; i < states.size(); ++i)
+		{
+			const SymbolSet& outputs = states[i]->OutputSemantics;
+			for(SymbolId semantic = outputs.First(); semantic != NO_SYMBOL; semantic = outputs.Next(semantic))
+			{
+				written.Insert(semantic);
+			}
+		}
+
+		for(SymbolId semantic = linked.First(); semantic != NO_SYMBOL; semantic = linked.Next(semantic))
+		{
+			const FrozenSymbol& symbol = parsed.GetSymbol(semantic);
+			if(!symbol.IsTexture && !symbol.IsSampler && !written.Contains(semantic))
+			{
+				m_Error = "Pixel shader input not written by any vertex shader: ";
+				m_Error.append(symbol.Name.begin(), symbol.Name.end());
+				return ShaderTranslator::UnlinkedSemantic;
+			}
+		}
+
+		// Every stage numbers what is passed between them the same way, whichever part of it it reads or writes
+		for(SymbolId semantic = linked.First(); semantic != NO_SYMBOL; semantic = linked.Next(semantic))
+		{
+			written.Insert(semantic);
+		}
+		if(m_PackInterpolators)
+		{
+			BuildInterpolatorLayout(written, parsed, interpolators);
+		}
+		else
+		{
+			BuildTexcoordLayout(written, parsed, interpolators);
+		}
+	}
+
+	OutputWriter writer(sink);
+	bool resourcesEmitted = !m_BindingLayout;
+	for(auto segment = parsed.Segments.cbegin(); segment != parsed.Segments.cend(); ++segment)
+	{
+		if(segment->EntryPoint < 0)
+		{
+			StageTimer timer(m_Stats, &TranslationStats::AssemblyTime);
+			writer.Write(parsed.Source.GetData() + segment->Begin, segment->End - segment->Begin);
+			continue;
+		}
+
+		if(!resourcesEmitted)
+		{
+			StageTimer timer(m_Stats, &TranslationStats::StructEmissionTime);
+			SymbolSet textures;
+			SymbolSet samplers;
+			for(auto state = states.cbegin(); state != states.cend(); ++state)
+			{
+				for(SymbolId texture = (*state)->InputTextures.First(); texture != NO_SYMBOL; texture = (*state)->InputTextures.Next(texture))
+				{
+					textures.Insert(texture);
 				}
-				// Not a polymorphic - paste the code as is
-				else
+				for(SymbolId sampler = (*state)->InputSamplers.First(); sampler != NO_SYMBOL; sampler = (*state)->InputSamplers.Next(sampler))
 				{
-					codeState.InnerSource.append(match[0].first, match[0].second);	
+					samplers.Insert(sampler);
 				}
-
-				start = match[0].second;
 			}
-		break;
-		case CT_None:
-			codeState.InnerSource.append(start, end);
-			start = end;
-		break;
+			EmitResources(writer, textures, samplers, parsed);
+			resourcesEmitted = true;
 		}
+		EmitEntryPoint(writer, *states[segment->EntryPoint], parsed, link ? &interpolators : nullptr);
+	}
+	{
+		StageTimer timer(m_Stats, &TranslationStats::AssemblyTime);
+		writer.Flush();
+	}
+
+	if(m_Stats)
+	{
+		m_Stats->BytesEmitted += writer.GetWritten();
 	}
+	return ShaderTranslator::Ok;
+}
 
-	// Create the input structure
-	std::ostringstream inputStruct;
-	auto err = ExpandShaderInput(inputStruct, codeState, semantics);
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::InstantiateShader(const ParsedShader& parsed
+																			, const ShaderTranslationParams& params
+																			, std::string& output)
+{
+	std::string hlsl;
+	HeapAllocationCounter::Count();
+	hlsl.reserve(parsed.Source.GetSize() * 2);
+	StringOutputSink sink(hlsl);
+	ShaderTranslator::ShaderTranslatorError err = InstantiateShader(parsed, params, sink);
+	if(m_Stats)
+	{
+		m_Stats->BytesMoved += sink.GetMovedBytes();
+	}
 	if(err != ShaderTranslator::Ok)
 	{
 		return err;
 	}
-	
-	std::ostringstream contextDeclaration;
-	contextDeclaration << std::endl << "\tstruct {" << std::endl;
-	for(auto semantic = codeState.ContextSemantics.cbegin(); semantic != codeState.ContextSemantics.end(); ++semantic)
+
+	output.swap(hlsl);
+
+	return ShaderTranslator::Ok;
+}
+
+ShaderTranslatorImpl::CacheKeys ShaderTranslatorImpl::MakeCacheKeys(unsigned long long sourceHash
+																	, const ShaderTranslationParams& params
+																	, const ShaderTranslationUniverse* universe
+																	, unsigned long long universeGeneration) const
+{
+	CacheKeys keys = {};
+	if(!m_Cache && !m_DiskCache)
+	{
+		return keys;
+	}
+
+	// Packing and linking change the output of the same bindings
+	unsigned long long paramsHash = HashParams(params);
+	if(m_PackInterpolators)
+	{
+		paramsHash = HashBytes(PACKED_PREFIX, strlen(PACKED_PREFIX), paramsHash);
+	}
+	if(m_LinkStages)
+	{
+		paramsHash = HashBytes("linked", 6, paramsHash);
+	}
+	if(m_BindingLayout)
+	{
+		const unsigned long long layoutHash = m_BindingLayout->GetHash();
+		paramsHash = HashBytes(reinterpret_cast<const char*>(&layoutHash), sizeof(layoutHash), paramsHash);
+	}
+	keys.Memory.SourceHash = sourceHash;
+	keys.Memory.ParamsHash = paramsHash;
+	keys.Memory.UniverseGeneration = universeGeneration;
+	if(m_DiskCache)
+	{
+		// Generations are per process, other processes can only agree on the contents
+		keys.Disk.SourceHash = sourceHash;
+		keys.Disk.ParamsHash = paramsHash;
+		keys.Disk.UniverseHash = universe->GetContentHash();
+	}
+	return keys;
+}
+
+bool ShaderTranslatorImpl::FindCached(const CacheKeys& keys, std::string& output) const
+{
+	if(m_Cache && m_Cache->Find(keys.Memory, output))
 	{
-		auto semanticDefinition = semantics.find(*semantic);
+		return true;
+	}
 
-		if(semanticDefinition == semantics.end())
+	if(m_DiskCache && m_DiskCache->Find(keys.Disk, output))
+	{
+		if(m_Cache)
 		{
-			m_Error = "Unknown semantic found: ";
-			m_Error.append(semantic->begin(), semantic->end());
-			return ShaderTranslator::UnknownSemantic;
+			m_Cache->Insert(keys.Memory, output);
 		}
+		return true;
+	}
+	return false;
+}
 
-		contextDeclaration << "\t\t" << semanticDefinition->second.Type << " " << boost::to_lower_copy(semanticDefinition->second.Name) << ";" << std::endl;
+void ShaderTranslatorImpl::StoreCached(const CacheKeys& keys, const std::string& output) const
+{
+	if(m_Cache)
+	{
+		m_Cache->Insert(keys.Memory, output);
+	}
+	if(m_DiskCache)
+	{
+		m_DiskCache->Store(keys.Disk, output);
 	}
-	contextDeclaration << "\t} context;" << std::endl;
+}
 
-	std::ostringstream outputStruct;
-	if(codeState.Type == VertexShader && codeState.OutputSemantics.size())
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::Instantiate(const ParsedShader& parsed
+																		, const ShaderTranslationParams& params
+																		, TranslationContext& context
+																		, std::string& output
+																		, TranslationStats* stats
+																		, TranslationDependencies* dependencies)
+{
+	StatsScope statsScope(*this, stats, context);
+	DependenciesScope dependenciesScope(*this, dependencies);
+	SetTracePermutation(params, -1);
+	TraceScope trace(m_Tracer, "Instantiate", m_Permutation);
+
+	// A hit could not tell what the translation depends on
+	const CacheKeys keys = MakeCacheKeys(parsed.SourceHash, params, parsed.Universe, parsed.UniverseGeneration);
+	if(!dependencies && FindCached(keys, output))
 	{
-		outputStruct << std::endl << "\tstruct " << codeState.OutputName << "{" << std::endl;
-		outputStruct << "\t\t " << PS_POSITION << " " << std::endl;
-		
-		unsigned counter = 0;
-		for(auto semantic = codeState.OutputSemantics.cbegin(); semantic != codeState.OutputSemantics.end(); ++semantic)
+		if(stats)
 		{
-			auto semanticDefinition = semantics.find(*semantic);
-			if(*semantic != POSITION_STRING)
-			{
-				outputStruct << "\t\t" << semanticDefinition->second.Type << " " << boost::to_lower_copy(semanticDefinition->second.Name) << " : TEXCOORD" << counter++ << ";" << std::endl;				
-			}
+			stats->CacheHit = true;
+			stats->BytesEmitted = output.size();
 		}
+		return ShaderTranslator::Ok;
+	}
 
-		outputStruct << "};" << std::endl;
+	context.Reset();
+	TranslationContext::Scope scope(context);
+	ShaderTranslator::ShaderTranslatorError err = InstantiateShader(parsed, params, output);
+	if(err == ShaderTranslator::Ok)
+	{
+		StoreCached(keys, output);
 	}
+	return err;
+}
 
-	std::ostringstream contextPopulation;
-	for(auto semantic = codeState.InputSemantics.cbegin(); semantic != codeState.InputSemantics.end(); ++semantic)
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::TranslateToHLSL(SourceView shader
+																			, const ShaderTranslationParams& params
+																			, const ShaderTranslationUniverse* universe
+																			, TranslationContext& context
+																			, std::string& output
+																			, TranslationStats* stats)
+{
+	StatsScope statsScope(*this, stats, context);
+	SetTracePermutation(params, -1);
+	TraceScope trace(m_Tracer, "TranslateToHLSL", m_Permutation);
+
+	// A hit skips the parsing and the scratch memory altogether
+	const CacheKeys keys = MakeCacheKeys((m_Cache || m_DiskCache) ? HashBytes(shader.GetData(), shader.GetSize()) : 0
+		, params
+		, universe
+		, universe->GetGeneration());
+	if(FindCached(keys, output))
 	{
-		ScratchString lowerSemantic = boost::to_lower_copy(*semantic);
-		contextPopulation << "\tcontext." << lowerSemantic << " = input." << lowerSemantic << ";" << std::endl;
+		if(stats)
+		{
+			stats->CacheHit = true;
+			stats->BytesEmitted = output.size();
+		}
+		return ShaderTranslator::Ok;
 	}
 
-	std::ostringstream textureInputs;
-	size_t registerCount = 0;
-	for(auto semantic = codeState.InputTextures.begin(); semantic != codeState.InputTextures.end(); ++semantic)
+	context.Reset();
+	TranslationContext::Scope scope(context);
+	ParsedShader parsed;
+	ShaderTranslator::ShaderTranslatorError err = ParseShader(shader, universe, parsed);
+	if(err != ShaderTranslator::Ok)
 	{
-		textureInputs << "Texture2D " << boost::to_lower_copy(*semantic) << " : register(t" << registerCount++ << ");" << std::endl;
+		return err;
 	}
 
-	std::ostringstream samplerInputs;
-	registerCount = 0;
-	for(auto semantic = codeState.InputSamplers.begin(); semantic != codeState.InputSamplers.end(); ++semantic)
+	err = InstantiateShader(parsed, params, output);
+	if(err == ShaderTranslator::Ok)
 	{
-		textureInputs << "SamplerState " << boost::to_lower_copy(*semantic) << " : register(s" << registerCount++ << ");" << std::endl;
+		StoreCached(keys, output);
 	}
+	return err;
+}
 
-	// Compose the final shader
-	state.Code.push_back(ScratchString("//texture inputs \n"));
-	state.Code.back().append(textureInputs.str().c_str());
-	state.Code.back().append("//sampler inputs \n");
-	state.Code.back().append(samplerInputs.str().c_str());
-	state.Code.back().append("//input \n");
-	state.Code.back().append(inputStruct.str().c_str());
-	state.Code.back().append("\n");
-	if(codeState.OutputSemantics.size())
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::Instantiate(const ParsedShader& parsed
+																		, const ShaderTranslationParams& params
+																		, TranslationContext& context
+																		, ShaderOutputSink& sink
+																		, TranslationStats* stats
+																		, TranslationDependencies* dependencies)
+{
+	// The caches keep whole strings - go through one
+	if(m_Cache || m_DiskCache)
 	{
-		state.Code.back().append("//output \n");
-		state.Code.back().append(outputStruct.str().c_str());
-		state.Code.back().append("\n");
+		std::string output;
+		ShaderTranslator::ShaderTranslatorError err = Instantiate(parsed, params, context, output, stats, dependencies);
+		if(err == ShaderTranslator::Ok)
+		{
+			sink.Write(output.data(), output.size());
+		}
+		return err;
 	}
-	state.Code.back().append(codeState.ShaderSignature);
-	state.Code.back().append("\n{\n");
-	state.Code.back().append(contextDeclaration.str().c_str());
-	state.Code.back().append("\n\t//context population \n");
-	state.Code.back().append(contextPopulation.str().c_str());
-	state.Code.back().append("\n");
-	state.Code.back().append(codeState.InnerSource);
-	state.Code.back().append("}\n");
 
-	return ShaderTranslator::Ok;
+	StatsScope statsScope(*this, stats, context);
+	DependenciesScope dependenciesScope(*this, dependencies);
+	SetTracePermutation(params, -1);
+	TraceScope trace(m_Tracer, "Instantiate", m_Permutation);
+
+	context.Reset();
+	TranslationContext::Scope scope(context);
+	return InstantiateShader(parsed, params, sink);
 }
 
-ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::TranslateToHLSL(const std::string& shader
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::TranslateToHLSL(SourceView shader
 																			, const ShaderTranslationParams& params
 																			, const ShaderTranslationUniverse* universe
-																			, std::string& output)
+																			, TranslationContext& context
+																			, ShaderOutputSink& sink
+																			, TranslationStats* stats)
 {
-	static const std::regex polyRegular("\\s*polymorphic\\s+(\\w+)");
-	//static const std::regex vsRegular("\\s*vertex_shader\\s+((\\w+)\\s+(\\w+)\\(([\\w\\s,]+)\\)(\\s+:\\s*\\w+)?)(\\s+needs\\s+((\\w*[,\\s]?)*))?");
-	//static const std::regex psRegular("\\s*pixel_shader\\s+((\\w+)\\s+(\\w+)\\(([\\w\\s,]+)\\)(\\s+:\\s*\\w+)?)(\\s+needs\\s+((\\w*[,\\s]?)*))?");
-	static const std::regex vsRegular("\\s*vertex_shader\\s+((\\w+)\\s+(\\w+)\\(([\\w\\s,]+)\\)(\\s+:\\s*\\w+)?)(\\s+needs\\s+((\\w[,\\s]*)*))?");
-	static const std::regex psRegular("\\s*pixel_shader\\s+((\\w+)\\s+(\\w+)\\(([\\w\\s,]+)\\)(\\s+:\\s*\\w+)?)(\\s+needs\\s+((\\w[,\\s]*)*))?");
-	
-	ParsingState state;
-	std::ostringstream hlsl;
-	std::istringstream stream(shader.c_str());
-
-	ScratchString line;
-	while(!std::getline(stream, line).eof())
-	{
-		ScratchString::const_iterator start, end;
-		start = line.begin();
-		end = line.end();
-		std::match_results<ScratchString::const_iterator> match;
-		// Poly
-		if(std::regex_search(start, end, match, polyRegular))
-		{
-			ScratchString name(match[1].first, match[1].second);
-			ShaderTranslator::ShaderTranslatorError err = ParsePolymorphic(stream, state.Functions, universe, name);
-			if(err != ShaderTranslator::Ok)
-			{
-				return err;
-			}
-			continue;
+	if(m_Cache || m_DiskCache)
+	{
+		std::string output;
+		ShaderTranslator::ShaderTranslatorError err = TranslateToHLSL(shader, params, universe, context, output, stats);
+		if(err == ShaderTranslator::Ok)
+		{
+			sink.Write(output.data(), output.size());
+		}
+		return err;
+	}
+
+	StatsScope statsScope(*this, stats, context);
+	SetTracePermutation(params, -1);
+	TraceScope trace(m_Tracer, "TranslateToHLSL", m_Permutation);
+
+	context.Reset();
+	TranslationContext::Scope scope(context);
+	ParsedShader parsed;
+	ShaderTranslator::ShaderTranslatorError err = ParseShader(shader, universe, parsed);
+	if(err != ShaderTranslator::Ok)
+	{
+		return err;
+	}
+
+	return InstantiateShader(parsed, params, sink);
+}
+
+void ShaderTranslatorImpl::TranslateBatch(const ParsedShader& parsed
+										, const std::vector<ShaderTranslationParams>& params
+										, std::vector<ShaderTranslator::BatchResult>& results)
+{
+	// Every worker keeps its context across batches so its memory stays warm
+	const unsigned workers = GetThreadPool().GetWorkerCount();
+	while(m_WorkerContexts.size() < workers)
+	{
+		m_WorkerContexts.emplace_back(new TranslationContext);
+	}
+
+	results.clear();
+	results.resize(params.size());
+	m_ThreadPool->ParallelFor(unsigned(params.size()), [&](unsigned index, unsigned worker)
+	{
+		ShaderTranslator::BatchResult& result = results[index];
+		ShaderTranslatorImpl translator;
+		translator.m_Tracer = m_Tracer;
+		translator.m_PackInterpolators = m_PackInterpolators;
+		translator.m_LinkStages = m_LinkStages;
+		translator.m_BindingLayout = m_BindingLayout;
+		translator.SetTracePermutation(params[index], int(index));
+		TraceScope trace(m_Tracer, "Permutation", translator.m_Permutation);
+
+		const CacheKeys keys = MakeCacheKeys(parsed.SourceHash, params[index], parsed.Universe, parsed.UniverseGeneration);
+		if(FindCached(keys, result.Output))
+		{
+			result.Error = ShaderTranslator::Ok;
+			return;
 		}
-		// VS
-		else if(std::regex_search(start, end, match, vsRegular))
+
+		TranslationContext& context = *m_WorkerContexts[worker];
+		context.Reset();
+		TranslationContext::Scope scope(context);
+
+		result.Error = translator.InstantiateShader(parsed, params[index], result.Output);
+		if(result.Error != ShaderTranslator::Ok)
 		{
-			ShaderTranslator::ShaderTranslatorError err = ParseShader(stream, state, params, universe, VertexShader, match);
-			if(err != ShaderTranslator::Ok)
-			{
-				return err;
-			}
-			hlsl << state.Code.back();
-			continue;
+			result.ErrorMessage = translator.GetError();
 		}
-		// PS
-		else if(std::regex_search(start, end, match, psRegular))
+		else
 		{
-			ShaderTranslator::ShaderTranslatorError err = ParseShader(stream, state, params, universe, PixelShader, match);
-			if(err != ShaderTranslator::Ok)
+			StoreCached(keys, result.Output);
+		}
+	});
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslatorImpl::TranslatePermutations(const ParsedShader& parsed
+																					, PermutationEnumerator& permutations
+																					, PermutationSet& result)
+{
+	// Enough to keep the pool busy without holding all permutations in memory
+	static const size_t PERMUTATIONS_PER_BATCH = 256;
+
+	result.Clear();
+	permutations.Reset();
+
+	// Content hash to the indices of the shaders with it - compared in full to rule out collisions
+	std::unordered_map<unsigned long long, std::vector<unsigned>> shadersByHash;
+	std::vector<ShaderTranslationParams> batch;
+	std::vector<ShaderTranslator::BatchResult> results;
+	ShaderTranslationParams params;
+	bool more = true;
+	while(more)
+	{
+		batch.clear();
+		while(batch.size() < PERMUTATIONS_PER_BATCH && (more = permutations.Next(params)))
+		{
+			batch.push_back(params);
+		}
+		if(batch.empty())
+		{
+			break;
+		}
+
+		TranslateBatch(parsed, batch, results);
+		for(size_t i = 0; i < batch.size(); ++i)
+		{
+			ShaderTranslator::BatchResult& translated = results[i];
+			if(translated.Error != ShaderTranslator::Ok)
 			{
-				return err;
+				m_Error = "Unable to translate permutation";
+				for(auto binding = batch[i].cbegin(); binding != batch[i].cend(); ++binding)
+				{
+					m_Error.append(binding == batch[i].cbegin() ? " " : ", ");
+					m_Error.append(binding->first.begin(), binding->first.end());
+					m_Error.append("=");
+					m_Error.append(binding->second.begin(), binding->second.end());
+				}
+				m_Error.append(": ");
+				m_Error.append(translated.ErrorMessage);
+				return translated.Error;
 			}
-			hlsl << state.Code.back();
-			continue;
+
+			std::vector<unsigned>& candidates = shadersByHash[HashBytes(translated.Output.data(), translated.Output.size())];
+			auto shader = std::find_if(candidates.cbegin(), candidates.cend(), [&](unsigned index) { return result.Shaders[index] == translated.Output; });
+			unsigned index;
+			if(shader != candidates.cend())
+			{
+				index = *shader;
+			}
+			else
+			{
+				index = unsigned(result.Shaders.size());
+				candidates.push_back(index);
+				result.Shaders.push_back(std::string());
+				result.Shaders.back().swap(translated.Output);
+			}
+
+			result.ShaderByKey[HashParams(batch[i])] = index;
+			result.ShaderIndices.push_back(index);
+			result.Permutations.push_back(ShaderTranslationParams());
+			result.Permutations.back().swap(batch[i]);
 		}
+	}
+	return ShaderTranslator::Ok;
+}
+
+TranslationContext& ShaderTranslatorImpl::GetDefaultContext()
+{
+	return m_DefaultContext;
+}
+
+TranslationThreadPool& ShaderTranslatorImpl::GetThreadPool()
+{
+	if(!m_ThreadPool)
+	{
+		m_OwnedThreadPool.reset(new TranslationThreadPool);
+		m_ThreadPool = m_OwnedThreadPool.get();
+	}
+	return *m_ThreadPool;
+}
 
-		hlsl << line << std::endl;
+void ShaderTranslatorImpl::SetThreadPool(TranslationThreadPool* pool)
+{
+	m_ThreadPool = pool;
+	if(m_OwnedThreadPool.get() != pool)
+	{
+		m_OwnedThreadPool.reset();
 	}
+}
+
+void ShaderTranslatorImpl::EnableCache(size_t maxEntries, size_t maxBytes)
+{
+	m_Cache.reset(new TranslationCache(maxEntries, maxBytes));
+}
 
-	output = hlsl.str().c_str();
+void ShaderTranslatorImpl::DisableCache()
+{
+	m_Cache.reset();
+}
 
-	return ShaderTranslator::Ok;
+void ShaderTranslatorImpl::SetDiskCache(DiskTranslationCache* cache)
+{
+	m_DiskCache = cache;
+}
+
+void ShaderTranslatorImpl::SetTracer(TranslationTracer* tracer)
+{
+	m_Tracer = tracer;
+}
+
+void ShaderTranslatorImpl::SetInterpolatorPacking(bool enabled)
+{
+	m_PackInterpolators = enabled;
+}
+
+void ShaderTranslatorImpl::SetStageLinking(bool enabled)
+{
+	m_LinkStages = enabled;
+}
+
+void ShaderTranslatorImpl::SetBindingLayout(const ResourceBindingLayout* layout)
+{
+	m_BindingLayout = layout;
+}
+
+void ShaderTranslatorImpl::SetParallelEntryPoints(bool enabled)
+{
+	m_ParallelEntryPoints = enabled;
+}
+
+TranslationCacheStats ShaderTranslatorImpl::GetCacheStats() const
+{
+	if(!m_Cache)
+	{
+		TranslationCacheStats empty = { 0, 0, 0, 0, 0 };
+		return empty;
+	}
+	return m_Cache->GetStats();
 }
 
 ///////////////////////////////////////////////////////////////
@@ -679,26 +1780,164 @@ ShaderTranslator::~ShaderTranslator()
 	delete m_Impl;
 }
 
-ShaderTranslator::ShaderTranslatorError ShaderTranslator::TranslateToHLSL(const std::string& shader
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::TranslateToHLSL(SourceView shader
+														, const ShaderTranslationParams& params
+														, const ShaderTranslationUniverse* universe
+														, std::string& output
+														, TranslationStats* stats)
+{
+	return m_Impl->TranslateToHLSL(shader, params, universe, m_Impl->GetDefaultContext(), output, stats);
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::TranslateToHLSL(SourceView shader
+														, const ShaderTranslationParams& params
+														, const ShaderTranslationUniverse* universe
+														, TranslationContext& context
+														, std::string& output
+														, TranslationStats* stats)
+{
+	return m_Impl->TranslateToHLSL(shader, params, universe, context, output, stats);
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::TranslateToHLSL(SourceView shader
 														, const ShaderTranslationParams& params
 														, const ShaderTranslationUniverse* universe
-														, std::string& output)
+														, ShaderOutputSink& sink
+														, TranslationStats* stats)
+{
+	return m_Impl->TranslateToHLSL(shader, params, universe, m_Impl->GetDefaultContext(), sink, stats);
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::ParseShader(SourceView shader
+														, const ShaderTranslationUniverse* universe
+														, ParsedShaderPtr& parsed)
 {
-	struct AllocatorScope
+	std::shared_ptr<ParsedShader> result = std::make_shared<ParsedShader>();
+	result->OwnedSource.assign(shader.GetData(), shader.GetSize());
+	ShaderTranslatorError err = m_Impl->ParseShader(SourceView(result->OwnedSource.data(), result->OwnedSource.size()), universe, *result);
+	if(err != Ok)
 	{
-		AllocatorScope(unsigned sz)
-		{
-			TlsScratchAllocator::Create(sz);
-		}
+		return err;
+	}
+	parsed = result;
+	return Ok;
+}
 
-		~AllocatorScope()
-		{
-			TlsScratchAllocator::Destroy();
-		}
-	};
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::ParseShader(const ShaderSourceFile& file
+														, const ShaderTranslationUniverse* universe
+														, ParsedShaderPtr& parsed)
+{
+	std::shared_ptr<ParsedShader> result = std::make_shared<ParsedShader>();
+	result->SourceFile = file.GetOwner();
+	ShaderTranslatorError err = m_Impl->ParseShader(file.GetView(), universe, *result);
+	if(err != Ok)
+	{
+		return err;
+	}
+	parsed = result;
+	return Ok;
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::Instantiate(const ParsedShader& parsed
+														, const ShaderTranslationParams& params
+														, std::string& output
+														, TranslationStats* stats
+														, TranslationDependencies* dependencies)
+{
+	return m_Impl->Instantiate(parsed, params, m_Impl->GetDefaultContext(), output, stats, dependencies);
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::Instantiate(const ParsedShader& parsed
+														, const ShaderTranslationParams& params
+														, TranslationContext& context
+														, std::string& output
+														, TranslationStats* stats
+														, TranslationDependencies* dependencies)
+{
+	return m_Impl->Instantiate(parsed, params, context, output, stats, dependencies);
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::Instantiate(const ParsedShader& parsed
+														, const ShaderTranslationParams& params
+														, ShaderOutputSink& sink
+														, TranslationStats* stats
+														, TranslationDependencies* dependencies)
+{
+	return m_Impl->Instantiate(parsed, params, m_Impl->GetDefaultContext(), sink, stats, dependencies);
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::TranslateBatch(SourceView shader
+														, const std::vector<ShaderTranslationParams>& params
+														, const ShaderTranslationUniverse* universe
+														, std::vector<BatchResult>& results)
+{
+	// The batch is done before returning - parse on the caller's text
+	ParsedShader parsed;
+	ShaderTranslatorError err = m_Impl->ParseShader(shader, universe, parsed);
+	if(err != Ok)
+	{
+		return err;
+	}
+
+	m_Impl->TranslateBatch(parsed, params, results);
+	return Ok;
+}
+
+ShaderTranslator::ShaderTranslatorError ShaderTranslator::TranslatePermutations(const ParsedShader& parsed
+														, PermutationEnumerator& permutations
+														, PermutationSet& result)
+{
+	return m_Impl->TranslatePermutations(parsed, permutations, result);
+}
+
+void ShaderTranslator::SetThreadPool(TranslationThreadPool* pool)
+{
+	m_Impl->SetThreadPool(pool);
+}
+
+void ShaderTranslator::EnableCache(size_t maxEntries, size_t maxBytes)
+{
+	m_Impl->EnableCache(maxEntries, maxBytes);
+}
+
+void ShaderTranslator::DisableCache()
+{
+	m_Impl->DisableCache();
+}
+
+void ShaderTranslator::SetDiskCache(DiskTranslationCache* cache)
+{
+	m_Impl->SetDiskCache(cache);
+}
 
-	AllocatorScope alloc(1024*128);
-	return m_Impl->TranslateToHLSL(shader, params, universe, output);	
+void ShaderTranslator::SetTracer(TranslationTracer* tracer)
+{
+	m_Impl->SetTracer(tracer);
+}
+
+void ShaderTranslator::SetInterpolatorPacking(bool enabled)
+{
+	m_Impl->SetInterpolatorPacking(enabled);
+}
+
+void ShaderTranslator::SetStageLinking(bool enabled)
+{
+	m_Impl->SetStageLinking(enabled);
+}
+
+void ShaderTranslator::SetBindingLayout(const ResourceBindingLayout* layout)
+{
+	m_Impl->SetBindingLayout(layout);
+}
+
+void ShaderTranslator::SetParallelEntryPoints(bool enabled)
+{
+	m_Impl->SetParallelEntryPoints(enabled);
+}
+
+TranslationCacheStats ShaderTranslator::GetCacheStats() const
+{
+	return m_Impl->GetCacheStats();
 }
 
 const std::string& ShaderTranslator::GetLastError() const
@@ -5,14 +5,24 @@
 #pragma once
 
 #include "ShaderTranslationTypes.h"
+#include "ShaderTranslationCache.h"
+#include "ShaderTranslationSink.h"
+#include "ShaderTranslationStats.h"
+#include "ShaderTranslationDependencies.h"
+#include "ShaderTranslationPermutations.h"
+#include "ShaderTranslationBindingLayout.h"
+#include "ShaderTranslationSourceFile.h"
 
 namespace translator
 {
 
 class ShaderTranslatorImpl;
 class ShaderTranslationUniverse;
-
-typedef std::map<String, String> ShaderTranslationParams;
+class ParsedShader;
+class TranslationThreadPool;
+class DiskTranslationCache;
+class TranslationTracer;
+typedef std::shared_ptr<const ParsedShader> ParsedShaderPtr;
 
 class ShaderTranslator
 {
@@ -29,12 +39,81 @@ public:
 		UndeclaredParam,
 		ContextIfNoEndBrace,
 		Ok,
+		UnlinkedSemantic,
+	};
+
+	struct BatchResult
+	{
+		ShaderTranslatorError Error;
+		std::string ErrorMessage;
+		std::string Output;
 	};
 
 	ShaderTranslator();
 	~ShaderTranslator();
 
-	ShaderTranslatorError TranslateToHLSL(const std::string& shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, std::string& output);
+	// All translations optionally report where their time and memory went. Without stats nothing is measured.
+	ShaderTranslatorError TranslateToHLSL(SourceView shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, std::string& output, TranslationStats* stats = nullptr);
+	// Uses the scratch memory of the given context instead of the one owned by the translator.
+	// The context is reset at the start of the translation.
+	ShaderTranslatorError TranslateToHLSL(SourceView shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, TranslationContext& context, std::string& output, TranslationStats* stats = nullptr);
+	// Streams the shader to the sink in a single pass without building it in memory first
+	ShaderTranslatorError TranslateToHLSL(SourceView shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, ShaderOutputSink& sink, TranslationStats* stats = nullptr);
+
+	// Parses the shader once so that it can be instantiated with many different bindings.
+	// The universe must outlive the parsed shader and must not be modified meanwhile.
+	// The parsed shader keeps a copy of the text, as it may outlive the caller's buffer.
+	ShaderTranslatorError ParseShader(SourceView shader, const ShaderTranslationUniverse* universe, ParsedShaderPtr& parsed);
+	// Parses the mapped text in place. The parsed shader keeps the mapping alive.
+	ShaderTranslatorError ParseShader(const ShaderSourceFile& file, const ShaderTranslationUniverse* universe, ParsedShaderPtr& parsed);
+	// Instantiating optionally records what it read from the universe, so that a build can tell which
+	// outputs a universe edit affects. Recording skips the cache lookups; the record is complete only on success.
+	ShaderTranslatorError Instantiate(const ParsedShader& parsed, const ShaderTranslationParams& params, std::string& output, TranslationStats* stats = nullptr, TranslationDependencies* dependencies = nullptr);
+	ShaderTranslatorError Instantiate(const ParsedShader& parsed, const ShaderTranslationParams& params, TranslationContext& context, std::string& output, TranslationStats* stats = nullptr, TranslationDependencies* dependencies = nullptr);
+	ShaderTranslatorError Instantiate(const ParsedShader& parsed, const ShaderTranslationParams& params, ShaderOutputSink& sink, TranslationStats* stats = nullptr, TranslationDependencies* dependencies = nullptr);
+
+	// Translates one permutation per parameter set on the thread pool. The shader is parsed once;
+	// per permutation errors are reported in the results, which are in the order of the params.
+	ShaderTranslatorError TranslateBatch(SourceView shader, const std::vector<ShaderTranslationParams>& params, const ShaderTranslationUniverse* universe, std::vector<BatchResult>& results);
+
+	// Translates every combination the enumerator yields in batches and keeps each distinct output once.
+	// Stops at the first permutation that fails; the error names its bindings.
+	ShaderTranslatorError TranslatePermutations(const ParsedShader& parsed, PermutationEnumerator& permutations, PermutationSet& result);
+
+	// The pool used for batches - if none is set one with a worker per hardware thread is created on demand
+	void SetThreadPool(TranslationThreadPool* pool);
+
+	// Keeps the results of successful translations in memory, keyed by the source,
+	// the bindings and the universe generation. A limit of 0 means unlimited.
+	void EnableCache(size_t maxEntries, size_t maxBytes);
+	void DisableCache();
+	TranslationCacheStats GetCacheStats() const;
+
+	// Looks results up in and stores them to a cache directory shared between runs and processes.
+	// Consulted after the memory cache; the translator does not own the cache, pass nullptr to stop using it.
+	void SetDiskCache(DiskTranslationCache* cache);
+
+	// Records every translation and its stages for a Chrome trace, including the ones of batches.
+	// The translator does not own the tracer, pass nullptr to stop tracing.
+	void SetTracer(TranslationTracer* tracer);
+
+	// Packs the vertex shader outputs and the pixel shader inputs into as few TEXCOORD vectors as possible.
+	// The entry points have to access them through the context and "output." writes. Off by default.
+	void SetInterpolatorPacking(bool enabled);
+
+	// Translates the vertex shaders of a file against its pixel shaders. The outputs no pixel shader reads
+	// and the polymorphic calls that only fed them are dropped; a pixel shader input that no vertex shader
+	// writes is an UnlinkedSemantic error. Files without both kinds of entry points are not affected. Off by default.
+	void SetStageLinking(bool enabled);
+
+	// Takes the texture and sampler registers from the layout, which must outlive the translations and
+	// not change during them. The resources of all entry points of a file are then declared once, before the first one.
+	// Resources the layout doesn't know get registers after its own. nullptr numbers them per entry point.
+	void SetBindingLayout(const ResourceBindingLayout* layout);
+
+	// Translates the entry points of a file concurrently on the thread pool. The output is the same
+	// and in source order. Batches and translations that record dependencies are not affected. Off by default.
+	void SetParallelEntryPoints(bool enabled);
 
 	const std::string& GetLastError() const;
 
@@ -0,0 +1,252 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#pragma once
+
+#include "ShaderTranslator.h"
+#include "ShaderTranslationIR.h"
+#include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationThreadPool.h"
+#include "ShaderTranslationDiskCache.h"
+#include "ShaderTranslationSink.h"
+#include "ShaderTranslationTracer.h"
+
+namespace translator
+{
+
+struct InterpolatorLayout;
+
+// Gathers the small pieces of the output and passes them on to the sink in large blocks
+class OutputWriter : boost::noncopyable
+{
+public:
+	explicit OutputWriter(ShaderOutputSink& sink);
+
+	void Write(const char* data, size_t size);
+	void Flush();
+
+	// The bytes passed on to the sink so far
+	unsigned long long GetWritten() const;
+
+	OutputWriter& operator<<(const char* str);
+	OutputWriter& operator<<(const String& str);
+	OutputWriter& operator<<(const FrozenString& str);
+	OutputWriter& operator<<(unsigned long long number);
+
+private:
+	static const size_t BUFFER_SIZE = 4096;
+
+	ShaderOutputSink& m_Sink;
+	size_t m_Size;
+	unsigned long long m_Written;
+	char m_Buffer[BUFFER_SIZE];
+};
+
+// Adds the wall time of its scope to a stage of the stats - does nothing without stats
+class StageTimer : boost::noncopyable
+{
+public:
+	typedef double TranslationStats::* Stage;
+
+	StageTimer(TranslationStats* stats, Stage stage)
+		: m_Stats(stats)
+		, m_Stage(stage)
+	{
+		if(m_Stats)
+		{
+			m_Start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~StageTimer()
+	{
+		if(m_Stats)
+		{
+			m_Stats->*m_Stage += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_Start).count();
+		}
+	}
+
+	// Ends the current stage and accounts the rest of the scope to another one
+	void Switch(Stage stage)
+	{
+		if(m_Stats)
+		{
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			m_Stats->*m_Stage += std::chrono::duration<double, std::micro>(now - m_Start).count();
+			m_Start = now;
+		}
+		m_Stage = stage;
+	}
+
+private:
+	TranslationStats* m_Stats;
+	Stage m_Stage;
+	std::chrono::steady_clock::time_point m_Start;
+};
+
+class ShaderTranslatorImpl
+{
+public:
+	ShaderTranslatorImpl();
+
+	const std::string& GetError();
+
+	ShaderTranslator::ShaderTranslatorError TranslateToHLSL(SourceView shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, TranslationContext& context, std::string& output, TranslationStats* stats);
+	ShaderTranslator::ShaderTranslatorError TranslateToHLSL(SourceView shader, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, TranslationContext& context, ShaderOutputSink& sink, TranslationStats* stats);
+
+	ShaderTranslator::ShaderTranslatorError ParseShader(SourceView shader, const ShaderTranslationUniverse* universe, ParsedShader& parsed);
+	ShaderTranslator::ShaderTranslatorError Instantiate(const ParsedShader& parsed, const ShaderTranslationParams& params, TranslationContext& context, std::string& output, TranslationStats* stats, TranslationDependencies* dependencies);
+	ShaderTranslator::ShaderTranslatorError Instantiate(const ParsedShader& parsed, const ShaderTranslationParams& params, TranslationContext& context, ShaderOutputSink& sink, TranslationStats* stats, TranslationDependencies* dependencies);
+
+	void TranslateBatch(const ParsedShader& parsed, const std::vector<ShaderTranslationParams>& params, std::vector<ShaderTranslator::BatchResult>& results);
+	ShaderTranslator::ShaderTranslatorError TranslatePermutations(const ParsedShader& parsed, PermutationEnumerator& permutations, PermutationSet& result);
+	void SetThreadPool(TranslationThreadPool* pool);
+
+	// Used by the calls that do not get a context from the caller
+	TranslationContext& GetDefaultContext();
+
+	void EnableCache(size_t maxEntries, size_t maxBytes);
+	void DisableCache();
+	void SetDiskCache(DiskTranslationCache* cache);
+	void SetTracer(TranslationTracer* tracer);
+	void SetInterpolatorPacking(bool enabled);
+	void SetStageLinking(bool enabled);
+	void SetBindingLayout(const ResourceBindingLayout* layout);
+	void SetParallelEntryPoints(bool enabled);
+	TranslationCacheStats GetCacheStats() const;
+
+private:
+	// Points the stages at the stats of a call and adds the memory use of its context at the end
+	class StatsScope : boost::noncopyable
+	{
+	public:
+		StatsScope(ShaderTranslatorImpl& translator, TranslationStats* stats, TranslationContext& context);
+		~StatsScope();
+
+	private:
+		ShaderTranslatorImpl& m_Translator;
+		TranslationStats* m_Previous;
+		TranslationContext& m_Context;
+		unsigned long long m_ChunkAllocations;
+		HeapAllocationCounter m_HeapAllocations;
+	};
+
+	// Points the recording at the dependencies of a call and clears them
+	class DependenciesScope : boost::noncopyable
+	{
+	public:
+		DependenciesScope(ShaderTranslatorImpl& translator, TranslationDependencies* dependencies);
+		~DependenciesScope();
+
+	private:
+		ShaderTranslatorImpl& m_Translator;
+		TranslationDependencies* m_Previous;
+	};
+
+	// A semantic "output.name" of a vertex shader body, as an offset in CodeState::InnerSource
+	struct OutputWrite
+	{
+		size_t Offset;
+		size_t Length;
+		SymbolId Semantic;
+	};
+
+	struct CodeState
+	{
+		TranslatorShaderType Type;
+		ScratchString InputName;
+		ScratchString OutputName;
+		ScratchString ShaderSignature;
+
+		SymbolSet InputSemantics;
+		SymbolSet OutputSemantics;
+		SymbolSet ContextSemantics;
+		SymbolSet AvailableSemantics;
+		SymbolSet InputTextures;
+		SymbolSet InputSamplers;
+
+		ScratchString InnerSource;
+		// Only kept when the interpolators are packed - the writes go to the packed vectors
+		CountedVector<OutputWrite> OutputWrites;
+
+		void ResizeSymbols(size_t symbolCount)
+		{
+			InputSemantics.Resize(symbolCount);
+			OutputSemantics.Resize(symbolCount);
+			ContextSemantics.Resize(symbolCount);
+			AvailableSemantics.Resize(symbolCount);
+			InputTextures.Resize(symbolCount);
+			InputSamplers.Resize(symbolCount);
+		}
+	};
+
+	// The key is only hashed when tracing
+	void SetTracePermutation(const ShaderTranslationParams& params, int index);
+	TranslationThreadPool& GetThreadPool();
+
+	struct CacheKeys
+	{
+		TranslationCacheKey Memory;
+		DiskCacheKey Disk;
+	};
+
+	CacheKeys MakeCacheKeys(unsigned long long sourceHash, const ShaderTranslationParams& params, const ShaderTranslationUniverse* universe, unsigned long long universeGeneration) const;
+	bool FindCached(const CacheKeys& keys, std::string& output) const;
+	void StoreCached(const CacheKeys& keys, const std::string& output) const;
+
+	class LineReader;
+	// The results of matching a declaration, in counted memory
+	typedef std::match_results<const char*, CountedAllocator<std::csub_match>> DeclarationMatch;
+
+	// Parsing - implemented in ShaderTranslationParser.cpp
+	ShaderTranslator::ShaderTranslatorError ParsePolymorphic(LineReader& lines, ParsedShader& parsed, const String& name);
+	ShaderTranslator::ShaderTranslatorError ParseEntryPoint(LineReader& lines, ParsedShader& parsed, TranslatorShaderType type, const DeclarationMatch& match);
+	void ParseRewrites(const ParsedShader& parsed, ParsedEntryPoint& entryPoint);
+
+	// Instantiation
+	ShaderTranslator::ShaderTranslatorError InstantiateShader(const ParsedShader& parsed, const ShaderTranslationParams& params, ShaderOutputSink& sink);
+	ShaderTranslator::ShaderTranslatorError InstantiateShader(const ParsedShader& parsed, const ShaderTranslationParams& params, std::string& output);
+	// linked holds the semantics the pixel shaders read when a vertex shader is linked to them
+	ShaderTranslator::ShaderTranslatorError InstantiateEntryPoint(const ParsedShader& parsed, const ParsedEntryPoint& entryPoint, const ShaderTranslationParams& params, const SymbolSet* linked, CodeState& codeState);
+	// Instantiates the given entry points, concurrently if enabled. Fails with the error of the first failing one in the list.
+	ShaderTranslator::ShaderTranslatorError ResolveEntryPoints(const ParsedShader& parsed, const ShaderTranslationParams& params, const CountedVector<int>& entryPoints, const SymbolSet* linked, CountedVector<std::unique_ptr<CodeState>>& states);
+	ShaderTranslator::ShaderTranslatorError ExpandFunction(const FrozenFunction& function, CodeState& state, const FrozenUniverse& frozen, ScratchString& output);
+	void EmitFunction(const FrozenFunction& function, CodeState& state, ScratchString& output);
+	ShaderTranslator::ShaderTranslatorError PrepareShaderInput(CodeState& codeState, const ParsedShader& parsed);
+	void RecordDependencies(const CodeState& codeState, const ParsedShader& parsed);
+	void RecordOutputWrite(CodeState& codeState, const char* body, const ParsedRewrite& rewrite);
+
+	// Emission - only called on states that instantiated successfully.
+	// linked holds the interpolators of the whole file when its stages are linked.
+	void EmitEntryPoint(OutputWriter& writer, const CodeState& codeState, const ParsedShader& parsed, const InterpolatorLayout* linked);
+	void EmitResources(OutputWriter& writer, const SymbolSet& textures, const SymbolSet& samplers, const ParsedShader& parsed);
+	// packed is given only for packed pixel shader inputs, texcoords only for linked unpacked ones
+	void EmitShaderInput(OutputWriter& writer, const CodeState& codeState, const ParsedShader& parsed, const InterpolatorLayout* packed, const InterpolatorLayout* texcoords);
+
+private:
+	std::string m_Error;
+	// Set for the duration of a call that collects stats
+	TranslationStats* m_Stats;
+	// Set for the duration of a call that records dependencies
+	TranslationDependencies* m_Dependencies;
+	TranslationTracer* m_Tracer;
+	TracePermutation m_Permutation;
+	bool m_PackInterpolators;
+	bool m_LinkStages;
+	const ResourceBindingLayout* m_BindingLayout;
+	bool m_ParallelEntryPoints;
+
+	TranslationContext m_DefaultContext;
+	std::vector<std::unique_ptr<TranslationContext>> m_WorkerContexts;
+	// The entry points resolved by a worker keep their memory here until the shader is written
+	std::vector<std::unique_ptr<TranslationContext>> m_EntryPointContexts;
+
+	TranslationThreadPool* m_ThreadPool;
+	std::unique_ptr<TranslationThreadPool> m_OwnedThreadPool;
+
+	std::unique_ptr<TranslationCache> m_Cache;
+	DiskTranslationCache* m_DiskCache;
+};
+
+}
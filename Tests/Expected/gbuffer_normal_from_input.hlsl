@@ -0,0 +1,44 @@
+//texture inputs 
+//sampler inputs 
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float3 normal_o : TEXCOORD0;
+float4 projposition : TEXCOORD1;
+float3 vertex_color : TEXCOORD2;
+};
+
+float4 PS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float depth_p;
+		float3 normal_o;
+		float3 normal_w;
+		float4 projposition;
+		float3 vertex_color;
+	} context;
+
+	//context population 
+	context.normal_o = input.normal_o;
+	context.projposition = input.projposition;
+	context.vertex_color = input.vertex_color;
+
+
+
+{ // CalculateProjectionDepth
+	context.depth_p = context.projposition.z / context.projposition.w;
+}
+
+
+
+{ // NormalFromInput
+	context.normal_w = mul(context.normal_o, World);
+}
+
+
+	return float4(context.normal_w.x
+		    , context.normal_w.y
+		    , context.normal_w.z
+		    , context.depth_p);
+}
@@ -0,0 +1 @@
+error 6
@@ -0,0 +1,88 @@
+cbuffer PerFrameLPrePass : register( b0 )
+{
+	matrix View;
+	matrix Projection;
+	vector Globals;
+};
+
+cbuffer PerSubset : register( b1 )
+{
+	matrix World;
+	vector DiffuseColor;
+};
+
+cbuffer GlobalProperties : register(b2)
+{
+	matrix InvViewProj;
+	vector ViewportSize;
+	vector CameraPosAndFarDist;
+};
+
+//texture inputs 
+Texture2D map_alphamask : register(t0);
+Texture2D map_diffuse : register(t1);
+Texture2D map_lbuffer : register(t2);
+Texture2D map_specularcolor : register(t3);
+//sampler inputs 
+SamplerState sampler_linear : register(s0);
+SamplerState sampler_point : register(s1);
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float2 uv : TEXCOORD0;
+};
+
+float4 PS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float3 albedo;
+		float alpha;
+		float3 specular_color;
+		float2 uv;
+	} context;
+
+	//context population 
+	context.uv = input.uv;
+
+
+	static const float3 ambient = float3(0.1f, 0.1f, 0.1f);
+	static const float3 specularColor = float3(1, 1, 1);
+	static const float specularIntensity = 1;
+
+	context.uv = input.Position.xy / Globals.xy; 
+
+{ // AlphaFromMap
+	context.alpha = map_alphamask.Sample(sampler_point, context.uv).a;
+}
+
+	{ // conditional if on semantic ALPHA
+		//this is obviously always true but was added to show nested IFs
+		{ // conditional if on semantic UV
+			if(context.alpha == 0)
+				discard;
+		}
+	}
+
+{ // AlbedoFromMap
+	context.albedo = map_diffuse.Sample(sampler_linear, context.uv).xyz;
+}
+
+	
+	
+	float4 lbuffer = map_lbuffer.Sample(sampler_point, context.uv);
+
+
+{ // SpecularFromMap
+	context.specular_color = map_specularcolor.Sample(sampler_linear, context.uv).xyz;
+}
+
+	
+	
+	float3 color = ambient*context.albedo  + (lbuffer.xyz * context.albedo  + lbuffer.w*context.specular_color*specularIntensity);
+
+	// ouput LUMA for AA
+	float luma = sqrt(dot(color.rgb, float3(0.299, 0.587, 0.114)));
+
+	return float4(color, luma);	
+}
@@ -0,0 +1,73 @@
+cbuffer PerFrameLPrePass : register( b0 )
+{
+	matrix View;
+	matrix Projection;
+	vector Globals;
+};
+
+cbuffer PerSubset : register( b1 )
+{
+	matrix World;
+	vector DiffuseColor;
+};
+
+cbuffer GlobalProperties : register(b2)
+{
+	matrix InvViewProj;
+	vector ViewportSize;
+	vector CameraPosAndFarDist;
+};
+
+//texture inputs 
+Texture2D map_lbuffer : register(t0);
+//sampler inputs 
+SamplerState sampler_point : register(s0);
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+};
+
+float4 PS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+	} context;
+
+	//context population 
+
+
+	static const float3 ambient = float3(0.1f, 0.1f, 0.1f);
+	static const float3 specularColor = float3(1, 1, 1);
+	static const float specularIntensity = 1;
+
+	context.uv = input.Position.xy / Globals.xy; 
+
+{ // None
+}
+
+	
+
+{ // None
+}
+
+	{ // conditional if on semantic ALBEDO
+		context.albedo = DiffuseColor.xyz;
+	}
+	
+	float4 lbuffer = map_lbuffer.Sample(sampler_point, context.uv);
+
+
+{ // None
+}
+
+	{ // conditional if on semantic SPECULAR_COLOR
+		context.specular_color = specularColor;
+	}
+	
+	float3 color = ambient*context.albedo  + (lbuffer.xyz * context.albedo  + lbuffer.w*context.specular_color*specularIntensity);
+
+	// ouput LUMA for AA
+	float luma = sqrt(dot(color.rgb, float3(0.299, 0.587, 0.114)));
+
+	return float4(color, luma);	
+}
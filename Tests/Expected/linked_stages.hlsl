@@ -0,0 +1,152 @@
+//texture inputs 
+Texture2D map_normal : register(t0);
+//sampler inputs 
+SamplerState sampler_point : register(s0);
+//input 
+struct VS_INPUT { 
+float4 Position : POSITION;
+float3 binormal : BINORMAL0;
+float3 normal_o : NORMAL0;
+float3 normal_t : NORMAL1;
+float3 tangent : TANGENT0;
+float2 uv : TEXCOORD0;
+float3 vertex_color : VERTEXCOLOR0;
+};
+
+//output 
+
+	struct VS_OUTPUT{
+		 float4 Position : SV_POSITION; 
+		float3 normal_w : TEXCOORD0;
+		float2 uv : TEXCOORD1;
+		float3 vertex_color : TEXCOORD2;
+};
+
+VS_OUTPUT VS(VS_INPUT input)
+{
+
+	struct {
+		float3 binormal;
+		float3 normal_o;
+		float3 normal_t;
+		float3 normal_w;
+		float3 tangent;
+		float3x3 tbn;
+		float2 uv;
+		float3 vertex_color;
+	} context;
+
+	//context population 
+	context.binormal = input.binormal;
+	context.normal_o = input.normal_o;
+	context.normal_t = input.normal_t;
+	context.tangent = input.tangent;
+	context.uv = input.uv;
+	context.vertex_color = input.vertex_color;
+
+
+	VS_OUTPUT output;
+
+	output.Position = mul(input.Position, World);
+
+	output.uv = context.uv;
+
+	output.vertex_color = context.vertex_color;
+
+{ // ComputeTBN
+	context.tbn = float3x3(context.tangent, context.binormal, context.normal_t);
+}
+
+{ // NormalFromMap
+	float3 normal = map_normal.Sample(sampler_point, context.uv);
+	normal = mul(normal, context.tbn);
+	normal = normalize(context.normal_o + normal);
+
+	context.normal_w = normal;
+}
+
+
+	output.normal_w = context.normal_w;
+	return output;
+}
+
+//texture inputs 
+//sampler inputs 
+//input 
+struct VS_INPUT { 
+float4 Position : POSITION;
+float2 uv : TEXCOORD0;
+};
+
+//output 
+
+	struct VS_OUTPUT{
+		 float4 Position : SV_POSITION; 
+		float2 uv : TEXCOORD1;
+};
+
+VS_OUTPUT ShadowVS(VS_INPUT input)
+{
+
+	struct {
+		float2 uv;
+	} context;
+
+	//context population 
+	context.uv = input.uv;
+
+
+	VS_OUTPUT output;
+
+	output.Position = mul(mul(input.Position, World), LightViewProjection);
+
+	output.uv = context.uv;
+	return output;
+}
+
+//texture inputs 
+//sampler inputs 
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float3 vertex_color : TEXCOORD2;
+};
+
+float4 ColorPS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float3 vertex_color;
+	} context;
+
+	//context population 
+	context.vertex_color = input.vertex_color;
+
+
+	return float4(context.vertex_color, 1);
+}
+
+//texture inputs 
+//sampler inputs 
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float3 normal_w : TEXCOORD0;
+float2 uv : TEXCOORD1;
+};
+
+float4 NormalPS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float3 normal_w;
+		float2 uv;
+	} context;
+
+	//context population 
+	context.normal_w = input.normal_w;
+	context.uv = input.uv;
+
+
+	return float4(context.normal_w * context.uv.x, 1);
+}
@@ -0,0 +1,157 @@
+//texture inputs 
+Texture2D map_normal : register(t0);
+//sampler inputs 
+SamplerState sampler_point : register(s0);
+//input 
+struct VS_INPUT { 
+float4 Position : POSITION;
+float3 binormal : BINORMAL0;
+float3 normal_o : NORMAL0;
+float3 normal_t : NORMAL1;
+float3 tangent : TANGENT0;
+float2 uv : TEXCOORD0;
+float3 vertex_color : VERTEXCOLOR0;
+};
+
+//output 
+
+	struct VS_OUTPUT{
+		 float4 Position : SV_POSITION; 
+		float4 packed0 : TEXCOORD0; // normal_w
+		float4 packed1 : TEXCOORD1; // vertex_color
+		float4 packed2 : TEXCOORD2; // uv
+};
+
+VS_OUTPUT VS(VS_INPUT input)
+{
+
+	struct {
+		float3 binormal;
+		float3 normal_o;
+		float3 normal_t;
+		float3 normal_w;
+		float3 tangent;
+		float3x3 tbn;
+		float2 uv;
+		float3 vertex_color;
+	} context;
+
+	//context population 
+	context.binormal = input.binormal;
+	context.normal_o = input.normal_o;
+	context.normal_t = input.normal_t;
+	context.tangent = input.tangent;
+	context.uv = input.uv;
+	context.vertex_color = input.vertex_color;
+
+
+	VS_OUTPUT output;
+
+	output.Position = mul(input.Position, World);
+
+	output.packed2.xy = context.uv;
+
+	output.packed1.xyz = context.vertex_color;
+
+{ // ComputeTBN
+	context.tbn = float3x3(context.tangent, context.binormal, context.normal_t);
+}
+
+{ // NormalFromMap
+	float3 normal = map_normal.Sample(sampler_point, context.uv);
+	normal = mul(normal, context.tbn);
+	normal = normalize(context.normal_o + normal);
+
+	context.normal_w = normal;
+}
+
+
+	output.packed0.xyz = context.normal_w;
+	return output;
+}
+
+//texture inputs 
+//sampler inputs 
+//input 
+struct VS_INPUT { 
+float4 Position : POSITION;
+float2 uv : TEXCOORD0;
+};
+
+//output 
+
+	struct VS_OUTPUT{
+		 float4 Position : SV_POSITION; 
+		float4 packed0 : TEXCOORD0; // normal_w
+		float4 packed1 : TEXCOORD1; // vertex_color
+		float4 packed2 : TEXCOORD2; // uv
+};
+
+VS_OUTPUT ShadowVS(VS_INPUT input)
+{
+
+	struct {
+		float2 uv;
+	} context;
+
+	//context population 
+	context.uv = input.uv;
+
+
+	VS_OUTPUT output;
+
+	output.Position = mul(mul(input.Position, World), LightViewProjection);
+
+	output.packed2.xy = context.uv;
+	return output;
+}
+
+//texture inputs 
+//sampler inputs 
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float4 packed0 : TEXCOORD0; // normal_w
+float4 packed1 : TEXCOORD1; // vertex_color
+float4 packed2 : TEXCOORD2; // uv
+};
+
+float4 ColorPS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float3 vertex_color;
+	} context;
+
+	//context population 
+	context.vertex_color = input.packed1.xyz;
+
+
+	return float4(context.vertex_color, 1);
+}
+
+//texture inputs 
+//sampler inputs 
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float4 packed0 : TEXCOORD0; // normal_w
+float4 packed1 : TEXCOORD1; // vertex_color
+float4 packed2 : TEXCOORD2; // uv
+};
+
+float4 NormalPS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float3 normal_w;
+		float2 uv;
+	} context;
+
+	//context population 
+	context.normal_w = input.packed0.xyz;
+	context.uv = input.packed2.xy;
+
+
+	return float4(context.normal_w * context.uv.x, 1);
+}
@@ -0,0 +1,38 @@
+//texture inputs 
+//sampler inputs 
+//input 
+struct PS_INPUT { 
+float4 Position : SV_POSITION;
+float2 uv : TEXCOORD0;
+};
+
+float4 PS(PS_INPUT input) : SV_Target
+{
+
+	struct {
+		float alpha;
+		float2 uv;
+	} context;
+
+	//context population 
+	context.uv = input.uv;
+
+
+	float4 color = float4(context.uv, 0, 1);
+
+{ // AlphaClipped
+	if(context.uv.x < 0.5f)
+	{
+		context.alpha = 0;
+	}
+	else
+	{
+		context.alpha = context.uv.y;
+	}
+}
+
+	{ // conditional if on semantic ALPHA
+		color.a = context.alpha;
+	}
+	return color;
+}
@@ -0,0 +1,314 @@
+//
+// Copyright 2012 Stoyan Nikolov. All rights reserved.
+// Licensed under: http://www.opensource.org/licenses/BSD-2-Clause
+//
+#include "stdafx.h"
+
+#include "ShaderTranslator.h"
+#include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationDiskCache.h"
+#include "ShaderTranslationThreadPool.h"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace translator;
+
+namespace fs = boost::filesystem;
+
+namespace
+{
+
+struct Options
+{
+	Options()
+		: Pack(false)
+		, Link(false)
+	{}
+
+	std::vector<ShaderTranslationUniverse::LibraryFile> Library;
+	std::string Shader;
+	std::string Expected;
+	std::string Snapshot;
+	ShaderTranslationParams Params;
+	bool Pack;
+	bool Link;
+};
+
+void PrintUsage()
+{
+	std::cerr << "Usage: TranslatorTests translate [options] SHADER EXPECTED [Polymorphic=Atom ...]\n"
+		<< "Translates the shader and compares the result with the expected file. A failed translation\n"
+		<< "is compared as the line \"error N\", N being the ShaderTranslator error code.\n"
+		<< "  --semantics FILE   a semantics library, may be repeated\n"
+		<< "  --atoms FILE       an atoms library, may be repeated\n"
+		<< "  --combinators FILE a combinators library, may be repeated\n"
+		<< "  --pack             pack the interpolators passed between the stages\n"
+		<< "  --link             link the vertex shaders to the pixel shaders\n"
+		<< "  --snapshot FILE    translate with the universe loaded from a snapshot of it saved to the file\n"
+		<< "       TranslatorTests disk-cache DIRECTORY\n"
+		<< "Stores to and collects a disk cache in the directory concurrently and checks what is left.\n";
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+	if(argc < 2 || std::string(argv[1]) != "translate")
+	{
+		return false;
+	}
+
+	for(int i = 2; i < argc; ++i)
+	{
+		const std::string name = argv[i];
+		ShaderTranslationUniverse::LibraryFile file;
+		if((name == "--semantics" || name == "--atoms" || name == "--combinators") && i + 1 < argc)
+		{
+			file.Path = argv[++i];
+			file.Content = name == "--semantics" ? ShaderTranslationUniverse::SemanticsLibrary
+				: name == "--atoms" ? ShaderTranslationUniverse::AtomsLibrary
+				: ShaderTranslationUniverse::CombinatorsLibrary;
+			options.Library.push_back(file);
+		}
+		else if(name == "--pack")
+		{
+			options.Pack = true;
+		}
+		else if(name == "--link")
+		{
+			options.Link = true;
+		}
+		else if(name == "--snapshot" && i + 1 < argc)
+		{
+			options.Snapshot = argv[++i];
+		}
+		else if(name.find('=') != std::string::npos)
+		{
+			const size_t separator = name.find('=');
+			options.Params.insert(std::make_pair(String(name.substr(0, separator).c_str()), String(name.substr(separator + 1).c_str())));
+		}
+		else if(name[0] != '-' && options.Shader.empty())
+		{
+			options.Shader = name;
+		}
+		else if(name[0] != '-' && options.Expected.empty())
+		{
+			options.Expected = name;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return !options.Shader.empty() && !options.Expected.empty();
+}
+
+std::string ReadWholeFile(const std::string& path)
+{
+	std::ifstream fin(path.c_str(), std::ios::binary);
+	if(!fin.is_open())
+	{
+		throw std::runtime_error("Unable to open " + path);
+	}
+	return std::string(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+}
+
+std::string RemoveCarriageReturns(std::string text)
+{
+	text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
+	return text;
+}
+
+// Reports the first line that differs. The text copied from the shader keeps the line endings
+// it was checked out with, so CRLF and LF count as the same.
+bool Compare(const std::string& expected, const std::string& actual)
+{
+	const std::string expectedText = RemoveCarriageReturns(expected);
+	const std::string actualText = RemoveCarriageReturns(actual);
+	if(expectedText == actualText)
+	{
+		return true;
+	}
+
+	std::istringstream expectedLines(expectedText);
+	std::istringstream actualLines(actualText);
+	std::string expectedLine;
+	std::string actualLine;
+	for(unsigned line = 1; ; ++line)
+	{
+		const bool hasExpected = bool(std::getline(expectedLines, expectedLine));
+		const bool hasActual = bool(std::getline(actualLines, actualLine));
+		if(!hasExpected || !hasActual || expectedLine != actualLine)
+		{
+			std::cerr << "Line " << line << " differs\n"
+				<< "  expected: " << (hasExpected ? expectedLine : "<end of file>") << "\n"
+				<< "  actual:   " << (hasActual ? actualLine : "<end of file>") << std::endl;
+			break;
+		}
+	}
+	return false;
+}
+
+DiskCacheKey MakeKey(unsigned index)
+{
+	const DiskCacheKey key = { index, index * 31ull, 7 };
+	return key;
+}
+
+// Collections run while the entries are stored - none may remove a file a writer is still writing
+bool CheckDiskCache(const std::string& directory)
+{
+	static const unsigned ENTRY_COUNT = 256;
+	const std::string payload(1024, 'x');
+
+	boost::system::error_code error;
+	fs::remove_all(directory, error);
+	DiskTranslationCache cache(directory);
+
+	std::atomic<bool> storing(true);
+	std::atomic<unsigned> collections(0);
+	boost::thread collector([&]()
+	{
+		while(storing)
+		{
+			cache.Collect((unsigned long long)-1);
+			++collections;
+		}
+	});
+
+	std::atomic<unsigned> failed(0);
+	TranslationThreadPool pool(4);
+	pool.ParallelFor(ENTRY_COUNT, [&](unsigned index, unsigned)
+	{
+		if(!cache.Store(MakeKey(index), payload))
+		{
+			++failed;
+		}
+	});
+	storing = false;
+	collector.join();
+
+	std::string output;
+	unsigned found = 0;
+	for(unsigned index = 0; index < ENTRY_COUNT; ++index)
+	{
+		found += cache.Find(MakeKey(index), output) && output == payload;
+	}
+	if(failed || found != ENTRY_COUNT)
+	{
+		std::cerr << failed << " stores failed and " << found << " of " << ENTRY_COUNT
+			<< " entries were found after " << collections << " concurrent collections" << std::endl;
+		return false;
+	}
+
+	// A crashed writer leaves its temporary file behind
+	const fs::path leftOver = fs::path(directory) / "crashed.tmp";
+	std::ofstream(leftOver.string().c_str()) << payload;
+
+	unsigned long long total = 0;
+	for(fs::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+	{
+		if(it->path().extension() == ".hlsl")
+		{
+			total += fs::file_size(it->path(), error);
+		}
+	}
+	if(error || !cache.Collect(total / 2))
+	{
+		std::cerr << "Unable to collect the cache" << std::endl;
+		return false;
+	}
+	found = 0;
+	for(unsigned index = 0; index < ENTRY_COUNT; ++index)
+	{
+		found += cache.Find(MakeKey(index), output);
+	}
+	if(fs::exists(leftOver) || found != ENTRY_COUNT / 2)
+	{
+		std::cerr << "Collecting down to half the entries left " << found << " of them"
+			<< (fs::exists(leftOver) ? " and the temporary file" : "") << std::endl;
+		return false;
+	}
+
+	cache.Collect(0);
+	for(unsigned index = 0; index < ENTRY_COUNT; ++index)
+	{
+		if(cache.Find(MakeKey(index), output))
+		{
+			std::cerr << "Collecting down to nothing left entry " << index << std::endl;
+			return false;
+		}
+	}
+
+	fs::remove_all(directory, error);
+	return true;
+}
+
+}
+
+int main(int argc, char* argv[])
+try
+{
+	if(argc == 3 && std::string(argv[1]) == "disk-cache")
+	{
+		return CheckDiskCache(argv[2]) ? 0 : 1;
+	}
+
+	Options options;
+	if(!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	ShaderTranslationUniverse universe;
+	if(universe.AddLibraryFiles(options.Library) != ShaderTranslationUniverse::Ok)
+	{
+		throw std::runtime_error("Unable to load the universe: " + universe.GetLastError());
+	}
+
+	ShaderTranslationUniverse loaded;
+	if(!options.Snapshot.empty())
+	{
+		if(universe.SaveSnapshot(options.Snapshot.c_str()) != ShaderTranslationUniverse::Ok
+			|| loaded.LoadSnapshot(options.Snapshot.c_str()) != ShaderTranslationUniverse::Ok)
+		{
+			throw std::runtime_error("Unable to load the snapshot: " + universe.GetLastError() + loaded.GetLastError());
+		}
+	}
+
+	ShaderTranslator translator;
+	translator.SetInterpolatorPacking(options.Pack);
+	translator.SetStageLinking(options.Link);
+
+	const std::string shader = ReadWholeFile(options.Shader);
+	std::string output;
+	const ShaderTranslator::ShaderTranslatorError error = translator.TranslateToHLSL(shader, options.Params, options.Snapshot.empty() ? &universe : &loaded, output);
+	if(error != ShaderTranslator::Ok)
+	{
+		std::ostringstream result;
+		result << "error " << error << "\n";
+		output = result.str();
+		std::cerr << "Translation failed: " << translator.GetLastError() << std::endl;
+	}
+
+	if(!options.Snapshot.empty())
+	{
+		// Modifying the loaded universe hashes the maps read back from the snapshot
+		loaded.AddSemantics("");
+		if(loaded.GetContentHash() != universe.GetContentHash())
+		{
+			std::cerr << "The universe read back from the snapshot differs from the saved one" << std::endl;
+			return 1;
+		}
+	}
+
+	return Compare(ReadWholeFile(options.Expected), output) ? 0 : 1;
+}
+catch(std::exception& ex)
+{
+	std::cerr << "Exception: " << ex.what() << std::endl;
+	return 1;
+}
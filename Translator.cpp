@@ -6,105 +6,323 @@
 
 #include "ShaderTranslator.h"
 #include "ShaderTranslationUniverse.h"
+#include "ShaderTranslationManifest.h"
+#include "ShaderTranslationThreadPool.h"
+#include "ShaderTranslationUtilities.h"
+
+#include <boost/filesystem.hpp>
 
 #include <iostream>
 #include <fstream>
-#include <exception>
+#include <stdexcept>
 
 using namespace translator;
 
-struct TestCase
+struct Options
 {
-	std::string FileName;
-	std::string OutputName;
-	ShaderTranslationParams Params;
+	Options()
+		: Manifest("Tests/manifest.txt")
+		, Threads(0)
+		, Force(false)
+		, Pack(false)
+		, Link(false)
+	{}
+
+	std::string Manifest;
+	std::string State;
+	unsigned Threads;
+	bool Force;
+	bool Pack;
+	bool Link;
 };
 
-enum Test
+void PrintUsage()
 {
-	TE_GBufferPS,
-	TE_LightPass,
+	std::cerr << "Usage: Translator [options] [manifest]\n"
+		<< "Translates the shaders of the manifest (Tests/manifest.txt by default) in parallel,\n"
+		<< "skipping the outputs whose shader, bindings and used universe definitions did not change since the last run.\n"
+		<< "  --state FILE       where the last run is remembered, the manifest path with .state appended by default\n"
+		<< "  --threads N        workers, 0 for one per hardware thread\n"
+		<< "  --force            translate every entry\n"
+		<< "  --pack             pack the interpolators passed between the stages into float4s\n"
+		<< "  --link             drop the vertex shader outputs the pixel shaders of the same file don't read\n";
+}
 
-	TE_Count
-};
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+	bool manifest = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		const std::string name = argv[i];
+		if(name == "--state" && i + 1 < argc)
+		{
+			options.State = argv[++i];
+		}
+		else if(name == "--threads" && i + 1 < argc)
+		{
+			options.Threads = unsigned(strtoul(argv[++i], nullptr, 10));
+		}
+		else if(name == "--force")
+		{
+			options.Force = true;
+		}
+		else if(name == "--pack")
+		{
+			options.Pack = true;
+		}
+		else if(name == "--link")
+		{
+			options.Link = true;
+		}
+		else if(name[0] != '-' && !manifest)
+		{
+			options.Manifest = name;
+			manifest = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
 
-TestCase Cases[TE_Count];
+	if(options.State.empty())
+	{
+		options.State = options.Manifest + ".state";
+	}
+	return true;
+}
 
-void FillTestCases()
+// Every distinct shader of the manifest is mapped and parsed once
+struct ShaderSource
 {
-	Cases[TE_GBufferPS].FileName = "Tests/GBuffer_PS.txt";
-	Cases[TE_GBufferPS].OutputName = "Tests/output.txt";
-	Cases[TE_GBufferPS].Params.insert(std::make_pair("MakeDepth", "CalculateProjectionDepth"));
-	Cases[TE_GBufferPS].Params.insert(std::make_pair("GetWorldNormal", "NormalFromMap"));
-
-	Cases[TE_LightPass].FileName = "Tests/LightPass.txt";
-	Cases[TE_LightPass].OutputName = "Tests/output.txt";
-	Cases[TE_LightPass].Params.insert(std::make_pair("GetAlpha", "AlphaFromMap"));
-	Cases[TE_LightPass].Params.insert(std::make_pair("GetAlbedo", "AlbedoFromMap"));
-	Cases[TE_LightPass].Params.insert(std::make_pair("GetSpecularColor", "SpecularFromMap"));
-}
+	ShaderSource()
+		: Hash(0)
+		, Needed(false)
+	{}
 
-std::string ReadWholeFile(const std::string& filename)
+	std::string Path;
+	ShaderSourceFile File;
+	unsigned long long Hash;
+	bool Needed;
+	ParsedShaderPtr Parsed;
+	std::string Error;
+};
+
+struct EntryResult
 {
-	std::ifstream fin(filename.c_str());
+	EntryResult()
+		: Shader(0)
+		, Key(0)
+		, Dirty(false)
+		, Succeeded(false)
+	{}
 
-	if(!fin.is_open())
+	unsigned Shader;
+	unsigned long long Key;
+	bool Dirty;
+	bool Succeeded;
+	std::string Error;
+	TranslationDependencies Dependencies;
+};
+
+bool WriteOutput(const std::string& path, const std::string& output)
+{
+	boost::system::error_code error;
+	const boost::filesystem::path parent = boost::filesystem::path(path).parent_path();
+	if(!parent.empty())
 	{
-		throw std::exception("Unable to open file");
+		boost::filesystem::create_directories(parent, error);
 	}
 
-	return std::string(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+	// The text copied from a mapped shader keeps its CRLF endings, which a text mode write would double
+	std::ofstream fout(path.c_str(), std::ios::binary | std::ios::trunc);
+	fout << output;
+	return bool(fout.flush());
 }
 
 int main(int argc, char* argv[])
 try
 {
-	FillTestCases();
-	Test currentTest = TE_LightPass;
+	Options options;
+	if(!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
 
-	ShaderTranslationUniverse universe;
-	
-	auto semantics = ReadWholeFile("Tests/semantics.txt");
-	auto error = universe.AddSemantics(semantics.c_str());
-	if(error != ShaderTranslationUniverse::Ok)
+	TranslationManifest manifest;
+	std::string manifestError;
+	if(!ReadManifest(options.Manifest, manifest, manifestError))
 	{
-		std::cerr << "Unable to read semantics: " << universe.GetLastError() << std::endl;
+		throw std::runtime_error(manifestError);
 	}
 
-	auto atoms = ReadWholeFile("Tests/atoms.txt");
-	error = universe.AddAtoms(atoms.c_str());
-	if(error != ShaderTranslationUniverse::Ok)
+	TranslationBuildState state;
+	if(!options.Force && !state.Load(options.State))
 	{
-		std::cerr << "Unable to read atoms: " << universe.GetLastError() << std::endl;
+		std::cerr << "Ignoring the unreadable state " << options.State << std::endl;
 	}
+	state.Retain(manifest);
+
+	TranslationThreadPool pool(options.Threads);
 
-	auto combinators = ReadWholeFile("Tests/combinators.txt");
-	error = universe.AddCombinators(combinators.c_str());
-	if(error != ShaderTranslationUniverse::Ok)
+	ShaderTranslationUniverse universe;
+	if(universe.AddLibraryFiles(manifest.Library, &pool) != ShaderTranslationUniverse::Ok)
 	{
-		std::cerr << "Unable to read combinators: " << universe.GetLastError() << std::endl;
+		throw std::runtime_error("Unable to load the universe: " + universe.GetLastError());
 	}
+	universe.Freeze();
 
-	ShaderTranslator transl;
+	// Only the outputs that used an edited definition have to be translated again
+	UniverseDigest digest;
+	BuildUniverseDigest(universe, digest);
+	UniverseDiff diff;
+	DiffUniverses(state.GetUniverse(), digest, diff);
+	std::set<std::string> affected;
+	state.FindAffected(diff, affected);
 
-	auto shader = ReadWholeFile(Cases[currentTest].FileName);
-	std::string output;
-		
-	auto translError =  transl.TranslateToHLSL(shader, Cases[currentTest].Params, &universe, output);
-	if(translError != ShaderTranslator::Ok)
+	std::vector<ShaderSource> shaders;
+	std::vector<EntryResult> results(manifest.Entries.size());
+	std::map<std::string, unsigned> shaderIndices;
+	for(size_t i = 0; i < manifest.Entries.size(); ++i)
 	{
-		std::cerr << "Unable to translate shader: " << transl.GetLastError() << std::endl;
+		auto inserted = shaderIndices.insert(std::make_pair(manifest.Entries[i].Shader, unsigned(shaders.size())));
+		if(inserted.second)
+		{
+			shaders.push_back(ShaderSource());
+			shaders.back().Path = manifest.Entries[i].Shader;
+		}
+		results[i].Shader = inserted.first->second;
 	}
 
-	std::ofstream fout(Cases[currentTest].OutputName);
-	fout << output;
+	pool.ParallelFor(unsigned(shaders.size()), [&](unsigned index, unsigned)
+	{
+		ShaderSource& shader = shaders[index];
+		if(!shader.File.Open(shader.Path.c_str()))
+		{
+			shader.Error = shader.File.GetLastError();
+			return;
+		}
+		const SourceView source = shader.File.GetView();
+		shader.Hash = HashBytes(source.GetData(), source.GetSize());
+	});
+
+	// Only the shaders with outputs to translate are parsed
+	unsigned dirty = 0;
+	for(size_t i = 0; i < manifest.Entries.size(); ++i)
+	{
+		const ManifestEntry& entry = manifest.Entries[i];
+		EntryResult& result = results[i];
+		ShaderSource& shader = shaders[result.Shader];
+		if(!shader.Error.empty())
+		{
+			result.Dirty = true;
+			++dirty;
+			continue;
+		}
+
+		result.Key = MakeBuildKey(shader.Hash, entry.Params);
+		// The same bindings produce a different output when packed or linked
+		if(options.Pack)
+		{
+			result.Key = HashBytes("pack", 4, result.Key);
+		}
+		if(options.Link)
+		{
+			result.Key = HashBytes("link", 4, result.Key);
+		}
+		result.Dirty = options.Force || !state.IsUpToDate(entry.Output, result.Key) || affected.count(entry.Output);
+		shader.Needed |= result.Dirty;
+		dirty += result.Dirty;
+	}
+
+	std::vector<std::unique_ptr<ShaderTranslator>> translators(pool.GetWorkerCount());
+	for(auto translator = translators.begin(); translator != translators.end(); ++translator)
+	{
+		translator->reset(new ShaderTranslator);
+		(*translator)->SetInterpolatorPacking(options.Pack);
+		(*translator)->SetStageLinking(options.Link);
+	}
 
-	std::cout << "Resulting shader: " << std::endl;
-	std::cout << output;
+	pool.ParallelFor(unsigned(shaders.size()), [&](unsigned index, unsigned worker)
+	{
+		ShaderSource& shader = shaders[index];
+		if(!shader.Needed)
+		{
+			return;
+		}
+		if(translators[worker]->ParseShader(shader.File, &universe, shader.Parsed) != ShaderTranslator::Ok)
+		{
+			shader.Error = translators[worker]->GetLastError();
+		}
+	});
+
+	pool.ParallelFor(unsigned(results.size()), [&](unsigned index, unsigned worker)
+	{
+		const ManifestEntry& entry = manifest.Entries[index];
+		EntryResult& result = results[index];
+		const ShaderSource& shader = shaders[result.Shader];
+		if(!result.Dirty)
+		{
+			return;
+		}
+		if(!shader.Error.empty())
+		{
+			result.Error = shader.Error;
+			return;
+		}
+
+		std::string output;
+		ShaderTranslator& translator = *translators[worker];
+		if(translator.Instantiate(*shader.Parsed, entry.Params, output, nullptr, &result.Dependencies) != ShaderTranslator::Ok)
+		{
+			result.Error = translator.GetLastError();
+		}
+		else if(!WriteOutput(entry.Output, output))
+		{
+			result.Error = "Unable to write " + entry.Output;
+		}
+		else
+		{
+			result.Succeeded = true;
+		}
+	});
+
+	// Failed outputs are translated again on the next run
+	unsigned failed = 0;
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const ManifestEntry& entry = manifest.Entries[i];
+		const EntryResult& result = results[i];
+		if(!result.Dirty)
+		{
+			continue;
+		}
+		if(result.Succeeded)
+		{
+			state.Update(entry.Output, result.Key, result.Dependencies);
+		}
+		else
+		{
+			state.Remove(entry.Output);
+			std::cerr << options.Manifest << "(" << entry.Line << "): " << entry.Shader << ": " << result.Error << std::endl;
+			++failed;
+		}
+	}
+
+	// The outputs left alone did not use anything that changed, so their dependencies still hold
+	state.SetUniverse(digest);
+	if(!state.Save(options.State))
+	{
+		std::cerr << "Unable to write the state " << options.State << std::endl;
+	}
 
-	return 0;
+	std::cout << "Translated " << (dirty - failed) << ", up to date " << (results.size() - dirty)
+		<< ", failed " << failed << std::endl;
+	return failed ? 1 : 0;
 }
 catch(std::exception& ex)
 {
 	std::cerr << "Exception: " << ex.what() << std::endl;
+	return 1;
 }
@@ -5,6 +5,11 @@
 #pragma once
 
 #include <string>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -14,4 +19,5 @@
 #include <regex>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/dynamic_bitset.hpp>
 #include <boost/thread.hpp>
\ No newline at end of file